@@ -28,14 +28,26 @@
 #include "globaldefs.hpp"
 #include "Streams.hpp"
 
+#include <utility>
 #include <vector>
 
 namespace bwtc {
 
+namespace {
+
+uint64 readPosition(InStream* in, int bits) {
+  uint64 pos = 0;
+  for(int j = 0; j < bits; ++j)
+    pos = (pos << 1) | (in->readBit() ? 1 : 0);
+  return pos;
+}
+
+} //namespace
+
 BWTBlock::BWTBlock()
     : m_begin(0), m_length(0), m_isTransformed(true) {}
 
-BWTBlock::BWTBlock(byte *data, uint32 length, bool isTransformed)
+BWTBlock::BWTBlock(byte *data, uint64 length, bool isTransformed)
     : m_begin(data), m_length(length), m_isTransformed(isTransformed) {}
 
 BWTBlock::BWTBlock(const BWTBlock& b)
@@ -50,14 +62,20 @@ BWTBlock& BWTBlock::operator=(const BWTBlock& b) {
   return *this;
 }
 
+const uint32 BWTBlock::kWidePositions;
+const int BWTBlock::kWidePositionBits;
+
 void BWTBlock::setBegin(byte* begin) {
   m_begin = begin;
 }
 
-void BWTBlock::setSize(uint32 length) {
+void BWTBlock::setSize(uint64 length) {
   m_length = length;
 }
 
+/* Starting points are written in 31 bits each. For the blocks larger than
+ * kMaxSmallBlockSize the positions are preceded by kWidePositions and
+ * written in kWidePositionBits bits. */
 size_t BWTBlock::writeHeader(OutStream* out) const {
   if(verbosity > 2) {
     std::clog << "Writing " << m_LFpowers.size() << " starting points."
@@ -67,9 +85,18 @@ size_t BWTBlock::writeHeader(OutStream* out) const {
   byte s = (byte)(m_LFpowers.size()-1);
   out->writeByte(s);
   int bitsLeft = 8;
-  for(size_t i = 0; i < m_LFpowers.size(); ++i) {
-    for(int j = 30; j >= 0; --j) {
-      s = (s << 1) | ((m_LFpowers[i] >> j) & 0x1);
+  std::vector<std::pair<uint64, int> > fields;
+  if(m_length > kMaxSmallBlockSize) {
+    fields.push_back(std::make_pair(kWidePositions, 31));
+    for(size_t i = 0; i < m_LFpowers.size(); ++i)
+      fields.push_back(std::make_pair(m_LFpowers[i], kWidePositionBits));
+  } else {
+    for(size_t i = 0; i < m_LFpowers.size(); ++i)
+      fields.push_back(std::make_pair(m_LFpowers[i], 31));
+  }
+  for(size_t i = 0; i < fields.size(); ++i) {
+    for(int j = fields[i].second - 1; j >= 0; --j) {
+      s = (s << 1) | ((fields[i].first >> j) & 0x1);
       --bitsLeft;
       if(bitsLeft == 0) {
         out->writeByte(s);
@@ -92,12 +119,14 @@ void BWTBlock::readHeader(InStream* in) {
               << std::endl;
   }
   m_LFpowers.resize(LFpows);
-  for(uint32 i = 0; i < LFpows; ++i) {
-    uint32 pos = 0;
-    for(uint32 j = 0; j < 31; ++j)
-      pos = (pos << 1) | (in->readBit() ? 1 : 0);
-    m_LFpowers[i] = pos;
+  int bits = 31;
+  uint64 first = readPosition(in, bits);
+  if(first == kWidePositions) {
+    bits = kWidePositionBits;
+    first = readPosition(in, bits);
   }
+  m_LFpowers[0] = first;
+  for(uint32 i = 1; i < LFpows; ++i) m_LFpowers[i] = readPosition(in, bits);
   in->flushBuffer();
 }
 
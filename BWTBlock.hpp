@@ -36,10 +36,20 @@
 
 namespace bwtc {
 
+/**Largest block whose transform fits into 32-bit suffix array (including
+ * the end-of-block character). Larger blocks are transformed and inverted
+ * with 64-bit indices, and their starting points are stored in wider
+ * fields of the block header. */
+const uint64 kMaxSmallBlockSize = 0x7fffffff - 1;
+
+/**Largest block size supported at all. It leaves room for the expansion of
+ * the block in the 48-bit length field of the compressed block. */
+const uint64 kMaxBlockSize = static_cast<uint64>(1) << 44;
+
 class BWTBlock {
  public:
   BWTBlock();
-  BWTBlock(byte *data, uint32 length, bool isTransformed);
+  BWTBlock(byte *data, uint64 length, bool isTransformed);
   BWTBlock(const BWTBlock& b);
   BWTBlock& operator=(const BWTBlock& b);
 
@@ -55,19 +65,26 @@ class BWTBlock {
   const byte* begin() const { return m_begin; }
   byte* end() { return m_begin + m_length; }
   const byte* end() const { return m_begin + m_length; }
-  std::vector<uint32>& LFpowers() { return m_LFpowers; }
+  std::vector<uint64>& LFpowers() { return m_LFpowers; }
+  const std::vector<uint64>& LFpowers() const { return m_LFpowers; }
 
   void setBegin(byte* begin);
-  void setSize(uint32 length);
+  void setSize(uint64 length);
 
   void prepareLFpowers(uint32 startingPoints);
   size_t writeHeader(OutStream *out) const;
   void readHeader(InStream *in);
   
  private:
+  /* Value of the first 31-bit starting point which tells that the starting
+   * points are stored in kWidePositionBits bits. Positions of the small
+   * blocks never have this value. */
+  static const uint32 kWidePositions = 0x7fffffff;
+  static const int kWidePositionBits = 48;
+
   byte *m_begin;
-  uint32 m_length;
-  std::vector<uint32> m_LFpowers;
+  uint64 m_length;
+  std::vector<uint64> m_LFpowers;
   bool m_isTransformed;
 };
 
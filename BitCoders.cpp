@@ -53,31 +53,9 @@ extern int statistics;
  * a new input byte.
  */
 
-namespace {
-/* Split a range [low,high] into [low,split] and [split+1,high]
- * proportional to the probability and its complement. */
-uint32 Split(uint32 low, uint32 high, uint32 probability) {
-  assert(probability <= kProbabilityScale);
-  assert(low < high);
-  /* range_size is high-low-1 rather than high-low+1 to ensure that
-   * neither subrange is empty, even when probability is 0 and 1. */
-  uint32 range_size = high - low - 1;
-  /* split = low + round(range_size * p)
-   *       = low + floor(range_size * p + .5)
-   * where p is the probability as a real value. */
-  uint32 high_bits = range_size >> kLogProbabilityScale;
-  uint32 low_bits = range_size & (kProbabilityScale - 1);
-  uint32 half = kProbabilityScale >> 1;
-  uint32 split = low + high_bits * probability
-      + ((low_bits * probability + half) >> kLogProbabilityScale);
-  assert(split >= low);
-  assert(split < high);
-  return split;
-}
-}  // namespace
-
 BitEncoder::BitEncoder()
-    : m_low(0), m_high(0xFFFFFFFF), m_counter(0), m_output(NULL) {}
+    : m_low(0), m_high(0xFFFFFFFF), m_counter(0), m_output(NULL),
+      m_window(NULL), m_pos(NULL), m_end(NULL) {}
 
 BitEncoder::~BitEncoder() { }
 
@@ -106,14 +84,37 @@ void BitEncoder::finish() {
   emitByte(255);
   emitByte(255);
   emitByte(255);
+  releaseWindow();
   m_output->flush();
   /* Prepare to encode another sequence. */
   m_low = 0;
   m_high = 0xFFFFFFFF;
 }
 
+/* Streams without windows give an empty one, in which case the bytes go
+ * through the stream one by one. */
+void BitEncoder::emitByteToNewWindow(byte b) {
+  releaseWindow();
+  m_window = m_pos = m_output->writeWindow(&m_end);
+  if (m_pos != m_end) {
+    *m_pos++ = b;
+  } else {
+    m_output->writeByte(b);
+    ++m_counter;
+  }
+}
+
+void BitEncoder::releaseWindow() {
+  if (m_window) {
+    m_counter += m_pos - m_window;
+    m_output->releaseWriteWindow(m_pos);
+  }
+  m_window = m_pos = m_end = NULL;
+}
+
 BitDecoder::BitDecoder() :
-    m_low(0), m_high(0xFFFFFFFF), m_next(0), m_input(NULL) {}
+    m_low(0), m_high(0xFFFFFFFF), m_next(0), m_input(NULL),
+    m_window(NULL), m_pos(NULL), m_end(NULL) {}
 
 BitDecoder::~BitDecoder() { }
 
@@ -126,6 +127,22 @@ void BitDecoder::start() {
   m_next = (m_next << 8) + readByte();
 }
 
+void BitDecoder::finish() {
+  releaseWindow();
+}
+
+byte BitDecoder::readByteFromNewWindow() {
+  releaseWindow();
+  m_window = m_pos = m_input->readWindow(&m_end);
+  if (m_pos != m_end) return *m_pos++;
+  return m_input->readByte();
+}
+
+void BitDecoder::releaseWindow() {
+  if (m_window) m_input->releaseReadWindow(m_pos);
+  m_window = m_pos = m_end = NULL;
+}
+
 bool BitDecoder::decode(Probability probability_of_one) {
   uint32 split = Split(m_low, m_high, probability_of_one);
   bool bit = (m_next <= split);
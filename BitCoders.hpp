@@ -30,7 +30,9 @@
 
 #include <string>
 #include <cassert>
-
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 
 #include "Streams.hpp"
 #include "globaldefs.hpp" /* Important definitions */
@@ -49,6 +51,27 @@ using bwtc::verbosity;
 /* Probabilities are encoded as integers in [0,kProbabilityScale]
  * with p representing the probability p/kProbabilityScale. */
 
+/* Split a range [low,high] into [low,split] and [split+1,high]
+ * proportional to the probability and its complement. */
+inline uint32 Split(uint32 low, uint32 high, uint32 probability) {
+  assert(probability <= kProbabilityScale);
+  assert(low < high);
+  /* range_size is high-low-1 rather than high-low+1 to ensure that
+   * neither subrange is empty, even when probability is 0 and 1. */
+  uint32 range_size = high - low - 1;
+  /* split = low + round(range_size * p)
+   *       = low + floor(range_size * p + .5)
+   * where p is the probability as a real value. */
+  uint32 high_bits = range_size >> kLogProbabilityScale;
+  uint32 low_bits = range_size & (kProbabilityScale - 1);
+  uint32 half = kProbabilityScale >> 1;
+  uint32 split = low + high_bits * probability
+      + ((low_bits * probability + half) >> kLogProbabilityScale);
+  assert(split >= low);
+  assert(split < high);
+  return split;
+}
+
 /**
  * Entropy compressor for a sequence of bits.
  * Given a probility distribution for each bit in the sequence,
@@ -80,18 +103,25 @@ class BitEncoder {
 
   /* Measures length of compressed sequence in bytes */
   inline void resetCounter() { m_counter = 0; }
-  inline uint64 counter() { return m_counter; }
+  inline uint64 counter() { return m_counter + (m_pos - m_window); }
 
  private:
   uint32 m_low;
   uint32 m_high;
   uint64 m_counter;
   bwtc::OutStream* m_output;
+  /* Output bytes are written straight into the window of the stream,
+   * which is held until finish(). */
+  byte* m_window;
+  byte* m_pos;
+  byte* m_end;
 
   inline void emitByte(unsigned char byte) {
-    m_output->writeByte(byte);
-    ++m_counter;
+    if (m_pos != m_end) *m_pos++ = byte;
+    else emitByteToNewWindow(byte);
   }
+  void emitByteToNewWindow(byte b);
+  void releaseWindow();
   BitEncoder(const BitEncoder&);
   BitEncoder& operator=(const BitEncoder&);
 };
@@ -109,10 +139,10 @@ class BitDecoder {
   //TODO: Do we need Disconnect()?
   //bwtc::InStream* Disconnect() { return input_.Disconnect(); }
 
-  /* start() must be called to start the decoding of a sequence.
-   * Nothing needs to be called to finish the decoding, but start()
-   * must be called again when starting to decode a new sequence.  */
+  /* start() must be called to start the decoding of a sequence and
+   * finish() to end it, before the input is used for anything else.  */
   void start();
+  void finish();
 
   /* Get the next bit of the uncompressed sequence.
    * The probability distribution must be the same as the one used
@@ -124,12 +154,207 @@ class BitDecoder {
   uint32 m_high;
   uint32 m_next;
   bwtc::InStream* m_input;
+  /* Input bytes are read straight from the window of the stream, which is
+   * held until finish(). */
+  const byte* m_window;
+  const byte* m_pos;
+  const byte* m_end;
 
-  byte readByte() { return m_input->readByte(); }
+  byte readByte() {
+    if (m_pos != m_end) return *m_pos++;
+    return readByteFromNewWindow();
+  }
+  byte readByteFromNewWindow();
+  void releaseWindow();
   BitDecoder(const BitDecoder&);
   BitDecoder& operator=(const BitDecoder&);
 };
 
+/*********************************************************************
+ * Interleaved versions of BitEncoder and BitDecoder.                *
+ *                                                                   *
+ * The bits of the sequence are distributed to Lanes independent     *
+ * range coders in round-robin fashion: bit i goes to the lane       *
+ * i mod Lanes. Every bit of a single coder depends on the range     *
+ * left by the previous bit, but the lanes don't depend on each      *
+ * other, so the CPU can work on several bits at the same time.      *
+ *                                                                   *
+ * Lanes are written into their own buffers. finish() writes the     *
+ * lengths of the lanes (7 bits per byte, the most significant bit   *
+ * tells if more bytes follow) and after them the contents of the    *
+ * lanes one after another.                                          *
+ *********************************************************************/
+template <unsigned Lanes>
+class InterleavedBitEncoder {
+ public:
+  InterleavedBitEncoder() : m_lane(0), m_counter(0), m_output(NULL) {
+    resetLanes();
+  }
+
+  void connect(bwtc::OutStream* out) { m_output = out; }
+
+  /* See BitEncoder::encode. */
+  void encode(bool bit, Probability probability_of_one) {
+    Lane& lane = m_lanes[m_lane];
+    if (++m_lane == Lanes) m_lane = 0;
+    uint32 split = Split(lane.low, lane.high, probability_of_one);
+    if (bit) lane.high = split; else lane.low = split + 1;
+    while (((lane.low ^ lane.high) & 0xFF000000) == 0) {
+      lane.bytes.push_back(static_cast<byte>(lane.low >> 24));
+      lane.low <<= 8;
+      lane.high = (lane.high << 8) + 255;
+    }
+    assert(lane.low < lane.high);
+  }
+
+  /* Writes the lanes into the output stream. After the call, encoder is
+   * ready to start encoding a new sequence. */
+  void finish() {
+    for (unsigned i = 0; i < Lanes; ++i) {
+      Lane& lane = m_lanes[i];
+      lane.bytes.push_back(static_cast<byte>(lane.low >> 24));
+      lane.bytes.insert(lane.bytes.end(), 3, 255);
+      uint64 length = lane.bytes.size();
+      while (length >= 0x80) {
+        emitByte(static_cast<byte>(length | 0x80));
+        length >>= 7;
+      }
+      emitByte(static_cast<byte>(length));
+    }
+    for (unsigned i = 0; i < Lanes; ++i) {
+      std::vector<byte>& bytes = m_lanes[i].bytes;
+      m_output->writeBlock(&bytes[0], &bytes[0] + bytes.size());
+      m_counter += bytes.size();
+    }
+    m_output->flush();
+    resetLanes();
+  }
+
+  /* Measures length of compressed sequence in bytes */
+  void resetCounter() { m_counter = 0; }
+  uint64 counter() const {
+    uint64 pending = 0;
+    for (unsigned i = 0; i < Lanes; ++i) pending += m_lanes[i].bytes.size();
+    return m_counter + pending;
+  }
+
+ private:
+  struct Lane {
+    uint32 low;
+    uint32 high;
+    std::vector<byte> bytes;
+  };
+  Lane m_lanes[Lanes];
+  unsigned m_lane;
+  uint64 m_counter;
+  bwtc::OutStream* m_output;
+
+  /* Buffers of the lanes are freed, so that they are not in memory while
+   * the next block is transformed. */
+  void resetLanes() {
+    for (unsigned i = 0; i < Lanes; ++i) {
+      m_lanes[i].low = 0;
+      m_lanes[i].high = 0xFFFFFFFF;
+      std::vector<byte>().swap(m_lanes[i].bytes);
+    }
+    m_lane = 0;
+  }
+
+  void emitByte(byte b) {
+    m_output->writeByte(b);
+    ++m_counter;
+  }
+  InterleavedBitEncoder(const InterleavedBitEncoder&);
+  InterleavedBitEncoder& operator=(const InterleavedBitEncoder&);
+};
+
+/*********************************************************************
+ * Decompressor for a bit sequence compressed by                    *
+ * InterleavedBitEncoder with the same number of lanes.              *
+ *********************************************************************/
+template <unsigned Lanes>
+class InterleavedBitDecoder {
+ public:
+  InterleavedBitDecoder() : m_lane(0), m_input(NULL) {}
+
+  void connect(bwtc::InStream* in) { m_input = in; }
+
+  /* Reads all lanes of the sequence from the input. Must be called before
+   * decoding each sequence and the input has to be at byte boundary. */
+  void start() {
+    uint64 lengths[Lanes];
+    uint64 total = 0;
+    for (unsigned i = 0; i < Lanes; ++i) {
+      lengths[i] = 0;
+      byte b;
+      unsigned shift = 0;
+      do {
+        b = m_input->readByte();
+        lengths[i] |= static_cast<uint64>(b & 0x7F) << shift;
+        shift += 7;
+      } while ((b & 0x80) && shift < 64);
+      /* Each lane ends with the four bytes written by finish(). */
+      if ((b & 0x80) || lengths[i] < 4) truncated();
+      total += lengths[i];
+    }
+    m_data.resize(total);
+    if (m_input->readBlock(&m_data[0], total) != total) truncated();
+    const byte* pos = &m_data[0];
+    for (unsigned i = 0; i < Lanes; ++i) {
+      Lane& lane = m_lanes[i];
+      lane.low = 0;
+      lane.high = 0xFFFFFFFF;
+      lane.next = 0;
+      for (int j = 0; j < 4; ++j) lane.next = (lane.next << 8) + pos[j];
+      lane.pos = pos + 4;
+      pos += lengths[i];
+      lane.end = pos;
+    }
+    m_lane = 0;
+  }
+
+  /* See BitDecoder::decode. */
+  bool decode(Probability probability_of_one) {
+    Lane& lane = m_lanes[m_lane];
+    if (++m_lane == Lanes) m_lane = 0;
+    uint32 split = Split(lane.low, lane.high, probability_of_one);
+    bool bit = (lane.next <= split);
+    if (bit) lane.high = split; else lane.low = split + 1;
+    while (((lane.low ^ lane.high) & 0xFF000000) == 0) {
+      lane.low <<= 8;
+      lane.high = (lane.high << 8) + 255;
+      /* A lane of a corrupt sequence may end too early. Like BitDecoder
+       * at the end of stream, it reads 0xFF then. */
+      byte next = (lane.pos < lane.end) ? *lane.pos++ : 0xFF;
+      lane.next = (lane.next << 8) + next;
+    }
+    assert(lane.next >= lane.low);
+    assert(lane.next <= lane.high);
+    return bit;
+  }
+
+ private:
+  struct Lane {
+    uint32 low;
+    uint32 high;
+    uint32 next;
+    const byte* pos;
+    const byte* end;
+  };
+  Lane m_lanes[Lanes];
+  unsigned m_lane;
+  std::vector<byte> m_data;
+  bwtc::InStream* m_input;
+
+  static void truncated() {
+    fprintf(stderr, "Compressed file ends in the middle of a block!\n");
+    exit(1);
+  }
+
+  InterleavedBitDecoder(const InterleavedBitDecoder&);
+  InterleavedBitDecoder& operator=(const InterleavedBitDecoder&);
+};
+
 }  // namespace dcsbwt
 
 #endif  // DCSBWT_RL_COMPRESS_H__
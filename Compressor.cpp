@@ -25,18 +25,260 @@
  */
 
 #include "Compressor.hpp"
+#include "MemoryAccountant.hpp"
 #include "PrecompressorBlock.hpp"
 #include "Streams.hpp"
 #include "Profiling.hpp"
 
+#include <algorithm>
+#include <iostream>
 #include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 namespace bwtc {
 
+namespace {
+
+/**Memory used for transforming and encoding a single slice. The encoded
+ * slice is staged in memory only after the transform, so the entropy
+ * encoder accounts for it in its encoding phase. When compressing in
+ * parallel, the private copy of the slice made by CompressionWorker is
+ * in memory during both phases. The encoded slices of parallel compression
+ * are accounted for the whole precompression block instead, since the
+ * workers may finish them before they can be written.
+ */
+class SliceFootprint {
+ public:
+  SliceFootprint(const EntropyEncoder& coder, const BWTManager& bwtm,
+                 bool parallel)
+      : m_coder(coder), m_bwtm(bwtm), m_parallel(parallel) {}
+
+  uint64 operator()(uint64 n) const {
+    return m_parallel ? n + 1 + encoderMemory(n) : encoderMemory(n);
+  }
+
+  /**Memory used by the entropy encoder, including the transform. */
+  uint64 encoderMemory(uint64 n) const {
+    uint64 output = m_parallel ? 0 : EntropyEncoder::maxEncodedSize(n);
+    return m_coder.maxSizeInBytes(n, m_bwtm, output);
+  }
+
+  /**Memory of the entropy encoder which the transform may use. The buffers
+   * the encoder keeps from the previous block are in memory during it. */
+  uint64 transformMemory(uint64 n) const {
+    return encoderMemory(n) - m_coder.heldSizeInBytes(n);
+  }
+
+ private:
+  const EntropyEncoder& m_coder;
+  const BWTManager& m_bwtm;
+  bool m_parallel;
+};
+
+/**Memory used for a precompression block of threads*n bytes, sized so
+ * that it can be transformed in one slice of n bytes for each thread. Block
+ * which shrinks in precompression is then transformed in the same way. With
+ * read-ahead also the next block, and the workspace of its precompression,
+ * is in memory.
+ */
+class BlockFootprint {
+ public:
+  BlockFootprint(const SliceFootprint& slice, const Precompressor* pre,
+                 uint64 threads, bool readAhead)
+      : m_slice(slice), m_pre(pre), m_threads(threads),
+        m_readAhead(readAhead) {}
+
+  uint64 operator()(uint64 n) const {
+    uint64 block = m_threads*n + 1;
+    uint64 bytes = block + m_threads*m_slice(n);
+    if(m_threads > 1) bytes += EntropyEncoder::maxEncodedSize(m_threads*n);
+    if(m_pre) {
+      block = m_pre->maxSizeInBytes(m_threads*n);
+      bytes = std::max(bytes, block);
+    }
+    if(m_readAhead) bytes += block;
+    return bytes;
+  }
+
+  /**Memory needed in any case, whatever the block size. */
+  uint64 fixed() const { return (*this)(0); }
+
+ private:
+  SliceFootprint m_slice;
+  const Precompressor* m_pre;
+  uint64 m_threads;
+  bool m_readAhead;
+};
+
+/**Slices of single precompression block which are transformed and encoded
+ * concurrently. Workers take the slices in order and store the encoded
+ * slices here, from where they are written into the output in their
+ * original order.
+ */
+struct SliceQueue {
+  explicit SliceQueue(PrecompressorBlock& pb)
+      : block(pb), next(0), encoded(pb.slices(), 0),
+        compressedBytes(pb.slices(), 0) {}
+
+  PrecompressorBlock& block;
+  boost::mutex mutex;
+  boost::condition_variable sliceEncoded;
+  /** Index of the next slice to be given to a worker. */
+  size_t next;
+  std::vector<MemoryOutStream*> encoded;
+  std::vector<size_t> compressedBytes;
+};
+
+/**Worker thread of the compressor. Entropy encoders and BWT-managers have
+ * state, so each worker owns its own instances of them.
+ */
+class CompressionWorker {
+ public:
+  CompressionWorker(char entropyCoder, char bwtChoice, uint32 startingPoints)
+      : m_coder(giveEntropyEncoder(entropyCoder)),
+        m_bwtmanager(startingPoints) {
+    m_bwtmanager.initialize(bwtChoice);
+  }
+
+  ~CompressionWorker() { delete m_coder; }
+
+  /**Sets the number of threads the transform of single slice may use. */
+  void setBwtThreads(uint32 threads) { m_bwtmanager.setThreads(threads); }
+
+  /**Sets the memory the transform of single slice may use. */
+  void setBwtMemoryBudget(uint64 bytes) {
+    m_bwtmanager.setMemoryBudget(bytes);
+  }
+
+  /**Transforms and encodes slices from the queue until all of the slices
+   * are taken. BWT needs the byte following the slice as a sentinel, so
+   * each slice is transformed in a private copy. Otherwise the sentinel
+   * would overwrite the first byte of the neighbouring slice which may be
+   * under processing in other thread. */
+  void run(SliceQueue* queue) {
+    while(true) {
+      size_t i;
+      {
+        boost::lock_guard<boost::mutex> lock(queue->mutex);
+        if(queue->next >= queue->block.slices()) return;
+        i = queue->next++;
+      }
+      const BWTBlock& slice = queue->block.getSlice(i);
+      m_buffer.resize(slice.size() + 1);
+      std::copy(slice.begin(), slice.end(), m_buffer.begin());
+      BWTBlock copy(&m_buffer[0], slice.size(), false);
+
+      MemoryOutStream *out = new MemoryOutStream();
+      size_t bytes = m_coder->transformAndEncode(copy, m_bwtmanager, out);
+      {
+        boost::lock_guard<boost::mutex> lock(queue->mutex);
+        queue->encoded[i] = out;
+        queue->compressedBytes[i] = bytes;
+      }
+      queue->sliceEncoded.notify_all();
+    }
+  }
+
+ private:
+  EntropyEncoder *m_coder;
+  BWTManager m_bwtmanager;
+  std::vector<byte> m_buffer;
+
+  CompressionWorker(const CompressionWorker&);
+  CompressionWorker& operator=(const CompressionWorker&);
+};
+
+/**Transforms and encodes the slices of the block using the given workers and
+ * writes the encoded slices into output in their original order.
+ *
+ * @return total bytes of the encoded slices
+ */
+size_t encodeSlicesInParallel(PrecompressorBlock& pb,
+                              std::vector<CompressionWorker*>& workers,
+                              OutStream* out) {
+  PROFILE("Compressor::encodeSlicesInParallel");
+  SliceQueue queue(pb);
+  /* If there are less slices than workers, the remaining threads are used
+   * for transforming the slices. */
+  boost::thread_group threads;
+  size_t n = std::min(workers.size(), pb.slices());
+  for(size_t t = 0; t < n; ++t) {
+    workers[t]->setBwtThreads(workers.size()/n);
+    threads.create_thread(
+        boost::bind(&CompressionWorker::run, workers[t], &queue));
+  }
+
+  size_t compressedSize = 0;
+  for(size_t i = 0; i < pb.slices(); ++i) {
+    MemoryOutStream *encoded;
+    {
+      boost::unique_lock<boost::mutex> lock(queue.mutex);
+      while(!queue.encoded[i]) queue.sliceEncoded.wait(lock);
+      encoded = queue.encoded[i];
+    }
+    out->writeBlock(encoded->begin(), encoded->end());
+    compressedSize += queue.compressedBytes[i];
+    delete encoded;
+  }
+  threads.join_all();
+  return compressedSize;
+}
+
+/**Reads and precompresses the precompression blocks one block ahead in a
+ * separate thread. */
+class BlockReader {
+ public:
+  BlockReader(const Precompressor& precompressor, InStream* in,
+              size_t blockSize)
+      : m_precompressor(precompressor), m_in(in), m_blockSize(blockSize),
+        m_next(0) {
+    start();
+  }
+
+  ~BlockReader() {
+    m_thread.join();
+    delete m_next;
+  }
+
+  /**Gives the next block and starts reading the one following it. The
+   * returned block is empty at the end of the input. */
+  PrecompressorBlock* next() {
+    m_thread.join();
+    PrecompressorBlock *pb = m_next;
+    m_next = 0;
+    if(pb->originalSize() > 0) start();
+    return pb;
+  }
+
+ private:
+  const Precompressor& m_precompressor;
+  InStream* m_in;
+  size_t m_blockSize;
+  PrecompressorBlock* m_next;
+  boost::thread m_thread;
+
+  void start() {
+    m_thread = boost::thread(boost::bind(&BlockReader::read, this));
+  }
+
+  void read() {
+    PROFILE("BlockReader::read");
+    m_next = m_precompressor.readBlock(m_blockSize, m_in);
+  }
+
+  BlockReader(const BlockReader&);
+  BlockReader& operator=(const BlockReader&);
+};
+
+} //namespace
+
 Compressor::
 Compressor(const std::string& in, const std::string& out,
            const std::string& preprocessing, size_t memLimit, char entropyCoder)
-    : m_in(new RawInStream(in)), m_out(new RawOutStream(out)),
+    : m_in(giveInStream(in)), m_out(giveOutStream(out)),
       m_coder(giveEntropyEncoder(entropyCoder)), m_precompressor(preprocessing),
       m_options(memLimit, entropyCoder) {}
 
@@ -52,68 +294,135 @@ Compressor::~Compressor() {
   delete m_coder;
 }
 
-size_t Compressor::writeGlobalHeader() {
-  m_out->writeByte(static_cast<byte>(m_options.entropyCoder));
+size_t Compressor::writeGlobalHeader(char entropyCoder) {
+  m_out->writeByte(static_cast<byte>(entropyCoder));
   return 1;
 }
 
 void Compressor::initializeBwtAlgorithm(char choice, uint32 startingPoints) {
+  m_options.bwtAlgorithm = choice;
   m_bwtmanager.initialize(choice);
   m_bwtmanager.setStartingPoints(startingPoints);
 }
 
 size_t Compressor::compress(size_t threads) {
   PROFILE("Compressor::compress");
-  if(threads != 1) {
-    std::cerr << "Supporting only single thread!" << std::endl;
-    return 0;
+  if(threads < 1) threads = 1;
+
+  /* The blocks encoded in different threads can't share the models. */
+  char entropyCoder = m_options.entropyCoder;
+  if(threads > 1 && !independentBlocks(entropyCoder)) {
+    entropyCoder = static_cast<char>(entropyCoder | kIndependentBlocks);
   }
+  size_t compressedSize = writeGlobalHeader(entropyCoder);
 
-  size_t compressedSize = writeGlobalHeader();
+  /* Block sizes are chosen so that the footprints reported by the stages
+   * fit into the memory limit. With precompression the size of the BWT
+   * blocks is decided for each precompression block after it has been
+   * precompressed. With read-ahead the next block is precompressed while
+   * the current one is transformed, so its footprint stays reserved. */
+  bool precompressing = m_precompressor.options().size() > 0;
+  SliceFootprint slice(*m_coder, m_bwtmanager, threads > 1);
+  BlockFootprint footprint(slice, precompressing ? &m_precompressor : 0,
+                           threads, m_options.readAhead);
 
-  /* Precompressor uses (1/3)n bytes of additional memory for the block
-   * of size n so we can handle 0.75*memLim sized block at once (0.74 should be
-   * enough to be on the safe side). */
-  size_t pbBlockSize = static_cast<size_t>(m_options.memLimit*0.74);
-  size_t bwtBlockSize = std::min(static_cast<size_t>(m_options.memLimit*0.185),
-                                 static_cast<size_t>(0x7fffffff - 1));
+  /* A limit smaller than the fixed parts of the footprints, such as the tables
+   * used by the stages and the buffers of the output stream, can't be
+   * honoured. It is taken as the memory given in addition to them. */
+  uint64 memLimit = m_options.memLimit;
+  uint64 fixed = footprint.fixed() + m_out->bufferSizeInBytes();
+  if(memLimit < fixed) {
+    if(verbosity > 0) {
+      std::clog << "Memory limit is less than the " << fixed
+                << " bytes needed in any case, using it in addition to them."
+                << std::endl;
+    }
+    memLimit += fixed;
+  }
+  MemoryAccountant memory(memLimit);
+  memory.reserve(m_out->bufferSizeInBytes());
 
-  if(m_precompressor.options().size() == 0) pbBlockSize = bwtBlockSize;
-  
+  size_t bwtBlockSize = memory.largestBlock(footprint, 1, kMaxBlockSize);
+  size_t pbBlockSize = bwtBlockSize*threads;
+  uint64 readAheadMemory = 0;
+  if(m_options.readAhead) {
+    readAheadMemory = precompressing ?
+        m_precompressor.maxSizeInBytes(pbBlockSize) : pbBlockSize + 1;
+  }
+  memory.reserve(readAheadMemory);
+
+  std::vector<CompressionWorker*> workers;
+  if(threads > 1) {
+    for(size_t t = 0; t < threads; ++t) {
+      workers.push_back(new CompressionWorker(
+          entropyCoder, m_options.bwtAlgorithm,
+          m_bwtmanager.getStartingPoints()));
+    }
+  }
+
+  /* Entropy encoder writes the length of the encoded BWT-block in front of
+   * it after the block is finished. Staging the block in memory keeps the
+   * output strictly sequential, so it can be a pipe or a socket. The staged
+   * block is freed after writing it, before the next transform. */
+  MemoryOutStream staging;
+
+  BlockReader *reader = 0;
+  if(m_options.readAhead) {
+    reader = new BlockReader(m_precompressor, m_in, pbBlockSize);
+  }
 
   size_t preBlocks = 0, bwtBlocks = 0;
   while(true) {
-    PrecompressorBlock *pb = m_precompressor.readBlock(pbBlockSize, m_in);
+    PrecompressorBlock *pb = reader ? reader->next() :
+        m_precompressor.readBlock(pbBlockSize, m_in);
     if(pb->originalSize() == 0) {
       delete pb;
       break;
     }
-    /* BWT uses roughly 4n additional bytes of additional memory but
-     * we have to also account the memory used for the rest of the data.
-     * Based on the experiments the limits used here are somewhat conservative.
-     */
-    if(pbBlockSize != bwtBlockSize) {
-      size_t s = (m_options.memLimit - pb->size())/4.5;
-      bwtBlockSize = std::min(s,static_cast<size_t>(0x7fffffff - 1));
+    uint64 blockMemory = 0;
+    if(precompressing) {
+      blockMemory = pb->size() + 1;
+      if(threads > 1) blockMemory += EntropyEncoder::maxEncodedSize(pb->size());
+      memory.reserve(blockMemory);
+      bwtBlockSize = memory.largestBlock(slice, threads, kMaxBlockSize);
     }
-    
+    if(verbosity > 1) {
+      std::clog << "Transforming in blocks of at most " << bwtBlockSize
+                << " bytes." << std::endl;
+    }
+    uint64 bwtMemory = slice.transformMemory(bwtBlockSize);
+    m_bwtmanager.setMemoryBudget(bwtMemory);
+    for(size_t t = 0; t < workers.size(); ++t) {
+      workers[t]->setBwtMemoryBudget(bwtMemory);
+    }
+
     pb->sliceIntoBlocks(bwtBlockSize);
     ++preBlocks;
     bwtBlocks += pb->slices();
 
     compressedSize += pb->writeBlockHeader(m_out);
 
-    for(size_t i = 0; i < pb->slices(); ++i) {
-      compressedSize += m_coder->
-          transformAndEncode(pb->getSlice(i), m_bwtmanager, m_out);
-      //TODO: if optimizing overall memory usage now would be time to
-      //delete space allocated for i:th slice. However the worst case
-      //stays the same
+    if(threads > 1) {
+      compressedSize += encodeSlicesInParallel(*pb, workers, m_out);
+    } else {
+      for(size_t i = 0; i < pb->slices(); ++i) {
+        compressedSize += m_coder->
+            transformAndEncode(pb->getSlice(i), m_bwtmanager, &staging);
+        m_out->writeBlock(staging.begin(), staging.end());
+        staging.clear();
+        //TODO: if optimizing overall memory usage now would be time to
+        //delete space allocated for i:th slice. However the worst case
+        //stays the same
+      }
     }
+    memory.release(blockMemory);
     delete pb;
   }
+  delete reader;
   compressedSize += PrecompressorBlock::writeEmptyHeader(m_out);
 
+  for(size_t t = 0; t < workers.size(); ++t) delete workers[t];
+
   return compressedSize;
 }
 
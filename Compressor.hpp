@@ -43,8 +43,18 @@
  *
  * Entropy coding:
  * Each BWT-block is compressed independently using some entropy coder.
- * Encoded BWTBlocks are written into the compressed file in the order
- * specified by ?TODO?
+ * Encoded BWTBlocks are written into the compressed file in the same order
+ * as they appear in the precompression block.
+ *
+ * When using several threads, the BWT-blocks of single precompression block
+ * are transformed and encoded concurrently. Each worker thread has its own
+ * BWTManager and entropy encoder and encodes the blocks into memory. The
+ * encoded blocks are then written into the output in their original order.
+ * With read-ahead enabled, the next precompression block is read and
+ * precompressed in its own thread at the same time.
+ * Also with a single thread the BWT-blocks are encoded into memory before
+ * writing them, so the output is written sequentially and it doesn't have to
+ * be seekable.
  *
  *
  * COMPRESSED FILE FORMAT:
@@ -54,7 +64,11 @@
  *
  * File header:
  * File header contains global information about the compressed file such as
- * used entropy coder etc.
+ * used entropy coder etc. The high bit of the entropy coder byte
+ * (kIndependentBlocks) tells that the wavelet coders started each BWT-block
+ * with fresh models. It is set when compressing with several threads.
+ * Otherwise the models are carried from block to block, and the blocks have
+ * to be decoded in order.
  *
  * Precompression block:
  * Precompression blocks are independent of each other. Each precompression
@@ -88,10 +102,15 @@ namespace bwtc {
 
 struct Options {
   Options(size_t memLimit_, char entropyCoder_) :
-      memLimit(memLimit_), entropyCoder(entropyCoder_) {}
-  Options(char entropyCoder_) : entropyCoder(entropyCoder_) {}
+      memLimit(memLimit_), entropyCoder(entropyCoder_), bwtAlgorithm('a'),
+      readAhead(false) {}
+  Options(char entropyCoder_) :
+      entropyCoder(entropyCoder_), bwtAlgorithm('a'), readAhead(false) {}
   size_t memLimit;
   char entropyCoder;
+  char bwtAlgorithm;
+  /**Read and precompress the next block while the current is encoded. */
+  bool readAhead;
 };
 
 class Compressor {
@@ -105,9 +124,17 @@ class Compressor {
   ~Compressor();
 
   size_t compress(size_t threads);
-  size_t writeGlobalHeader();
+  /**Writes the file header telling the entropy coder choice, possibly with
+   * kIndependentBlocks set. */
+  size_t writeGlobalHeader(char entropyCoder);
   void initializeBwtAlgorithm(char choice, uint32 startingPoints);
 
+  /**When enabled, the next precompression block is read and precompressed
+   * in a separate thread while the current block is transformed and
+   * encoded. Both blocks are held in memory at the same time, so the
+   * blocks are made smaller to stay within the memory limit. */
+  void setReadAhead(bool readAhead) { m_options.readAhead = readAhead; }
+
  private:
   InStream *m_in;
   OutStream *m_out;
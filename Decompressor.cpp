@@ -25,22 +25,203 @@
  */
 
 #include "Decompressor.hpp"
+#include "MemoryAccountant.hpp"
 #include "Streams.hpp"
 #include "preprocessors/Postprocessor.hpp"
 #include "Profiling.hpp"
 #include "bwtransforms/InverseBWT.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <numeric>
 #include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 namespace bwtc {
 
-Decompressor::Decompressor(const std::string& in, const std::string& out)
-    : m_in(new RawInStream(in)), m_out(new RawOutStream(out)),
-      m_decoder(0) {}
+namespace {
+
+void truncated() {
+  fprintf(stderr, "Compressed file ends in the middle of a block!\n");
+  exit(1);
+}
+
+/**Encoded slices of single precompression block which are decoded
+ * concurrently. The encoded slices are read from input into memory before
+ * their decoding starts, and the slices of the block already point to their
+ * final positions.
+ */
+struct EncodedSlices {
+  explicit EncodedSlices(PrecompressorBlock& pb)
+      : block(pb), next(0), end(0), encoded(pb.slices(), 0) {}
+
+  ~EncodedSlices() {
+    for(size_t i = 0; i < encoded.size(); ++i) delete encoded[i];
+  }
+
+  PrecompressorBlock& block;
+  boost::mutex mutex;
+  /** Index of the next slice to be given to a worker. */
+  size_t next;
+  /** End of the slices read from input so far. */
+  size_t end;
+  std::vector<MemoryInStream*> encoded;
+};
+
+/**Worker thread of the decompressor. Each worker owns its own entropy
+ * decoder, the inverse transform is chosen for each slice.
+ */
+class DecompressionWorker {
+ public:
+  explicit DecompressionWorker(char decoder)
+      : m_decoder(giveEntropyDecoder(decoder)), m_ibwtThreads(1),
+        m_memoryBudget(0) {}
+
+  ~DecompressionWorker() {
+    delete m_decoder;
+  }
+
+  /**Sets the number of threads the inverse transform of single slice may
+   * use, and the memory the worker may use for a slice. */
+  void setInverseTransform(uint32 threads, uint64 memoryBudget) {
+    m_ibwtThreads = threads;
+    m_memoryBudget = memoryBudget;
+  }
+
+  /**Decodes and inverts slices until all of them are taken. Inverse BWT
+   * writes the byte following the slice, so each slice is processed in a
+   * private buffer and copied to its place in the precompression block
+   * afterwards. */
+  void run(EncodedSlices* slices) {
+    while(true) {
+      size_t i;
+      {
+        boost::lock_guard<boost::mutex> lock(slices->mutex);
+        if(slices->next >= slices->end) return;
+        i = slices->next++;
+      }
+      BWTBlock& slice = slices->block.getSlice(i);
+      m_buffer.resize(slice.size() + 1);
+      BWTBlock copy(&m_buffer[0], slice.size(), true);
+      m_decoder->decodeBlock(copy, slices->encoded[i]);
+      assert(copy.size() == slice.size());
+      uint64 budget = m_memoryBudget > m_buffer.capacity() ?
+          m_memoryBudget - m_buffer.capacity() : 0;
+      InverseBWTransform *ibwt =
+          giveInverseTransformer(m_ibwtThreads, slice.size(), budget);
+      ibwt->doTransform(copy);
+      delete ibwt;
+      std::copy(copy.begin(), copy.end(), slice.begin());
+    }
+  }
+
+ private:
+  EntropyDecoder *m_decoder;
+  uint32 m_ibwtThreads;
+  uint64 m_memoryBudget;
+  std::vector<byte> m_buffer;
+
+  DecompressionWorker(const DecompressionWorker&);
+  DecompressionWorker& operator=(const DecompressionWorker&);
+};
+
+/**Decodes the slices read so far using the given workers, and frees their
+ * encoded data.
+ *
+ * @param encodedMemory Bytes of the encoded slices, reserved from memory.
+ */
+void decodeReadSlices(EncodedSlices& slices,
+                      std::vector<DecompressionWorker*>& workers,
+                      MemoryAccountant& memory, uint64 encodedMemory) {
+  /* If there are less slices than workers, the remaining threads are used
+   * for inverting the slices. */
+  size_t first = slices.next;
+  boost::thread_group threads;
+  size_t n = std::min(workers.size(), slices.end - slices.next);
+  for(size_t t = 0; t < n; ++t) {
+    workers[t]->setInverseTransform(workers.size()/n, memory.available()/n);
+    threads.create_thread(
+        boost::bind(&DecompressionWorker::run, workers[t], &slices));
+  }
+  threads.join_all();
+  for(size_t i = first; i < slices.end; ++i) {
+    delete slices.encoded[i];
+    slices.encoded[i] = 0;
+  }
+  memory.release(encodedMemory);
+}
+
+/**Reads the encoded slices of the block from input and decodes them using
+ * the given workers. The lengths of the slices are checked against the
+ * input left before anything is allocated for them. Slices are read as long
+ * as they fit into the memory left, and the ones read are decoded before
+ * reading more, so at least one slice is always read.
+ *
+ * @param decoder Decoder used for reading the block headers, which tell
+ *                the sizes of the decoded slices.
+ * @param memory Accountant of the memory limit, from which the encoded
+ *               slices are reserved while they are decoded. The rest is
+ *               divided between the workers.
+ */
+void decodeSlicesInParallel(PrecompressorBlock& pb,
+                            std::vector<DecompressionWorker*>& workers,
+                            EntropyDecoder* decoder, InStream* in,
+                            MemoryAccountant& memory) {
+  PROFILE("Decompressor::decodeSlicesInParallel");
+  EncodedSlices slices(pb);
+  uint64 encodedMemory = 0;
+  for(size_t i = 0; i < pb.slices(); ++i) {
+    uint64 compressedLength = in->read48bits();
+    if(compressedLength > in->bytesLeft()) truncated();
+    if(encodedMemory > 0 && compressedLength + 6 > memory.available()) {
+      decodeReadSlices(slices, workers, memory, encodedMemory);
+      encodedMemory = 0;
+    }
+    memory.reserve(compressedLength + 6);
+    encodedMemory += compressedLength + 6;
+
+    MemoryInStream *encoded = new MemoryInStream(compressedLength + 6);
+    byte *data = encoded->data();
+    for(int j = 0; j < 6; ++j) {
+      data[j] = 0xFF & (compressedLength >> (5-j)*8);
+    }
+    slices.encoded[i] = encoded;
+    slices.end = i + 1;
+    if(in->readBlock(data + 6, compressedLength) != compressedLength) {
+      truncated();
+    }
 
-Decompressor::Decompressor(InStream* in, OutStream* out)
-    : m_in(in), m_out(out), m_decoder(0) {}
+    BWTBlock header;
+    std::vector<uint64> contextLengths;
+    decoder->readBlockHeader(header, &contextLengths, encoded);
+    encoded->rewind();
+    uint64 size = std::accumulate(contextLengths.begin(),
+                                  contextLengths.end(), static_cast<uint64>(0));
+    if(size > pb.originalSize() - pb.size()) truncated();
+
+    pb.getSlice(i).setBegin(pb.end());
+    pb.getSlice(i).setSize(size);
+    pb.usedAtEnd(size);
+  }
+  decodeReadSlices(slices, workers, memory, encodedMemory);
+}
+
+} //namespace
+
+Decompressor::Decompressor(const std::string& in, const std::string& out,
+                           uint64 memLimit)
+    : m_in(new RawInStream(in)), m_out(giveOutStream(out)),
+      m_decoder(0), m_decoderChoice(0), m_memLimit(memLimit) {}
+
+Decompressor::Decompressor(InStream* in, OutStream* out, uint64 memLimit)
+    : m_in(in), m_out(out), m_decoder(0), m_decoderChoice(0),
+      m_memLimit(memLimit) {}
 
 Decompressor::~Decompressor() {
   delete m_in;
@@ -49,22 +230,30 @@ Decompressor::~Decompressor() {
 }
 
 size_t Decompressor::readGlobalHeader() {
-  char entropyDecoder = static_cast<char>(m_in->readByte());
+  m_decoderChoice = static_cast<char>(m_in->readByte());
   delete m_decoder;
-  m_decoder = giveEntropyDecoder(entropyDecoder);
+  m_decoder = giveEntropyDecoder(m_decoderChoice);
   return 1;
 }
 
 size_t Decompressor::decompress(size_t threads) {
   PROFILE("Decompressor::decompress");
-  if(threads != 1) {
-    std::cerr << "Supporting only single thread!" << std::endl;
-    return 0;
-  }
-  InverseBWTransform *ibwt = giveInverseTransformer();
+  if(threads < 1) threads = 1;
+  MemoryAccountant memory(
+      m_memLimit > 0 ? m_memLimit : std::numeric_limits<uint64>::max());
 
   readGlobalHeader();
 
+  /* The blocks of the older files depend on the previous ones, so only the
+   * inverse transform can use several threads. */
+  bool parallel = threads > 1 && independentBlocks(m_decoderChoice);
+  std::vector<DecompressionWorker*> workers;
+  if(parallel) {
+    for(size_t t = 0; t < threads; ++t) {
+      workers.push_back(new DecompressionWorker(m_decoderChoice));
+    }
+  }
+
   size_t preBlocks = 0, bwtBlocks = 0, decompressedSize = 0;
   while(true) {
     PrecompressorBlock *pb = PrecompressorBlock::readBlockHeader(m_in);
@@ -74,13 +263,24 @@ size_t Decompressor::decompress(size_t threads) {
     }
     ++preBlocks;
     bwtBlocks += pb->slices();
+    uint64 blockMemory = pb->originalSize() + 1;
+    memory.reserve(blockMemory);
 
-    for(size_t i = 0; i < pb->slices(); ++i) {
-      pb->getSlice(i).setBegin(pb->end());
-      m_decoder->decodeBlock(pb->getSlice(i), m_in);
-      pb->usedAtEnd(pb->getSlice(i).size());
-      ibwt->doTransform(pb->getSlice(i));
+    if(parallel) {
+      decodeSlicesInParallel(*pb, workers, m_decoder, m_in, memory);
+    } else {
+      for(size_t i = 0; i < pb->slices(); ++i) {
+        BWTBlock& slice = pb->getSlice(i);
+        slice.setBegin(pb->end());
+        m_decoder->decodeBlock(slice, m_in);
+        pb->usedAtEnd(slice.size());
+        InverseBWTransform *ibwt =
+            giveInverseTransformer(threads, slice.size(), memory.available());
+        ibwt->doTransform(slice);
+        delete ibwt;
+      }
     }
+    memory.release(blockMemory);
     // Postprocess pb
     Postprocessor postprocessor(verbosity > 1, pb->grammar());
     size_t postSize = postprocessor.uncompress(pb->begin(), pb->size(), m_out);
@@ -89,7 +289,7 @@ size_t Decompressor::decompress(size_t threads) {
     assert(postSize == pb->originalSize());
     delete pb;
   }
-  delete ibwt;
+  for(size_t t = 0; t < workers.size(); ++t) delete workers[t];
   return decompressedSize;
 }
 
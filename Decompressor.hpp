@@ -28,7 +28,19 @@
  *  input -->  ENTROPY DECODING -> INVERSE BWT -> POSTPROCESSING --> ouput
  *
  * The postprocessing phase decompresses the precompressed data.
- * Memory needed for the decompression is determined by the compressor options.
+ * Memory needed for the decompression is mostly determined by the compressor
+ * options. The inverse transform of each BWT-block is chosen to fit into the
+ * memory limit, if one is given: MTL-SA is the fastest, but for the large
+ * blocks FastInverseBWTransform needs less memory.
+ *
+ * When using several threads, the encoded BWT-blocks of a precompression
+ * block are first read into memory. Their sizes are known from the block
+ * headers, so the blocks are entropy decoded and inverse transformed
+ * concurrently. Postprocessing is done after all BWT-blocks of the
+ * precompression block are ready. The wavelet coded blocks depend on the
+ * previous ones unless kIndependentBlocks is set in the file header, so such
+ * files are decoded block by block, and only the inverse transforms use
+ * several threads.
  *
  * For the description of compressed file format @see Compressor.hpp.
  *
@@ -47,8 +59,10 @@ namespace bwtc {
 
 class Decompressor {
  public:
-  Decompressor(const std::string& in, const std::string& out);
-  Decompressor(InStream* in, OutStream* out);
+  /**@param memLimit Memory limit in bytes, 0 meaning no limit. */
+  Decompressor(const std::string& in, const std::string& out,
+               uint64 memLimit = 0);
+  Decompressor(InStream* in, OutStream* out, uint64 memLimit = 0);
   ~Decompressor();
 
   size_t decompress(size_t threads);
@@ -58,6 +72,9 @@ class Decompressor {
   InStream *m_in;
   OutStream *m_out;
   EntropyDecoder *m_decoder;
+  /** Entropy decoder given in the global header. */
+  char m_decoderChoice;
+  uint64 m_memLimit;
 };
 
 } //namespace bwtc
@@ -25,6 +25,8 @@
  *
  */
 
+#include <algorithm>
+#include <cassert>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -32,35 +34,180 @@
 #include "EntropyCoders.hpp"
 #include "WaveletCoders.hpp"
 #include "HuffmanCoders.hpp"
+#include "RansCoders.hpp"
+#include "Utils.hpp"
 
 namespace bwtc {
 
+/* Incompressible blocks grow a little. The constant covers the headers of
+ * the block and of its context blocks, and the write window of
+ * MemoryOutStream. */
+uint64 EntropyEncoder::maxEncodedSize(uint64 block_size) {
+  return block_size + block_size/8 + (1 << 16);
+}
+
+/*********************************************************************
+ * The format of header for single main block is the following:      *
+ * - 48 bits for the length of the compressed main block, doesn't    *
+ *   include 6 bytes used for this                                   *
+ * - byte representing the number of separately encoded sections.    *
+ *   zero represents 256                                             *
+ * - lengths of the sections which are encoded with same wavelet tree*
+ *********************************************************************/
+uint64 writeEncodedBlockHeader(const BWTBlock& block,
+                               std::vector<uint64>& stats, OutStream* out,
+                               long int* headerPosition) {
+  uint64 headerLength = 0;
+  *headerPosition = out->getPos();
+  for (unsigned i = 0; i < 6; ++i) out->writeByte(0x00); //fill 48 bits
+
+  headerLength += block.writeHeader(out);
+  
+  /* Deduce sections for separate encoding. At the moment uses not-so-well
+   * thought heuristic. */
+  std::vector<uint64> temp; std::vector<uint64>& s = stats;
+  size_t sum = 0;
+  for(size_t i = 0; i < s.size(); ++i) {
+    sum += s[i];
+    if(sum >= 10000) {
+      temp.push_back(sum);
+      sum = 0;
+    }
+  }
+  if (sum != 0) {
+    if(temp.size() > 0) temp.back() += sum;
+    else temp.push_back(sum);
+  }
+  s.resize(temp.size());
+  std::copy(temp.begin(), temp.end(), s.begin());
+  byte len;
+  if(temp.size() == 256) len = 0;
+  else len = temp.size();
+  out->writeByte(len);
+  headerLength += 1;
+
+  assert(s.size() == temp.size());
+  assert(temp.size() <= 256);
+
+  for (size_t i = 0; i < stats.size(); ++i) {
+    int bytes;
+    uint64 packed_cblock_size = utils::packInteger(stats[i], &bytes);
+    headerLength += bytes;
+    writePackedInteger(packed_cblock_size, out);
+  }
+  return headerLength;
+}
+
+uint64 readEncodedBlockHeader(BWTBlock& block, std::vector<uint64>* stats,
+                              InStream* in) {
+  uint64 compressed_length = in->read48bits();
+  block.readHeader(in);
+  
+  byte sections = in->readByte();
+  size_t sects = (sections == 0) ? 256 : sections;
+  for(size_t i = 0; i < sects; ++i) {
+    uint64 value = readPackedInteger(in);
+    stats->push_back(utils::unpackInteger(value));
+  }
+  return compressed_length;
+}
+
+/* Integer is written in reversal fashion so that it can be read easier.*/
+void writePackedInteger(uint64 packed_integer, OutStream* out) {
+  do {
+    byte to_written = static_cast<byte>(packed_integer & 0xFF);
+    packed_integer >>= 8;
+    out->writeByte(to_written);
+  } while (packed_integer);
+}
+
+uint64 readPackedInteger(InStream* in) {
+  static const uint64 kEndSymbol = static_cast<uint64>(1) << 63;
+  static const uint64 kEndMask = static_cast<uint64>(1) << 7;
+
+  uint64 packed_integer = 0;
+  bool bits_left = true;
+  int i;
+  // A packed integer takes at most 8 bytes. The limit also ends the loop
+  // at the end of a truncated stream, where readByte gives 0xFF.
+  for(i = 0; bits_left && i < 8; ++i) {
+    uint64 read = static_cast<uint64>(in->readByte());
+    bits_left = (read & kEndMask) != 0;
+    packed_integer |= (read << i*8);
+  }
+  if (packed_integer == 0x80) return kEndSymbol;
+  return packed_integer;
+}
+
+bool independentBlocks(char coder) {
+  if(static_cast<byte>(coder) & kIndependentBlocks) return true;
+  return coder == 'H' || coder == 'P' || coder == 'R';
+}
+
 EntropyEncoder*
 giveEntropyEncoder(char encoder) {
+  bool independent = (static_cast<byte>(encoder) & kIndependentBlocks) != 0;
+  encoder = static_cast<char>(encoder & ~kIndependentBlocks);
   if(encoder == 'H') {
     if(verbosity > 1) {
       std::clog << "Using Huffman encoder\n";
     }
     return new HuffmanEncoder();
+  } else if(encoder == 'P') {
+    if(verbosity > 1) {
+      std::clog << "Using Huffman encoder with " << kHuffmanSubstreams
+                << " substreams\n";
+    }
+    return new HuffmanEncoder(kHuffmanSubstreams);
+  } else if(encoder == 'R') {
+    if(verbosity > 1) {
+      std::clog << "Using rANS encoder\n";
+    }
+    return new RansEncoder();
+  } else if(encoder == 'I') {
+    if(verbosity > 1) {
+      std::clog << "Using Wavelet tree encoder with " << kWaveletCoderLanes
+                << " interleaved range coders\n";
+    }
+    return new WaveletEncoder('B', true, independent);
   } else {
     if(verbosity > 1) {
       std::clog << "Using Wavelet tree encoder\n";
     }
-    return new WaveletEncoder(encoder);
+    return new WaveletEncoder(encoder, false, independent);
   }
 }
 
 EntropyDecoder* giveEntropyDecoder(char decoder) {
+  bool independent = (static_cast<byte>(decoder) & kIndependentBlocks) != 0;
+  decoder = static_cast<char>(decoder & ~kIndependentBlocks);
   if(decoder == 'H') {
     if(verbosity > 1) {
       std::clog << "Using Huffman decoder\n";
     }
     return new HuffmanDecoder();
+  } else if(decoder == 'P') {
+    if(verbosity > 1) {
+      std::clog << "Using Huffman decoder with " << kHuffmanSubstreams
+                << " substreams\n";
+    }
+    return new HuffmanDecoder(kHuffmanSubstreams);
+  } else if(decoder == 'R') {
+    if(verbosity > 1) {
+      std::clog << "Using rANS decoder\n";
+    }
+    return new RansDecoder();
+  } else if(decoder == 'I') {
+    if(verbosity > 1) {
+      std::clog << "Using Wavelet tree decoder with " << kWaveletCoderLanes
+                << " interleaved range coders\n";
+    }
+    return new WaveletDecoder('B', true, independent);
   } else {
     if(verbosity > 1) {
       std::clog << "Using Wavelet tree decoder\n";
     }
-    return new WaveletDecoder(decoder);
+    return new WaveletDecoder(decoder, false, independent);
   }
 }
 
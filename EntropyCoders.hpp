@@ -59,6 +59,30 @@ class EntropyEncoder {
   virtual size_t transformAndEncode(BWTBlock& block, BWTManager& bwtm,
                                     OutStream* out) = 0;
 
+  /**Upper bound for the memory used by transformAndEncode for a block of
+   * block_size bytes, excluding the block itself. The transform made with
+   * bwtm and the encoding are separate phases, so the bound is the larger
+   * of them added to the buffers kept from one block to the next (see
+   * heldSizeInBytes). Encoded output of at most output bytes which is held
+   * in memory, such as a staged block, is in memory only during the
+   * encoding.
+   */
+  virtual uint64 maxSizeInBytes(uint64 block_size, const BWTManager& bwtm,
+                                uint64 output) const = 0;
+
+  /**Upper bound for the buffers which the encoder keeps from one block of
+   * block_size bytes to the next, so that they are in memory also during
+   * the transform. Keeping them saves allocating and faulting them in for
+   * every block, but when memory limits the block size the blocks are
+   * smaller: with the run buffers of 'H' the blocks of -m 1 are about 3/4
+   * of what they would be if the buffers were freed before the transform,
+   * and the output is about 1% larger. */
+  virtual uint64 heldSizeInBytes(uint64 /*block_size*/) const { return 0; }
+
+  /**Upper bound for the size of an encoded block. The encoded blocks are
+   * staged in memory before they are written (see Compressor). */
+  static uint64 maxEncodedSize(uint64 block_size);
+
 #ifdef ENTROPY_PROFILER
   uint32 m_bytesForCharacters;
   uint32 m_bytesForRuns;
@@ -71,8 +95,58 @@ class EntropyDecoder {
  public:
   virtual ~EntropyDecoder() {}
   virtual void decodeBlock(BWTBlock& block, InStream* in) = 0;
+
+  /**Reads the header of an encoded block. This is needed, for example, for
+   * finding out the size of the block before decoding it.
+   *
+   * @param block LFpowers of the block are read here.
+   * @param stats Lengths of the context blocks are stored here.
+   * @param in Stream positioned at the beginning of the encoded block.
+   * @return length of the compressed block (excluding the 6 bytes used
+   *         for storing the length itself)
+   */
+  virtual uint64 readBlockHeader(BWTBlock& block, std::vector<uint64>* stats,
+                                 InStream* in) = 0;
 };
 
+/**Writes the header of an encoded BWT-block used by the Huffman and rANS
+ * coders. The context blocks of stats are merged into the sections which
+ * are coded separately.
+ *
+ * @param headerPosition Set to the position of the 48 bits reserved for the
+ *                       length of the compressed block, which is written
+ *                       when the block is finished.
+ * @return bytes written, excluding the 48 bits
+ */
+uint64 writeEncodedBlockHeader(const BWTBlock& block,
+                               std::vector<uint64>& stats, OutStream* out,
+                               long int* headerPosition);
+
+/**Reads the header written by writeEncodedBlockHeader.
+ *
+ * @return length of the compressed block (excluding the 48 bits)
+ */
+uint64 readEncodedBlockHeader(BWTBlock& block, std::vector<uint64>* stats,
+                              InStream* in);
+
+/**Writes an integer packed with utils::packInteger. */
+void writePackedInteger(uint64 packed_integer, OutStream* out);
+
+/**Reads an integer written by writePackedInteger. If end symbol is
+ * encountered, then the most significant bit is activated. */
+uint64 readPackedInteger(InStream* in);
+
+/**Flag of the entropy coder choice stored in the file header. The wavelet
+ * coders carry the state of their probability models from one BWT-block to
+ * the next, unless this flag is set. With the flag each block is coded with
+ * freshly created models, so that the blocks can be encoded and decoded in
+ * different threads. */
+const byte kIndependentBlocks = 0x80;
+
+/**Tells whether the BWT-blocks coded with the given choice (possibly with
+ * kIndependentBlocks set) can be decoded independently of each other. */
+bool independentBlocks(char coder);
+
 EntropyEncoder* giveEntropyEncoder(char encoder);
 
 EntropyDecoder* giveEntropyDecoder(char decoder);
@@ -27,6 +27,7 @@
 
 #include <cassert>
 #include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <iterator>
 #include <iostream> // For std::streampos
@@ -43,14 +44,371 @@
 
 namespace bwtc {
 
-HuffmanEncoder::HuffmanEncoder()
-    : m_headerPosition(0), m_compressedBlockLength(0) {}
+namespace {
+
+/* Number of bits looked up at once when decoding Huffman codes. */
+const uint32 kTableBits = 12;
+
+void truncated() {
+  fprintf(stderr, "Compressed file ends in the middle of a block!\n");
+  exit(1);
+}
+
+/*********************************************************************
+ * Reads bits of a section, most significant bit first. Whole bytes  *
+ * are taken from the InStream into a 64-bit buffer, but only bytes  *
+ * known to belong to the section are read, so after the section the *
+ * stream is positioned at the beginning of the next byte.           *
+ *********************************************************************/
+class SectionBitReader {
+ public:
+  explicit SectionBitReader(InStream* in)
+      : m_in(in), m_buffer(0), m_bits(0) {}
+
+  /* Fills the buffer when at least bitsLeft bits of the section are still
+   * to be read (bits in the buffer included). */
+  void refill(uint64 bitsLeft) {
+    while (m_bits <= 56 && bitsLeft > m_bits) readByte();
+  }
+
+  /* Reads bytes until the buffer has at least n (<= 57) bits. Caller has
+   * to know that the section has the bits. */
+  void need(uint32 n) {
+    assert(n <= 57);
+    while (m_bits < n) readByte();
+  }
+
+  /* Next n bits, padded with zeros if the buffer has less bits. */
+  uint32 peek(uint32 n) const {
+    if (m_bits >= n) return (m_buffer >> (m_bits - n)) & mask(n);
+    return (m_buffer << (n - m_bits)) & mask(n);
+  }
+
+  void skip(uint32 n) { assert(n <= m_bits); m_bits -= n; }
+
+  uint32 take(uint32 n) {
+    uint32 value = peek(n);
+    skip(n);
+    return value;
+  }
+
+  /* Consumes the zeros before the next one-bit and returns their number. */
+  uint32 skipZeros() {
+    uint32 zeros = 0;
+    while (true) {
+      if (m_bits == 0) readByte();
+      uint64 window = m_buffer & mask(m_bits);
+      if (window == 0) {
+        zeros += m_bits;
+        m_bits = 0;
+      } else {
+        uint32 z = m_bits - 1 - utils::logFloor(window);
+        m_bits -= z;
+        return zeros + z;
+      }
+    }
+  }
+
+  uint32 bits() const { return m_bits; }
+
+  /* Drops the padding bits at the end of a section. */
+  void clear() { assert(m_bits < 8); m_bits = 0; }
+
+ private:
+  InStream* m_in;
+  uint64 m_buffer;
+  uint32 m_bits;
+
+  void readByte() {
+    m_buffer = (m_buffer << 8) | m_in->readByte();
+    m_bits += 8;
+  }
+
+  static uint64 mask(uint32 n) {
+    return n >= 64 ? ~static_cast<uint64>(0)
+        : (static_cast<uint64>(1) << n) - 1;
+  }
+};
+
+/*********************************************************************
+ * Decoding table for the codes given by utils::computeHuffmanCodes. *
+ * Each entry of the table corresponds to kTableBits next bits of    *
+ * the input and tells the one or two codes that fit completely into *
+ * them. Codes longer than kTableBits are decoded bit by bit using   *
+ * the canonical structure of the code: codes of each length are     *
+ * consecutive integers.                                             *
+ *********************************************************************/
+class HuffmanTable {
+ public:
+  struct Entry {
+    byte symbols[2];
+    byte len0;  // length of the code of symbols[0]
+    byte total; // length of both codes, 0 if the first code is too long
+  };
+
+  explicit HuffmanTable(const uint32* clen) : m_minLength(0xff) {
+    uint32 code[256];
+    utils::computeHuffmanCodes(const_cast<uint32*>(clen), code);
+
+    std::fill(m_count, m_count + kMaxLength + 1, 0);
+    for (uint32 k = 0; k < 256; ++k) {
+      if (clen[k] == 0) continue;
+      assert(clen[k] <= kMaxLength);
+      ++m_count[clen[k]];
+      m_minLength = std::min(m_minLength, clen[k]);
+    }
+    uint32 offset = 0;
+    for (uint32 len = 1; len <= kMaxLength; ++len) {
+      m_offset[len] = offset;
+      offset += m_count[len];
+    }
+    uint32 next[kMaxLength + 1];
+    std::copy(m_offset, m_offset + kMaxLength + 1, next);
+    std::fill(m_first, m_first + kMaxLength + 1, 0);
+    for (uint32 k = 0; k < 256; ++k) {
+      if (clen[k] == 0) continue;
+      if (next[clen[k]] == m_offset[clen[k]]) m_first[clen[k]] = code[k];
+      m_sorted[next[clen[k]]++] = static_cast<byte>(k);
+    }
+
+    Entry empty = {{0, 0}, 0, 0};
+    std::fill(m_table, m_table + (1 << kTableBits), empty);
+    for (uint32 k = 0; k < 256; ++k) {
+      if (clen[k] == 0 || clen[k] > kTableBits) continue;
+      uint32 shift = kTableBits - clen[k];
+      for (uint32 i = code[k] << shift; i < (code[k] + 1) << shift; ++i) {
+        m_table[i].symbols[0] = static_cast<byte>(k);
+        m_table[i].len0 = m_table[i].total = clen[k];
+      }
+    }
+    /* Second codes are taken from the entries of single codes. */
+    for (uint32 i = 0; i < (1u << kTableBits); ++i) {
+      Entry& e = m_table[i];
+      if (e.total == 0 || e.len0 == kTableBits) continue;
+      uint32 rest = (i << e.len0) & ((1 << kTableBits) - 1);
+      const Entry& second = m_table[rest];
+      if (second.total > 0 && e.len0 + second.len0 <= kTableBits) {
+        e.symbols[1] = second.symbols[0];
+        e.total = e.len0 + second.len0;
+      }
+    }
+  }
+
+  const Entry& lookup(uint32 bits) const { return m_table[bits]; }
+
+  uint32 minLength() const { return m_minLength; }
+
+  template <typename Reader>
+  byte decodeLongCode(Reader& reader) const {
+    uint32 value = 0;
+    for (uint32 len = 1; len <= kMaxLength; ++len) {
+      reader.need(1);
+      value = (value << 1) | reader.take(1);
+      if (m_count[len] > 0 && value >= m_first[len]
+          && value - m_first[len] < m_count[len])
+        return m_sorted[m_offset[len] + value - m_first[len]];
+    }
+    assert(false);
+    return 0;
+  }
+
+ private:
+  static const uint32 kMaxLength = 56;
+
+  Entry m_table[1 << kTableBits];
+  uint32 m_count[kMaxLength + 1];
+  uint32 m_first[kMaxLength + 1];
+  uint32 m_offset[kMaxLength + 1];
+  byte m_sorted[256];
+  uint32 m_minLength;
+};
+
+/* Reads bits most significant bit first from memory. The memory has to
+ * extend at least 16 bytes past the bits to be read.
+ *
+ * The next bits are kept in the most significant end of the 64-bit
+ * buffer. Refilling loads the next 8 bytes at once, of which as many whole
+ * bytes are counted as fit into the buffer; bits after the counted ones are
+ * the following bits of the input, not zeros. */
+class MemoryBitReader {
+ public:
+  MemoryBitReader() : m_pos(0), m_buffer(0), m_bits(0) {}
+  explicit MemoryBitReader(const byte* pos)
+      : m_pos(pos), m_buffer(0), m_bits(0) {}
+
+  /* After the call the buffer has at least 56 bits. */
+  void refill() {
+    m_buffer |= loadBigEndian(m_pos) >> m_bits;
+    m_pos += (63 - m_bits) >> 3;
+    m_bits |= 56;
+  }
+
+  void need(uint32 n) { if (m_bits < n) refill(); }
+
+  /* Next byte to be loaded into the buffer. */
+  const byte* position() const { return m_pos; }
+
+  uint32 peek(uint32 n) const { return m_buffer >> (64 - n); }
+
+  void skip(uint32 n) {
+    assert(n <= m_bits);
+    m_buffer <<= n;
+    m_bits -= n;
+  }
+
+  uint32 take(uint32 n) {
+    uint32 value = peek(n);
+    skip(n);
+    return value;
+  }
+
+  /* Consumes the zeros before the next one-bit, which has to be among the
+   * next 56 bits. */
+  uint32 skipZeros() {
+    refill();
+    assert(m_buffer != 0);
+    uint32 zeros = 63 - utils::logFloor(m_buffer);
+    assert(zeros < m_bits);
+    skip(zeros);
+    return zeros;
+  }
+
+ private:
+  const byte* m_pos;
+  uint64 m_buffer;
+  uint32 m_bits;
+
+  static uint64 loadBigEndian(const byte* p) {
+#ifdef __GNUC__
+    uint64 value;
+    std::memcpy(&value, p, sizeof(value));
+    return __builtin_bswap64(value);
+#else
+    uint64 value = 0;
+    for (int i = 0; i < 8; ++i) value = (value << 8) | p[i];
+    return value;
+#endif
+  }
+};
+
+/* Writes the Huffman codes of the symbols and pads the last byte with
+ * zeros. Returns the number of bytes written.
+ * Assumption: max_code_len <= 47 (roughly). */
+uint64 writeHuffmanCodes(const byte* runseq, uint64 nRuns, const uint32* clen,
+                         const uint32* code, OutStream* out) {
+  uint64 bytes = 0;
+  uint64 buffer = 0;
+  int32 bitsInBuffer = 0;
+  for (uint64 k = 0; k < nRuns; ++k) {
+    byte c = runseq[k];
+    while (bitsInBuffer + clen[c] > 64) {
+      bitsInBuffer -= 8;
+      out->writeByte((buffer >> bitsInBuffer) & 0xff);
+      ++bytes;
+    }
+    buffer <<= clen[c];
+    buffer |= code[c];
+    bitsInBuffer += clen[c];
+  }
+
+  // Flush the remaining bytes.
+  while (bitsInBuffer >= 8) {
+    bitsInBuffer -= 8;
+    out->writeByte((buffer >> bitsInBuffer) & 0xff);
+    ++bytes;
+  }
+
+  // Flush the remaining bits.
+  if (bitsInBuffer > 0) {
+    buffer <<= (8 - bitsInBuffer);
+    out->writeByte(buffer & 0xff);
+    ++bytes;
+  }
+  return bytes;
+}
+
+/* Writes the run lengths as gamma codes and pads the last byte with zeros.
+ * Returns the number of bytes written. */
+uint64 writeGammaCodes(RunBuffer::LengthIterator lengths, uint64 nRuns,
+                       OutStream* out) {
+  uint64 bytes = 0;
+  uint64 buffer = 0;
+  int32 bitsInBuffer = 0;
+  for (uint64 k = 0; k < nRuns; ++k) {
+    uint32 runlen = lengths.next();
+    int gammaCodeLen = utils::logFloor(runlen) * 2 + 1;
+    while (bitsInBuffer + gammaCodeLen > 64) {
+      bitsInBuffer -= 8;
+      out->writeByte((buffer >> bitsInBuffer) & 0xff);
+      ++bytes;
+    }
+    buffer <<= gammaCodeLen;
+    buffer |= runlen;
+    bitsInBuffer += gammaCodeLen;
+  }
+  while (bitsInBuffer >= 8) {
+    bitsInBuffer -= 8;
+    out->writeByte((buffer >> bitsInBuffer) & 0xff);
+    ++bytes;
+  }
+  if (bitsInBuffer > 0) {
+    buffer <<= (8 - bitsInBuffer);
+    out->writeByte(buffer & 0xff);
+    ++bytes;
+  }
+  return bytes;
+}
+
+} // namespace
+
+const byte RunBuffer::kLongRun;
+
+uint64 RunBuffer::store(const byte* src, size_t length, uint64* runFreqs) {
+  reserve(length);
+  m_longLengths.clear();
+  uint64 runs = 0;
+  size_t i = 0;
+  while (i < length) {
+    byte c = src[i];
+    size_t j = i + 1;
+    while (j < length && src[j] == c && j - i < utils::kMaxRunLength) ++j;
+    ++runFreqs[c];
+    m_symbols[runs] = c;
+    if (j - i < kLongRun) {
+      m_lengths[runs] = static_cast<byte>(j - i);
+    } else {
+      m_lengths[runs] = kLongRun;
+      m_longLengths.push_back(j - i);
+    }
+    ++runs;
+    i = j;
+  }
+  return runs;
+}
+
+void RunBuffer::reserve(size_t length) {
+  if (m_symbols.size() < length) {
+    m_symbols.resize(length);
+    m_lengths.resize(length);
+  }
+}
+
+RunBuffer::LengthIterator::LengthIterator(const RunBuffer& runs, uint64 first)
+    : m_short(&runs.m_lengths[0] + first), m_long(0) {
+  if (runs.m_longLengths.empty()) return;
+  m_long = &runs.m_longLengths[0]
+      + std::count(&runs.m_lengths[0], m_short, kLongRun);
+}
+
+HuffmanEncoder::HuffmanEncoder(uint32 substreams)
+    : m_substreams(substreams), m_headerPosition(0),
+      m_compressedBlockLength(0) {}
 
 HuffmanEncoder::~HuffmanEncoder() {}
 
 size_t HuffmanEncoder::
 transformAndEncode(BWTBlock& block, BWTManager& bwtm, OutStream* out) {
-  std::vector<uint32> characterFrequencies(256, 0);
+  std::vector<uint64> characterFrequencies(256, 0);
   //TODO: Also gather information about the runs  during BWT
   bwtm.doTransform(block, &characterFrequencies[0]); 
 
@@ -60,6 +418,23 @@ transformAndEncode(BWTBlock& block, BWTManager& bwtm, OutStream* out) {
   return m_compressedBlockLength + 6;
 }
 
+/* With substreams the codes of a context block are gathered before writing
+ * them. */
+uint64 HuffmanEncoder::
+maxSizeInBytes(uint64 block_size, const BWTManager& bwtm,
+               uint64 output) const {
+  uint64 bytes = output;
+  if (m_substreams > 1) bytes += maxEncodedSize(block_size);
+  return heldSizeInBytes(block_size)
+      + std::max(bytes, bwtm.maxSizeInBytes(block_size));
+}
+
+/* Run buffer takes two bytes per run and four more for each run of at least
+ * 255 bytes. It is kept from block to block. */
+uint64 HuffmanEncoder::heldSizeInBytes(uint64 block_size) const {
+  return 2*block_size + block_size/255*sizeof(uint32);
+}
+
 void HuffmanEncoder::serializeShape(uint32 *clen, std::vector<bool> &vec) {
   size_t maxLen = 0;
   byte b = 0;
@@ -117,18 +492,11 @@ size_t HuffmanDecoder::deserializeShape(InStream &input, uint32 *clen) {
 }
 
 void HuffmanEncoder::
-encodeData(const byte* block, const std::vector<uint32>& stats,
-           uint32 blockSize, OutStream* out) {
+encodeData(const byte* block, const std::vector<uint64>& stats,
+           uint64 /*blockSize*/, OutStream* out) {
   PROFILE("HuffmanEncoder::encodeData");
+  m_runs.reserve(*std::max_element(stats.begin(), stats.end()));
   size_t beg = 0;
-  
-  // For storing runs data.
-  byte *runseq = new byte[blockSize];
-  uint32 *runlen = new uint32[blockSize];
-  if (!runseq || !runlen) {
-    fprintf(stderr,"Allocation error.\n");
-    exit(1);
-  }
 
   const byte *block_ptr = block;
   for(size_t i = 0; i < stats.size(); ++i) {
@@ -140,14 +508,15 @@ encodeData(const byte* block, const std::vector<uint32>& stats,
     std::fill(clen, clen + 256, 0);
     uint64 freqs[256];
     std::fill(freqs, freqs + 256, 0);
-    uint64 nRuns = utils::calculateRunFrequenciesAndStoreRuns(freqs,
-      runseq, runlen, block_ptr + beg, current_cblock_size);
+    uint64 nRuns = m_runs.store(block_ptr + beg, current_cblock_size, freqs);
+    const byte* runseq = m_runs.symbols();
 
 #ifdef ENTROPY_PROFILER
     {
       std::map<uint32, uint32> runDistribution, charDistribution;
+      RunBuffer::LengthIterator runlen(m_runs, 0);
       for(size_t j = 0; j < nRuns; ++j) {
-        ++runDistribution[runlen[j]];
+        ++runDistribution[runlen.next()];
         ++charDistribution[runseq[j]];
       }
       
@@ -180,159 +549,82 @@ encodeData(const byte* block, const std::vector<uint32>& stats,
     // Store Huffman code lengths.
     std::vector<bool> shape;
     serializeShape(clen, shape);
-    for(size_t k = 0; k < shape.size();) {
-      byte b = 0; size_t j = 0;
-      for(; j < 8 && k < shape.size(); ++k, ++j) {
-        b <<= 1;
-        b |= (shape[k]) ? 1 : 0;
-      }
-      if (j < 8) b <<= (8 - j);
-      out->writeByte(b);
-      ++m_compressedBlockLength;
-    }
+    std::vector<byte> shapeBytes;
+    utils::packBits(shape, &shapeBytes);
+    out->writeBlock(&shapeBytes[0], &shapeBytes[0] + shapeBytes.size());
+    m_compressedBlockLength += shapeBytes.size();
 
     // Compute Huffman codes.
     uint32 code[256];
     utils::computeHuffmanCodes(clen, code);
 
-    // Encode the data using Huffman code.
-    // Assumption: max_code_len <= 47 (roughly).
-    uint64 buffer = 0;
-    int32 bitsInBuffer = 0;
-    for (uint64 k = 0; k < nRuns; ++k) {
-      byte c = runseq[k];
-      while (bitsInBuffer + clen[c] > 64) {
-        bitsInBuffer -= 8;
-        out->writeByte((buffer >> bitsInBuffer) & 0xff);
-        ++m_compressedBlockLength;
-      }
-      buffer <<= clen[c];
-      buffer |= code[c];
-      bitsInBuffer += clen[c];
-    }
-
-    // Flush the remaining bytes.    
-    while (bitsInBuffer >= 8) {
-      bitsInBuffer -= 8;
-      out->writeByte((buffer >> bitsInBuffer) & 0xff);
-      ++m_compressedBlockLength;
-    }
-
-    // Flush the remaining bits.
-    if (bitsInBuffer > 0) {
-      buffer <<= (8 - bitsInBuffer);
-      out->writeByte(buffer & 0xff);
-      ++m_compressedBlockLength;
-    }
-
-    // Store the lengths of runs.
-    buffer = 0;
-    bitsInBuffer = 0;
-    for (uint64 k = 0; k < nRuns; ++k) {
-      int gammaCodeLen = utils::logFloor(runlen[k]) * 2 + 1;
-      while (bitsInBuffer + gammaCodeLen > 64) {
-        bitsInBuffer -= 8;
-        out->writeByte((buffer >> bitsInBuffer) & 0xff);
-        ++m_compressedBlockLength;
-      }
-      buffer <<= gammaCodeLen;
-      buffer |= runlen[k];
-      bitsInBuffer += gammaCodeLen;
-    }
-    while (bitsInBuffer >= 8) {
-      bitsInBuffer -= 8;
-      out->writeByte((buffer >> bitsInBuffer) & 0xff);
-      ++m_compressedBlockLength;
-    }
-    if (bitsInBuffer > 0) {
-      buffer <<= (8 - bitsInBuffer);
-      out->writeByte(buffer & 0xff);
-      ++m_compressedBlockLength;
+    if (m_substreams == 1) {
+      m_compressedBlockLength +=
+          writeHuffmanCodes(runseq, nRuns, clen, code, out);
+      // Store the lengths of runs.
+      m_compressedBlockLength +=
+          writeGammaCodes(RunBuffer::LengthIterator(m_runs, 0), nRuns, out);
+    } else {
+      writeSubstreams(nRuns, clen, code, out);
     }
 
     beg += current_cblock_size;
   }
-  delete[] runseq;
-  delete[] runlen;
-}
-
-void HuffmanEncoder::finishBlock(OutStream* out) {
-  out->write48bits(m_compressedBlockLength, m_headerPosition);
 }
 
 /*********************************************************************
- * The format of header for single main block is the following:      *
- * - 48 bits for the length of the compressed main block, doesn't    *
- *   include 6 bytes used for this                                   *
- * - byte representing the number of separately encoded sections.    *
- *   zero represents 256                                             *
- * - lengths of the sections which are encoded with same wavelet tree*
+ * With m_substreams > 1 the runs of a context block are divided     *
+ * evenly into substreams, the j:th substream having the runs        *
+ * [nRuns*j/m_substreams, nRuns*(j+1)/m_substreams). Substreams can   *
+ * be decoded independently. After the shape of the code follows:    *
+ * - for each substream: the length of its decoded data, the number  *
+ *   of bytes in its Huffman codes and the number of bytes in its     *
+ *   gamma codes (packed integers)                                    *
+ * - for each substream: its Huffman codes and gamma codes, both      *
+ *   padded to full bytes                                            *
  *********************************************************************/
 void HuffmanEncoder::
-writeBlockHeader(const BWTBlock& block, std::vector<uint32>& stats,
-                 OutStream* out) {
-  uint64 headerLength = 0;
-  m_headerPosition = out->getPos();
-  for (unsigned i = 0; i < 6; ++i) out->writeByte(0x00); //fill 48 bits
-
-  headerLength += block.writeHeader(out);
-  
-  /* Deduce sections for separate encoding. At the moment uses not-so-well
-   * thought heuristic. */
-  std::vector<uint32> temp; std::vector<uint32>& s = stats;
-  size_t sum = 0;
-  for(size_t i = 0; i < s.size(); ++i) {
-    sum += s[i];
-    if(sum >= 10000) {
-      temp.push_back(sum);
-      sum = 0;
+writeSubstreams(uint64 nRuns, const uint32* clen, const uint32* code,
+                OutStream* out) {
+  std::vector<MemoryOutStream> codes(m_substreams), gammas(m_substreams);
+  for (uint32 j = 0; j < m_substreams; ++j) {
+    uint64 first = nRuns*j/m_substreams, last = nRuns*(j + 1)/m_substreams;
+    uint64 length = 0;
+    RunBuffer::LengthIterator runlen(m_runs, first);
+    for (uint64 k = first; k < last; ++k) length += runlen.next();
+    uint64 codeBytes = writeHuffmanCodes(m_runs.symbols() + first,
+                                         last - first, clen, code, &codes[j]);
+    uint64 gammaBytes = writeGammaCodes(
+        RunBuffer::LengthIterator(m_runs, first), last - first, &gammas[j]);
+    uint64 values[3] = {length, codeBytes, gammaBytes};
+    for (int v = 0; v < 3; ++v) {
+      int bytes;
+      writePackedInteger(utils::packInteger(values[v], &bytes), out);
+      m_compressedBlockLength += bytes;
     }
   }
-  if (sum != 0) {
-    if(temp.size() > 0) temp.back() += sum;
-    else temp.push_back(sum);
+  for (uint32 j = 0; j < m_substreams; ++j) {
+    out->writeBlock(codes[j].begin(), codes[j].end());
+    out->writeBlock(gammas[j].begin(), gammas[j].end());
+    m_compressedBlockLength += (codes[j].end() - codes[j].begin())
+        + (gammas[j].end() - gammas[j].begin());
   }
-  s.resize(temp.size());
-  std::copy(temp.begin(), temp.end(), s.begin());
-  byte len;
-  if(temp.size() == 256) len = 0;
-  else len = temp.size();
-  out->writeByte(len);
-  headerLength += 1;
-
-  assert(s.size() == temp.size());
-  assert(temp.size() <= 256);
+}
 
-  for (size_t i = 0; i < stats.size(); ++i) {
-    int bytes;
-    uint64 packed_cblock_size = utils::packInteger(stats[i], &bytes);
-    headerLength += bytes;
-    writePackedInteger(packed_cblock_size, out);
-  }
-  m_compressedBlockLength = headerLength;
+void HuffmanEncoder::finishBlock(OutStream* out) {
+  out->write48bits(m_compressedBlockLength, m_headerPosition);
 }
 
-/* Integer is written in reversal fashion so that it can be read easier.*/
-void HuffmanEncoder::writePackedInteger(uint64 packed_integer, OutStream* out) {
-  do {
-    byte to_written = static_cast<byte>(packed_integer & 0xFF);
-    packed_integer >>= 8;
-    out->writeByte(to_written);
-  } while (packed_integer);
+void HuffmanEncoder::
+writeBlockHeader(const BWTBlock& block, std::vector<uint64>& stats,
+                 OutStream* out) {
+  m_compressedBlockLength =
+      writeEncodedBlockHeader(block, stats, out, &m_headerPosition);
 }
 
 uint64 HuffmanDecoder::
 readBlockHeader(BWTBlock& block, std::vector<uint64>* stats, InStream* in) {
-  uint64 compressed_length = in->read48bits();
-  block.readHeader(in);
-  
-  byte sections = in->readByte();
-  size_t sects = (sections == 0) ? 256 : sections;
-  for(size_t i = 0; i < sects; ++i) {
-    uint64 value = readPackedInteger(in);
-    stats->push_back(utils::unpackInteger(value));
-  }
-  return compressed_length;
+  return readEncodedBlockHeader(block, stats, in);
 }
 
 void HuffmanDecoder::decodeBlock(BWTBlock& block, InStream* in) {
@@ -349,8 +641,6 @@ void HuffmanDecoder::decodeBlock(BWTBlock& block, InStream* in) {
   uint64 block_size = std::accumulate(
       context_lengths.begin(), context_lengths.end(), static_cast<uint64>(0));
   
-  byte *runseq = new byte[block_size];
-  uint32 *runlen = new uint32[block_size];
 
   byte *data_ptr = block.begin();
 
@@ -366,273 +656,140 @@ void HuffmanDecoder::decodeBlock(BWTBlock& block, InStream* in) {
     std::fill(clen, clen + 256, 0);
     deserializeShape(*in, clen);
 
-    // Compute Huffman codes.
-    uint32 code[256];
-    utils::computeHuffmanCodes(clen, code);
-
-    // Comput lookup arrays used in Huffman decoding.
-    //   1. For each byte k, leadingZeros[p][k] tells what is the number of
-    //      leading zeros on p least significant bits of k (the other bits
-    //      doesn't matter).
-    byte leadingZeros[9][256];
-    
-    //   2. For each length t and byte k lookupWhich[t][k] tells which
-    //      Huffman code consists of t zeros followed by some prefix of k.
-    //      In case there is no such code, the value 256 is stored.
-    uint16 lookupWhich[50][256];
-    
-    //   3. For each length t and byte k such that lookupWhich[t][k] < 256,
-    //      lookupLength[t][k] tells the length of corresponding code prefix.
-    byte lookupLength[50][256];
-    
-    // Compute lookup arrays.
-    for (int32 p = 0; p <= 8; ++p) {
-      for (int32 k = 0; k < 256; ++k) {
-        leadingZeros[p][k] = p;
-        for (int32 t = 0; t < p; ++t)
-          if (k & (1 << t))
-            leadingZeros[p][k] = p - t - 1;
-      }
-    }
-    for (int32 k = 0; k < 50; ++k)
-      std::fill(&lookupWhich[k][0], &lookupWhich[k][256], 256);
-    for (int k = 0; k < 256; ++k) if (clen[k] && code[k]) {
-      int32 max_non0_bit = 0;
-      for (int32 j = 0; j < 16; ++j)
-        if (code[k] & (1 << j))
-          max_non0_bit = j;
-      ++max_non0_bit;
-      int32 lead0 = clen[k] - max_non0_bit;
-      int32 rest = 8 - max_non0_bit;
-      for (int32 any_set = 0; any_set < (1 << rest); ++any_set) {
-        lookupWhich[lead0][(code[k] << rest) + any_set] = k;
-        lookupLength[lead0][(code[k] << rest) + any_set] = max_non0_bit;
-      }
-    }
-    
-    // Store the symbol (and its length) that have code with zeros only.
-    int32 len0 = 0;
-    byte b = 0, code0 = 0;
-    for (int32 k = 0; k < 256; ++k, ++b) {
-      if (clen[k] > 0 && code[k] == 0) {
-        len0 = clen[k];
-        code0 = b;
-      }
+    if (m_substreams > 1) {
+      decodeSubstreams(clen, nRuns, data_ptr, context_lengths[i], in);
+      data_ptr += context_lengths[i];
+      continue;
     }
 
-    // Decode Huffman codes.
-    byte buffer = 0;
-    int32 bitsInBuffer = 0, zeroCount = 0;
-    uint32 haveDecoded = 0;
+    // Decode the symbols of the runs.
+    if (m_runseq.size() < nRuns) m_runseq.resize(nRuns);
+    byte* runseq = &m_runseq[0];
+    HuffmanTable table(clen);
+    SectionBitReader reader(in);
+    uint32 minLen = table.minLength();
+    uint64 haveDecoded = 0;
     while (haveDecoded < nRuns) {
-      byte b = in->readByte();
-      if (zeroCount > 0 && !bitsInBuffer) {
-        buffer = b;
-        if (!buffer) {
-          zeroCount += 8;
-          
-          // Extract codes consisting of zeros (code0s).
-          while (zeroCount >= len0 && haveDecoded < nRuns) {
-            runseq[haveDecoded++] = code0;
-            zeroCount -= len0;
-          }
-        } else {
-        
-          // Extract code0s.
-          zeroCount += leadingZeros[8][buffer];
-          bitsInBuffer = 8 - leadingZeros[8][buffer];
-          while (zeroCount >= len0 && haveDecoded < nRuns) {
-            runseq[haveDecoded++] = code0;
-            zeroCount -= len0;
-          }
-          
-          // Extract code on the boundary of previous byte (buffer) and b.
-          if (zeroCount + bitsInBuffer > 8 && haveDecoded < nRuns) {
-            byte sbuffer = (buffer << (8 - bitsInBuffer));
-            if (lookupWhich[zeroCount][sbuffer] < 256 &&
-                bitsInBuffer >= lookupLength[zeroCount][sbuffer]) {
-              runseq[haveDecoded++] = lookupWhich[zeroCount][sbuffer];
-              bitsInBuffer -= lookupLength[zeroCount][sbuffer];
-              zeroCount = leadingZeros[bitsInBuffer][buffer];
-              bitsInBuffer -= zeroCount;
-              buffer &= (1 << bitsInBuffer) - 1;
-            }
-            while (zeroCount >= len0 && haveDecoded < nRuns) {
-              runseq[haveDecoded++] = code0;
-              zeroCount -= len0;
-            }
-          }
-
-          // Extract codes from b.
-          if (zeroCount + bitsInBuffer <= 8 && haveDecoded < nRuns) {
-            while (haveDecoded < nRuns) { bool decoded = false;
-              byte sbuffer = (buffer << (8 - bitsInBuffer));
-              if (lookupWhich[zeroCount][sbuffer] < 256
-                  && bitsInBuffer >= lookupLength[zeroCount][sbuffer]) {
-                runseq[haveDecoded++] = lookupWhich[zeroCount][sbuffer];
-                bitsInBuffer -= lookupLength[zeroCount][sbuffer];
-                zeroCount = leadingZeros[bitsInBuffer][buffer];
-                bitsInBuffer -= zeroCount; decoded = true;
-                buffer &= (1 << bitsInBuffer) - 1;
-              }
-              while (zeroCount >= len0 && haveDecoded < nRuns) {
-                runseq[haveDecoded++] = code0;
-                zeroCount -= len0; decoded = true;
-              }
-              if (!decoded) break;
-            }
-            continue;
-          }
-
-          // Tricky case, the code starts in byte before b (buffer) and ends in
-          // byte after b (nextb), but since b is nonzero, we are guaranteed
-          // that this code will end in the very next byte after b (nextb).
-          if (zeroCount + bitsInBuffer > 8 && haveDecoded < nRuns) {
-            
-            // Read nextb.
-            byte nextb = in->readByte();
-            byte cbuffer = (buffer << (8 - bitsInBuffer)) |
-              (nextb >> bitsInBuffer);
-            assert(lookupWhich[zeroCount][cbuffer] < 256);
-            runseq[haveDecoded++] = lookupWhich[zeroCount][cbuffer];
-            bitsInBuffer = bitsInBuffer + (8 - lookupLength[zeroCount][cbuffer]);
-            zeroCount = leadingZeros[bitsInBuffer][nextb];
-            bitsInBuffer -= zeroCount;
-            buffer = nextb;
-            nextb &= (1 << bitsInBuffer) - 1;
-
-            // Extract codes from nextb.
-            while (haveDecoded < nRuns) { bool decoded = false;
-              byte sbuffer = (buffer << (8 - bitsInBuffer));
-              if (lookupWhich[zeroCount][sbuffer] < 256  &&
-                  bitsInBuffer >= lookupLength[zeroCount][sbuffer]) {
-                runseq[haveDecoded++] = lookupWhich[zeroCount][sbuffer];
-                bitsInBuffer -= lookupLength[zeroCount][sbuffer];
-                zeroCount = leadingZeros[bitsInBuffer][buffer];
-                bitsInBuffer -= zeroCount; decoded = true;
-                buffer &= (1 << bitsInBuffer) - 1;
-              }
-              while (zeroCount >= len0 && haveDecoded < nRuns) {
-                runseq[haveDecoded++] = code0;
-                zeroCount -= len0; decoded = true;
-              }
-              if (!decoded) break;
-            }
-            continue;
-          }
-        }
-      } else if (!zeroCount && !bitsInBuffer) {
-      
-        // Extract codes from b.
-        buffer = b;
-        bitsInBuffer = 8;
-        zeroCount = leadingZeros[bitsInBuffer][buffer];
-        bitsInBuffer -= zeroCount;
-        while (haveDecoded < nRuns) { bool decoded = false;
-          byte sbuffer = (buffer << (8 - bitsInBuffer));
-          if (lookupWhich[zeroCount][sbuffer] < 256
-              && bitsInBuffer >= lookupLength[zeroCount][sbuffer]) {
-            runseq[haveDecoded++] = lookupWhich[zeroCount][sbuffer];
-            bitsInBuffer -= lookupLength[zeroCount][sbuffer];
-            zeroCount = leadingZeros[bitsInBuffer][buffer];
-            bitsInBuffer -= zeroCount;
-            decoded = true;
-            buffer &= (1 << bitsInBuffer) - 1;
-          }
-          while (zeroCount >= len0 && haveDecoded < nRuns) {
-            runseq[haveDecoded++] = code0;
-            zeroCount -= len0;
-            decoded = true;
-          }
-          if (!decoded) break;
-        }
+      reader.refill((nRuns - haveDecoded) * minLen);
+      const HuffmanTable::Entry& e = table.lookup(reader.peek(kTableBits));
+      if (e.total == 0) {
+        runseq[haveDecoded++] = table.decodeLongCode(reader);
         continue;
-      } else { // bitsInBuffer > 0
-
-        // Previous byte (buffer) contains nonzero non-consumed bits, hence
-        // this code will end in b.
-        byte cbuffer = (buffer << (8 - bitsInBuffer)) | (b >> bitsInBuffer);
-        assert(lookupWhich[zeroCount][cbuffer] < 256);
-        runseq[haveDecoded++] = lookupWhich[zeroCount][cbuffer];
-        bitsInBuffer = bitsInBuffer + (8 - lookupLength[zeroCount][cbuffer]);
-        zeroCount = leadingZeros[bitsInBuffer][b];
-        bitsInBuffer -= zeroCount;
-        buffer = b;
-        buffer &= (1 << bitsInBuffer) - 1;
-
-        // Extract codes from b.
-        while (haveDecoded < nRuns) {
-          bool decoded = false;
-          byte sbuffer = (buffer << (8 - bitsInBuffer));
-          if (lookupWhich[zeroCount][sbuffer] < 256 &&
-              bitsInBuffer >= lookupLength[zeroCount][sbuffer]) {
-            runseq[haveDecoded++] = lookupWhich[zeroCount][sbuffer];
-            bitsInBuffer -= lookupLength[zeroCount][sbuffer];
-            zeroCount = leadingZeros[bitsInBuffer][buffer];
-            bitsInBuffer -= zeroCount;
-            decoded = true;
-            buffer &= (1 << bitsInBuffer) - 1;
-          }
-          while (zeroCount >= len0 && haveDecoded < nRuns) {
-            runseq[haveDecoded++] = code0;
-            zeroCount -= len0;
-            decoded = true;
-          }
-          if (!decoded) break;
-        }
+      }
+      // Near the end of the section the buffer may hold less bits than the
+      // lookup, and the entry found with the padding zeros may be longer
+      // than the actual code. Reading more bits could then go past the
+      // section, so the code is decoded bit by bit.
+      if (e.len0 > reader.bits()) {
+        runseq[haveDecoded++] = table.decodeLongCode(reader);
         continue;
       }
+      runseq[haveDecoded++] = e.symbols[0];
+      if (e.total > e.len0 && e.total <= reader.bits() && haveDecoded < nRuns) {
+        runseq[haveDecoded++] = e.symbols[1];
+        reader.skip(e.total);
+      } else {
+        reader.skip(e.len0);
+      }
     }
-    in->flushBuffer();
 
-    // Now read gamma codes that store lenghts of runs.
+    // Now read gamma codes that store lenghts of runs and fill the block
+    // with the runs. The section starts from the next byte.
+    reader.clear();
     for (uint64 k = 0; k < nRuns; ++k) {
-      int zeros = 0;
-      while (!in->readBit())
-        ++zeros;
-      uint64 value = 0;        
-      for (int32 t = 0; t < zeros; ++t) {
-        int32 bit = in->readBit();
-        value = (value << 1) | bit;
-      }
-      value |= (1 << zeros);
-      runlen[k] = value;
+      reader.refill(nRuns - k);
+      uint32 zeros = reader.skipZeros();
+      reader.need(zeros + 1);
+      uint32 runlen = reader.take(zeros + 1);
+      std::fill(data_ptr, data_ptr + runlen, runseq[k]);
+      data_ptr += runlen;
     }
     in->flushBuffer();
-    
-    // Fill the block with runs data.
-    byte *runseq_ptr = &runseq[0];
-    for (uint64 k = 0; k < nRuns; ++k) {
-      for (uint32 t = 0; t < runlen[k]; ++t)
-        *data_ptr++ = *runseq_ptr;
-      ++runseq_ptr;
-    }
   }
 
   block.setSize(block_size);
-  
-  delete[] runseq;
-  delete[] runlen;
 }
 
-uint64 HuffmanDecoder::readPackedInteger(InStream* in) {
-  static const uint64 kEndSymbol = static_cast<uint64>(1) << 63;
-  static const uint64 kEndMask = static_cast<uint64>(1) << 7;
+/* Decodes the substreams written by HuffmanEncoder::writeSubstreams in
+ * lockstep, one run from each substream at a time, so that the decoding of
+ * the substreams can overlap in the CPU. The lengths of the substreams have
+ * to add up to the length of the context block and a run may not go past
+ * the end of its substream, so corrupt input cannot write over the block. */
+void HuffmanDecoder::
+decodeSubstreams(const uint32* clen, uint64 nRuns, byte* to, uint64 length,
+                 InStream* in) {
+  HuffmanTable table(clen);
+  std::vector<uint64> lengths(m_substreams), runs(m_substreams);
+  std::vector<uint64> codeBytes(m_substreams), gammaBytes(m_substreams);
+  uint64 total = 0, decodedLength = 0;
+  for (uint32 j = 0; j < m_substreams; ++j) {
+    lengths[j] = utils::unpackInteger(readPackedInteger(in));
+    codeBytes[j] = utils::unpackInteger(readPackedInteger(in));
+    gammaBytes[j] = utils::unpackInteger(readPackedInteger(in));
+    runs[j] = nRuns*(j + 1)/m_substreams - nRuns*j/m_substreams;
+    if (lengths[j] > length - decodedLength) truncated();
+    decodedLength += lengths[j];
+    uint64 bytesLeft = in->bytesLeft() - total;
+    if (codeBytes[j] > bytesLeft || gammaBytes[j] > bytesLeft - codeBytes[j])
+      truncated();
+    total += codeBytes[j] + gammaBytes[j];
+  }
+  if (decodedLength != length) truncated();
+  /* A reader may have loaded 8 bytes past its section when a run has been
+   * decoded. The readers of corrupt input are stopped there, and one more
+   * run reads at most 24 bytes further, so 32 bytes of padding suffice. */
+  m_substreamData.resize(total + 32);
+  if (total > 0 && in->readBlock(&m_substreamData[0], total) != total)
+    truncated();
+
+  std::vector<MemoryBitReader> codes(m_substreams), gammas(m_substreams);
+  std::vector<const byte*> codeEnd(m_substreams), gammaEnd(m_substreams);
+  std::vector<byte*> out(m_substreams), end(m_substreams);
+  const byte* pos = &m_substreamData[0];
+  for (uint32 j = 0; j < m_substreams; ++j) {
+    codes[j] = MemoryBitReader(pos);
+    codeEnd[j] = pos + codeBytes[j] + 8;
+    gammas[j] = MemoryBitReader(pos + codeBytes[j]);
+    pos += codeBytes[j] + gammaBytes[j];
+    gammaEnd[j] = pos + 8;
+    out[j] = to;
+    to += lengths[j];
+    end[j] = to;
+  }
 
-  uint64 packed_integer = 0;
-  bool bits_left = true;
-  int i;
-  for(i = 0; bits_left; ++i) {
-    uint64 read = static_cast<uint64>(in->readByte());
-    bits_left = (read & kEndMask) != 0;
-    packed_integer |= (read << i*8);
+  uint64 maxRuns = *std::max_element(runs.begin(), runs.end());
+  for (uint64 k = 0; k < maxRuns; ++k) {
+    for (uint32 j = 0; j < m_substreams; ++j) {
+      if (k >= runs[j]) continue;
+      MemoryBitReader& code = codes[j];
+      code.refill();
+      const HuffmanTable::Entry& e = table.lookup(code.peek(kTableBits));
+      byte c;
+      if (e.total == 0) {
+        c = table.decodeLongCode(code);
+      } else {
+        c = e.symbols[0];
+        code.skip(e.len0);
+      }
+      MemoryBitReader& gamma = gammas[j];
+      gamma.refill();
+      uint32 zeros = gamma.skipZeros();
+      gamma.need(zeros + 1);
+      uint32 runLength = gamma.take(zeros + 1);
+      if (runLength > static_cast<uint64>(end[j] - out[j]) ||
+          code.position() > codeEnd[j] || gamma.position() > gammaEnd[j])
+        truncated();
+      std::fill(out[j], out[j] + runLength, c);
+      out[j] += runLength;
+    }
   }
-  if (packed_integer == 0x80) return kEndSymbol;
-  return packed_integer;
+  for (uint32 j = 0; j < m_substreams; ++j)
+    if (out[j] != end[j]) truncated();
 }
 /*********** Encoding and decoding single BWTBlock-section ends ********/
 
-HuffmanDecoder::HuffmanDecoder() {}
+HuffmanDecoder::HuffmanDecoder(uint32 substreams)
+    : m_substreams(substreams) {}
 
 HuffmanDecoder::~HuffmanDecoder() {}
 
@@ -42,45 +42,103 @@
 
 namespace bwtc {
 
+/**Number of substreams in the context blocks of the multi-stream format. */
+const uint32 kHuffmanSubstreams = 4;
+
+/**Runs of a context block. The buffers are kept from one block to the
+ * next and they only grow, so that they are reallocated only when a context
+ * block has more runs than any before.
+ *
+ * Run lengths below 255 take a byte. Longer ones are stored separately,
+ * leaving 255 in their place.
+ */
+class RunBuffer {
+ public:
+  /**Stores the runs of src and counts the runs of each symbol to runFreqs.
+   *
+   * @return number of runs
+   */
+  uint64 store(const byte* src, size_t length, uint64* runFreqs);
+
+  /**Allocates the buffers for context blocks of at most length bytes. */
+  void reserve(size_t length);
+
+  const byte* symbols() const { return &m_symbols[0]; }
+
+  /**Gives the run lengths one by one, starting from a given run. */
+  class LengthIterator {
+   public:
+    LengthIterator(const RunBuffer& runs, uint64 first);
+    uint32 next() {
+      byte b = *m_short++;
+      return b < kLongRun ? b : *m_long++;
+    }
+   private:
+    const byte* m_short;
+    const uint32* m_long;
+  };
+
+ private:
+  static const byte kLongRun = 255;
+
+  std::vector<byte> m_symbols;
+  std::vector<byte> m_lengths;
+  std::vector<uint32> m_longLengths;
+};
+
 class HuffmanEncoder : public EntropyEncoder {
  public:
-  HuffmanEncoder();
+  /**@param substreams Number of independently decodable substreams each
+   *                   context block is divided into. With 1 the format
+   *                   is the original single stream format. */
+  explicit HuffmanEncoder(uint32 substreams = 1);
   ~HuffmanEncoder();
 
   size_t transformAndEncode(BWTBlock& block, BWTManager& bwtm,
                             OutStream* out);
+  uint64 maxSizeInBytes(uint64 block_size, const BWTManager& bwtm,
+                        uint64 output) const;
+  uint64 heldSizeInBytes(uint64 block_size) const;
   
-  void encodeData(const byte* data, const std::vector<uint32>& stats,
-                  uint32 blockSize, OutStream* out);
-  void writeBlockHeader(const BWTBlock& b, std::vector<uint32>& stats,
+  void encodeData(const byte* data, const std::vector<uint64>& stats,
+                  uint64 blockSize, OutStream* out);
+  void writeBlockHeader(const BWTBlock& b, std::vector<uint64>& stats,
                         OutStream* out);
   void finishBlock(OutStream* out);
 
-  void writePackedInteger(uint64 packed_integer, OutStream* out);
-
-
  private:
+  uint32 m_substreams;
   long int m_headerPosition;
   uint64 m_compressedBlockLength;
+  RunBuffer m_runs;
 
   void serializeShape(uint32 *clen, std::vector<bool> &vec);
+  void writeSubstreams(uint64 nRuns, const uint32* clen, const uint32* code,
+                       OutStream* out);
   HuffmanEncoder(const HuffmanEncoder&);
   HuffmanEncoder& operator=(const HuffmanEncoder&);
 };
 
 class HuffmanDecoder : public EntropyDecoder {
  public:
-  HuffmanDecoder();
+  /**@param substreams See HuffmanEncoder. */
+  explicit HuffmanDecoder(uint32 substreams = 1);
   ~HuffmanDecoder();
 
-  uint64 readPackedInteger(InStream* in);
   void decodeBlock(BWTBlock& block, InStream* in);
   uint64 readBlockHeader(BWTBlock& block, std::vector<uint64>* stats,
                          InStream* in);
 
  private:
+  uint32 m_substreams;
+  /** Compressed substreams of a context block. */
+  std::vector<byte> m_substreamData;
+  /** Symbols of the runs of a context block. Only grows. */
+  std::vector<byte> m_runseq;
 
   size_t deserializeShape(InStream &input, uint32 *clen);
+  void decodeSubstreams(const uint32* clen, uint64 nRuns, byte* to,
+                        uint64 length, InStream* in);
   HuffmanDecoder(const HuffmanDecoder&);
   HuffmanDecoder& operator=(const HuffmanDecoder&);
 };
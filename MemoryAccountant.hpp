@@ -0,0 +1,97 @@
+/**
+ * @file MemoryAccountant.hpp
+ *
+ * @section LICENSE
+ *
+ * This file is part of bwtc.
+ *
+ * bwtc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bwtc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bwtc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Bookkeeping of the memory limit given by the user.
+ */
+
+#ifndef BWTC_MEMORY_ACCOUNTANT_HPP_
+#define BWTC_MEMORY_ACCOUNTANT_HPP_
+
+#include "globaldefs.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace bwtc {
+
+/**Keeps account of the memory limit. Memory which stays in use while the
+ * later stages run, for example the precompression block whose slices are
+ * being transformed, is reserved from the accountant. Block sizes are then
+ * chosen as the largest ones whose footprints fit into what is left.
+ *
+ * The stages report their footprints themselves with maxSizeInBytes:
+ * Precompressor, BWTransform (through BWTManager), EntropyEncoder (which
+ * includes the transform it calls) and InverseBWTransform. Each of them
+ * gives an upper bound for the memory used for a block of given size,
+ * excluding the block itself.
+ */
+class MemoryAccountant {
+ public:
+  explicit MemoryAccountant(uint64 limit) : m_limit(limit), m_reserved(0) {}
+
+  uint64 limit() const { return m_limit; }
+  uint64 reserved() const { return m_reserved; }
+  uint64 available() const {
+    return m_limit > m_reserved ? m_limit - m_reserved : 0;
+  }
+
+  void reserve(uint64 bytes) { m_reserved += bytes; }
+  void release(uint64 bytes) {
+    assert(bytes <= m_reserved);
+    m_reserved -= bytes;
+  }
+
+  /**Finds the largest block size n <= maxSize for which copies blocks can
+   * be processed at the same time, that is copies*footprint(n) fits into
+   * available memory.
+   *
+   * @param footprint Function object giving the bytes used for a block of
+   *                  size n. It has to be nondecreasing in n.
+   * @param copies Number of blocks processed at the same time.
+   * @param maxSize Largest acceptable block size.
+   * @return the block size, which is 1 if even that doesn't fit
+   */
+  template <typename Footprint>
+  uint64 largestBlock(const Footprint& footprint, uint64 copies,
+                      uint64 maxSize) const {
+    uint64 budget = available()/std::max(copies, static_cast<uint64>(1));
+    uint64 low = 1, high = std::max(maxSize, static_cast<uint64>(1));
+    if(footprint(low) > budget) return low;
+    while(low < high) {
+      uint64 mid = low + (high - low + 1)/2;
+      if(footprint(mid) <= budget) low = mid;
+      else high = mid - 1;
+    }
+    return low;
+  }
+
+ private:
+  uint64 m_limit;
+  uint64 m_reserved;
+
+  MemoryAccountant(const MemoryAccountant&);
+  MemoryAccountant& operator=(const MemoryAccountant&);
+};
+
+} //namespace bwtc
+
+#endif
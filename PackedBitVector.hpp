@@ -0,0 +1,158 @@
+/**
+ * @file PackedBitVector.hpp
+ *
+ * @section LICENSE
+ *
+ * This file is part of bwtc.
+ *
+ * bwtc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bwtc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bwtc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Bitvector packed into 64-bit words with an optional rank directory.
+ */
+
+#ifndef BWTC_PACKED_BIT_VECTOR_HPP_
+#define BWTC_PACKED_BIT_VECTOR_HPP_
+
+#include "globaldefs.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace bwtc {
+
+/**Bitvector which stores the bits into 64-bit words and, once its rank
+ * directory is built, answers to rank queries in constant time. It can be
+ * used as the BitVector-parameter of WaveletTree.
+ *
+ * Bit i is the (i mod 64):th least significant bit of the word i/64.
+ *
+ * Rank directory has two levels: for each superblock of 2^16 bits the number
+ * of ones before it, and for each block of 512 bits the number of ones
+ * between the beginning of its superblock and the block. The rest is counted
+ * from at most 8 words. The coders only push and read the bits, so the
+ * directory is built on demand with buildRankDirectory and pushing bits
+ * doesn't pay for it.
+ */
+class PackedBitVector {
+ public:
+  PackedBitVector() : m_size(0), m_ones(0), m_rankedBits(0) {}
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  void reserve(size_t bits) {
+    m_words.reserve((bits + kWordBits - 1)/kWordBits);
+  }
+
+  void clear() {
+    m_words.clear();
+    m_superblocks.clear();
+    m_blocks.clear();
+    m_size = m_ones = m_rankedBits = 0;
+  }
+
+  bool operator[](size_t i) const {
+    assert(i < m_size);
+    return (m_words[i/kWordBits] >> (i % kWordBits)) & 1;
+  }
+
+  bool back() const { return (*this)[m_size - 1]; }
+
+  void push_back(bool bit) {
+    if(m_size % kWordBits == 0) m_words.push_back(0);
+    if(bit) m_words.back() |= static_cast<uint64>(1) << (m_size % kWordBits);
+    ++m_size;
+  }
+
+  void pop_back() {
+    assert(m_size > 0);
+    --m_size;
+    m_words.back() &= ~(static_cast<uint64>(1) << (m_size % kWordBits));
+    if(m_size % kWordBits == 0) m_words.pop_back();
+  }
+
+  /**Builds the rank directory of the current bits. It is needed by rank,
+   * rank1 and ones, and has to be built again after the bits change. */
+  void buildRankDirectory() {
+    m_superblocks.clear();
+    m_blocks.clear();
+    m_ones = 0;
+    for(size_t w = 0; w < m_words.size(); ++w) {
+      if(w % kWordsInBlock == 0) {
+        if(w % kWordsInSuperblock == 0) m_superblocks.push_back(m_ones);
+        m_blocks.push_back(static_cast<uint16>(m_ones - m_superblocks.back()));
+      }
+      m_ones += popcount(m_words[w]);
+    }
+    m_rankedBits = m_size;
+  }
+
+  /**Number of bits equal to bit in the range [0, i). */
+  size_t rank(bool bit, size_t i) const {
+    size_t ones = rank1(i);
+    return bit ? ones : std::min(i, m_size) - ones;
+  }
+
+  /**Number of one-bits in the range [0, i). */
+  size_t rank1(size_t i) const {
+    assert(m_rankedBits == m_size);
+    if(i >= m_size) return m_ones;
+    size_t word = i/kWordBits;
+    size_t ones = m_superblocks[i/kSuperblockBits] + m_blocks[i/kBlockBits];
+    for(size_t w = (i/kBlockBits)*kWordsInBlock; w < word; ++w) {
+      ones += popcount(m_words[w]);
+    }
+    uint64 mask = (static_cast<uint64>(1) << (i % kWordBits)) - 1;
+    return ones + popcount(m_words[word] & mask);
+  }
+
+  /**Total number of one-bits. */
+  size_t ones() const {
+    assert(m_rankedBits == m_size);
+    return m_ones;
+  }
+
+  /**Word-level access to the bits (see the class description for the order
+   * of the bits). Unused bits of the last word are zeros. */
+  size_t words() const { return m_words.size(); }
+  uint64 word(size_t w) const { return m_words[w]; }
+
+  bool operator==(const PackedBitVector& other) const {
+    return m_size == other.m_size && m_words == other.m_words;
+  }
+
+ private:
+  static const size_t kWordBits = 64;
+  static const size_t kBlockBits = 512;
+  static const size_t kWordsInBlock = kBlockBits/kWordBits;
+  static const size_t kSuperblockBits = 1 << 16;
+  static const size_t kWordsInSuperblock = kSuperblockBits/kWordBits;
+
+  std::vector<uint64> m_words;
+  std::vector<uint64> m_superblocks;
+  std::vector<uint16> m_blocks;
+  size_t m_size;
+  /* Number of ones and the bits covered by the rank directory. */
+  size_t m_ones;
+  size_t m_rankedBits;
+
+  static size_t popcount(uint64 w) { return __builtin_popcountll(w); }
+};
+
+} //namespace bwtc
+
+#endif
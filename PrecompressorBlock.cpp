@@ -36,12 +36,20 @@ namespace bwtc {
 
 PrecompressorBlock::PrecompressorBlock(size_t size)
     : m_data((byte*)malloc(sizeof(byte)*(size+1))), m_used(0),
-      m_originalSize(size), m_reserved(size+1) {}
+      m_originalSize(size), m_reserved(size+1), m_mappedFrom(0) {}
 
 PrecompressorBlock::PrecompressorBlock(size_t maxSize, InStream* in)
-    : m_data((byte*)malloc(sizeof(byte)*(maxSize+1))), m_used(0),
-      m_originalSize(0), m_reserved(maxSize+1)
+    : m_data(0), m_used(0), m_originalSize(0), m_reserved(0), m_mappedFrom(0)
 {
+  size_t mapped;
+  m_data = in->mapBlock(maxSize, &mapped);
+  if(m_data) {
+    m_mappedFrom = in;
+    m_reserved = mapped + 1;
+    m_originalSize = m_used = mapped;
+    return;
+  }
+  m_data = (byte*)malloc(sizeof(byte)*(maxSize+1));
   uint64 read = in->readBlock(m_data, maxSize);
   m_data = (byte*)realloc(m_data, sizeof(byte)*(read+1));
   m_reserved = read + 1;
@@ -49,7 +57,8 @@ PrecompressorBlock::PrecompressorBlock(size_t maxSize, InStream* in)
 }
 
 PrecompressorBlock::~PrecompressorBlock() {
-  free(m_data);
+  if(m_mappedFrom) m_mappedFrom->unmapBlock(m_data, m_originalSize);
+  else free(m_data);
 }
 
 void PrecompressorBlock::setSize(size_t size) {
@@ -57,7 +66,11 @@ void PrecompressorBlock::setSize(size_t size) {
   if(m_used != size) {
     m_used = size;
     m_reserved = size+1;
-    m_data = (byte*)realloc(m_data, sizeof(byte)*(m_reserved));
+    /* Mapped block can only shrink, and the mapping is kept as it is. */
+    assert(!m_mappedFrom || size <= m_originalSize);
+    if(!m_mappedFrom) {
+      m_data = (byte*)realloc(m_data, sizeof(byte)*(m_reserved));
+    }
   }
 }
 
@@ -123,11 +136,11 @@ readBlockHeader(InStream* in, MetaData metadata) {
 void PrecompressorBlock::sliceIntoBlocks(size_t blockSize) {
   //Have at least one additional byte for the sentinel of BWT
   assert(m_used < m_reserved);
-  assert(blockSize < (0x80000000 - 2));
+  assert(blockSize <= kMaxBlockSize);
   m_bwtBlocks.clear();
   size_t begin = 0;
   while(begin < m_used) {
-    uint32 bSize = std::min(blockSize, m_used - begin);
+    size_t bSize = std::min(blockSize, m_used - begin);
     m_bwtBlocks.push_back(BWTBlock(&m_data[begin], bSize, false));
     begin += bSize;
   }
@@ -85,6 +85,12 @@ class PrecompressorBlock {
   size_t m_originalSize;
   /**Memory reserved for block.*/
   size_t m_reserved;
+  /**Stream from which the data is mapped (see InStream::mapBlock), 0 if
+   * the data is allocated with malloc. */
+  InStream* m_mappedFrom;
+
+  PrecompressorBlock(const PrecompressorBlock&);
+  PrecompressorBlock& operator=(const PrecompressorBlock&);
 };
 
 } //namespace bwtc
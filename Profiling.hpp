@@ -6,6 +6,8 @@
 #include <iostream>
 #include <map>
 
+#include <boost/thread/mutex.hpp>
+
 class ProfileManager {
  public:
   struct ProfilingResult {
@@ -21,7 +23,7 @@ class ProfileManager {
   typedef std::map<const char*, ProfilingResult> Results;
 
   static ProfileManager* getInstance() {
-    static ProfileManager prof = ProfileManager();
+    static ProfileManager prof;
     return &prof;
   }
 
@@ -37,6 +39,7 @@ class ProfileManager {
   
  
   void profilingResult(const char* name, double time) {
+    boost::mutex::scoped_lock lock(m_mutex);
     ProfilingResult& p = m_results[name];
     p.calls++;
     p.time += time;
@@ -52,6 +55,7 @@ class ProfileManager {
   
  private:
   Results m_results;
+  boost::mutex m_mutex;
 };
 
 class AutoProfile {
@@ -0,0 +1,430 @@
+/**
+ * @file RansCoders.cpp
+ *
+ * @section LICENSE
+ *
+ * This file is part of bwtc.
+ *
+ * bwtc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bwtc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bwtc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Implementations of rANS encoder and decoder.
+ */
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm> // for sort, fill
+#include <iostream>
+#include <numeric> // for std::accumulate
+#include <vector>
+
+#include "RansCoders.hpp"
+#include "globaldefs.hpp"
+#include "Utils.hpp"
+#include "Profiling.hpp"
+
+namespace bwtc {
+
+/*********************************************************************
+ * rANS with 32-bit state and byte-wise renormalization. The state   *
+ * is kept in [kRansLow, 256*kRansLow) between the symbols.          *
+ * Frequencies of the symbols sum up to 2^kScaleBits.                *
+ *                                                                   *
+ * Encoder processes the symbols in reverse order and writes the     *
+ * bytes backwards, so that the decoder can read them forwards.      *
+ * Decoder reads in exactly the bytes written by the encoder for the *
+ * same symbol, so several states can share a single byte stream as  *
+ * long as they are used in the same order in both ends.             *
+ *********************************************************************/
+namespace {
+
+const uint32 kScaleBits = 12;
+const uint32 kScale = 1 << kScaleBits;
+const uint32 kRansLow = 1 << 23;
+/* Run lengths are coded by the position of their highest one-bit. */
+const uint32 kLengthAlphabet = 32;
+
+inline void ransPut(uint32& x, byte*& ptr, uint32 start, uint32 freq) {
+  assert(freq > 0);
+  uint32 max = ((kRansLow >> kScaleBits) << 8) * freq;
+  while (x >= max) {
+    *--ptr = static_cast<byte>(x & 0xff);
+    x >>= 8;
+  }
+  x = ((x / freq) << kScaleBits) + (x % freq) + start;
+}
+
+inline void ransFlush(uint32 x, byte*& ptr) {
+  ptr -= 4;
+  ptr[0] = static_cast<byte>(x >> 0);
+  ptr[1] = static_cast<byte>(x >> 8);
+  ptr[2] = static_cast<byte>(x >> 16);
+  ptr[3] = static_cast<byte>(x >> 24);
+}
+
+inline uint32 ransInit(const byte*& ptr) {
+  uint32 x = ptr[0] | (ptr[1] << 8) | (ptr[2] << 16)
+      | (static_cast<uint32>(ptr[3]) << 24);
+  ptr += 4;
+  return x;
+}
+
+/* Decodes a symbol from x using the slot -> symbol table. */
+inline byte ransGet(uint32& x, const byte*& ptr, const byte* symbolOf,
+                    const uint32* start, const uint32* freq) {
+  uint32 slot = x & (kScale - 1);
+  byte s = symbolOf[slot];
+  x = freq[s] * (x >> kScaleBits) + slot - start[s];
+  while (x < kRansLow) x = (x << 8) | *ptr++;
+  return s;
+}
+
+bool largerFrequency(const std::pair<uint32, uint32>& a,
+                     const std::pair<uint32, uint32>& b) {
+  return a.first > b.first;
+}
+
+/* Scales the frequencies to sum up to kScale, so that each occurring
+ * symbol keeps a nonzero frequency. */
+void normalizeFrequencies(const uint64* freqs, uint32 alphabet,
+                          uint32* normalized) {
+  uint64 total = std::accumulate(freqs, freqs + alphabet,
+                                 static_cast<uint64>(0));
+  std::fill(normalized, normalized + alphabet, 0);
+  if (total == 0) return;
+  uint32 sum = 0;
+  std::vector<std::pair<uint32, uint32> > order;
+  for (uint32 i = 0; i < alphabet; ++i) {
+    if (freqs[i] == 0) continue;
+    normalized[i] = std::max(static_cast<uint64>(1),
+                             freqs[i] * kScale / total);
+    sum += normalized[i];
+    order.push_back(std::make_pair(normalized[i], i));
+  }
+  std::sort(order.begin(), order.end(), largerFrequency);
+  if (sum < kScale) {
+    normalized[order[0].second] += kScale - sum;
+  } else {
+    /* Rounding ones up may overshoot, take the excess from the most
+     * frequent symbols. */
+    uint32 excess = sum - kScale;
+    for (size_t i = 0; excess > 0; ++i) {
+      assert(i < order.size());
+      uint32& f = normalized[order[i].second];
+      uint32 take = std::min(excess, f - 1);
+      f -= take;
+      excess -= take;
+    }
+  }
+}
+
+void cumulativeFrequencies(const uint32* freqs, uint32 alphabet,
+                           uint32* start) {
+  uint32 sum = 0;
+  for (uint32 i = 0; i < alphabet; ++i) {
+    start[i] = sum;
+    sum += freqs[i];
+  }
+  assert(sum == kScale);
+}
+
+void truncated() {
+  fprintf(stderr, "Compressed file ends in the middle of a block!\n");
+  exit(1);
+}
+
+void buildSymbolTable(const uint32* freqs, const uint32* start,
+                      uint32 alphabet, byte* symbolOf) {
+  for (uint32 i = 0; i < alphabet; ++i)
+    std::fill(symbolOf + start[i], symbolOf + start[i] + freqs[i],
+              static_cast<byte>(i));
+}
+
+} // namespace
+
+RansEncoder::RansEncoder()
+    : m_headerPosition(0), m_compressedBlockLength(0) {}
+
+RansEncoder::~RansEncoder() {}
+
+size_t RansEncoder::
+transformAndEncode(BWTBlock& block, BWTManager& bwtm, OutStream* out) {
+  std::vector<uint64> characterFrequencies(256, 0);
+  bwtm.doTransform(block, &characterFrequencies[0]);
+
+  writeBlockHeader(block, characterFrequencies, out);
+  encodeData(block.begin(), characterFrequencies, block.size(), out);
+  finishBlock(out);
+  return m_compressedBlockLength + 6;
+}
+
+/* The rANS stream takes at most four bytes per run and the remaining bits
+ * of the run lengths at most one bit per byte, they are allocated after the
+ * transform. */
+uint64 RansEncoder::
+maxSizeInBytes(uint64 block_size, const BWTManager& bwtm,
+               uint64 output) const {
+  uint64 bytes = 4*block_size + block_size/8 + 8 + output;
+  return heldSizeInBytes(block_size)
+      + std::max(bytes, bwtm.maxSizeInBytes(block_size));
+}
+
+/* Run buffer and the length classes take three bytes per run and four more
+ * for each run of at least 255 bytes. They are kept from block to block. */
+uint64 RansEncoder::heldSizeInBytes(uint64 block_size) const {
+  return 3*block_size + block_size/255*sizeof(uint32);
+}
+
+/* Frequencies are written as a bitmap of the occurring symbols followed by
+ * the frequencies (minus one) of the occurring symbols as packed integers. */
+void RansEncoder::
+writeFrequencies(const uint32* freqs, uint32 alphabet, OutStream* out) {
+  for (uint32 i = 0; i < alphabet; i += 8) {
+    byte b = 0;
+    for (uint32 j = 0; j < 8; ++j) {
+      b <<= 1;
+      if (i + j < alphabet && freqs[i + j] > 0) b |= 1;
+    }
+    out->writeByte(b);
+    ++m_compressedBlockLength;
+  }
+  for (uint32 i = 0; i < alphabet; ++i) {
+    if (freqs[i] == 0) continue;
+    int bytes;
+    writePackedInteger(utils::packInteger(freqs[i] - 1, &bytes), out);
+    m_compressedBlockLength += bytes;
+  }
+}
+
+void RansEncoder::writeBytes(const byte* begin, const byte* end,
+                             OutStream* out) {
+  int bytes;
+  writePackedInteger(utils::packInteger(end - begin, &bytes), out);
+  out->writeBlock(begin, end);
+  m_compressedBlockLength += bytes + (end - begin);
+}
+
+/*********************************************************************
+ * Each context block is encoded as:                                 *
+ * - number of runs (packed integer)                                 *
+ * - frequencies of the run symbols                                  *
+ * - frequencies of the run length classes                           *
+ * - length of the rANS stream (packed integer) and the stream       *
+ * - length of the remaining bits of run lengths (packed integer)    *
+ *   and the bits                                                    *
+ *********************************************************************/
+void RansEncoder::
+encodeData(const byte* block, const std::vector<uint64>& stats,
+           uint64 /*blockSize*/, OutStream* out) {
+  PROFILE("RansEncoder::encodeData");
+  size_t largest = *std::max_element(stats.begin(), stats.end());
+  m_runs.reserve(largest);
+  if (m_lengthClasses.size() < largest) m_lengthClasses.resize(largest);
+  std::vector<byte> ransBuffer, bits;
+
+  size_t beg = 0;
+  for (size_t i = 0; i < stats.size(); ++i) {
+    size_t current_cblock_size = stats[i];
+    if (current_cblock_size == 0) continue;
+
+    uint64 runFreqs[256];
+    std::fill(runFreqs, runFreqs + 256, 0);
+    uint64 nRuns = m_runs.store(block + beg, current_cblock_size, runFreqs);
+    const byte* runseq = m_runs.symbols();
+
+    /* Length classes are needed backwards for rANS, so they are stored. */
+    uint64 lengthFreqs[kLengthAlphabet];
+    std::fill(lengthFreqs, lengthFreqs + kLengthAlphabet, 0);
+    RunBuffer::LengthIterator lengths(m_runs, 0);
+    for (uint64 k = 0; k < nRuns; ++k) {
+      m_lengthClasses[k] = utils::logFloor(lengths.next());
+      ++lengthFreqs[m_lengthClasses[k]];
+    }
+
+    uint32 symFreq[256], symStart[256];
+    uint32 lenFreq[kLengthAlphabet], lenStart[kLengthAlphabet];
+    normalizeFrequencies(runFreqs, 256, symFreq);
+    normalizeFrequencies(lengthFreqs, kLengthAlphabet, lenFreq);
+    cumulativeFrequencies(symFreq, 256, symStart);
+    cumulativeFrequencies(lenFreq, kLengthAlphabet, lenStart);
+
+    int bytes;
+    writePackedInteger(utils::packInteger(nRuns, &bytes), out);
+    m_compressedBlockLength += bytes;
+    writeFrequencies(symFreq, 256, out);
+    writeFrequencies(lenFreq, kLengthAlphabet, out);
+
+    /* Each symbol takes at most two bytes of output. */
+    ransBuffer.resize(4*nRuns + 8);
+    byte* end = &ransBuffer[0] + ransBuffer.size();
+    byte* ptr = end;
+    uint32 symbolState = kRansLow, lengthState = kRansLow;
+    for (uint64 k = nRuns; k-- > 0;) {
+      byte lengthClass = m_lengthClasses[k];
+      ransPut(lengthState, ptr, lenStart[lengthClass], lenFreq[lengthClass]);
+      ransPut(symbolState, ptr, symStart[runseq[k]], symFreq[runseq[k]]);
+    }
+    ransFlush(lengthState, ptr);
+    ransFlush(symbolState, ptr);
+    writeBytes(ptr, end, out);
+
+    /* Bits of the run lengths below the highest one-bit. */
+    bits.clear();
+    uint64 buffer = 0;
+    int32 bitsInBuffer = 0;
+    lengths = RunBuffer::LengthIterator(m_runs, 0);
+    for (uint64 k = 0; k < nRuns; ++k) {
+      uint32 length = lengths.next();
+      int32 n = m_lengthClasses[k];
+      while (bitsInBuffer + n > 64) {
+        bitsInBuffer -= 8;
+        bits.push_back((buffer >> bitsInBuffer) & 0xff);
+      }
+      buffer <<= n;
+      buffer |= length ^ (static_cast<uint64>(1) << n);
+      bitsInBuffer += n;
+    }
+    while (bitsInBuffer >= 8) {
+      bitsInBuffer -= 8;
+      bits.push_back((buffer >> bitsInBuffer) & 0xff);
+    }
+    if (bitsInBuffer > 0) bits.push_back((buffer << (8 - bitsInBuffer)) & 0xff);
+    writeBytes(bits.empty() ? 0 : &bits[0],
+               bits.empty() ? 0 : &bits[0] + bits.size(), out);
+
+    beg += current_cblock_size;
+  }
+}
+
+void RansEncoder::finishBlock(OutStream* out) {
+  out->write48bits(m_compressedBlockLength, m_headerPosition);
+}
+
+void RansEncoder::
+writeBlockHeader(const BWTBlock& block, std::vector<uint64>& stats,
+                 OutStream* out) {
+  m_compressedBlockLength =
+      writeEncodedBlockHeader(block, stats, out, &m_headerPosition);
+}
+
+uint64 RansDecoder::
+readBlockHeader(BWTBlock& block, std::vector<uint64>* stats, InStream* in) {
+  return readEncodedBlockHeader(block, stats, in);
+}
+
+void RansDecoder::readFrequencies(uint32* freqs, uint32 alphabet,
+                                  InStream* in) {
+  std::fill(freqs, freqs + alphabet, 0);
+  std::vector<bool> present(alphabet);
+  for (uint32 i = 0; i < alphabet; i += 8) {
+    byte b = in->readByte();
+    for (uint32 j = 0; j < 8 && i + j < alphabet; ++j)
+      present[i + j] = (b >> (7 - j)) & 1;
+  }
+  uint64 sum = 0;
+  for (uint32 i = 0; i < alphabet; ++i) {
+    if (!present[i]) continue;
+    uint64 freq = utils::unpackInteger(readPackedInteger(in)) + 1;
+    if (freq > kScale) truncated();
+    freqs[i] = freq;
+    sum += freq;
+  }
+  /* The symbol tables have room for exactly kScale slots. */
+  if (sum != kScale) truncated();
+}
+
+void RansDecoder::readBytes(std::vector<byte>& to, InStream* in) {
+  uint64 length = utils::unpackInteger(readPackedInteger(in));
+  /* Padding for the bit reader, which may look past the end. */
+  to.resize(length + 8);
+  std::fill(to.begin() + length, to.end(), 0);
+  if (in->readBlock(&to[0], length) != length) truncated();
+}
+
+void RansDecoder::decodeBlock(BWTBlock& block, InStream* in) {
+  PROFILE("RansDecoder::decodeBlock");
+  if(in->compressedDataEnding()) return;
+
+  std::vector<uint64> context_lengths;
+  uint64 compr_len = readBlockHeader(block, &context_lengths, in);
+
+  if (verbosity > 2) {
+    std::clog << "Size of compressed block = " << compr_len << "\n";
+  }
+
+  uint64 block_size = std::accumulate(
+      context_lengths.begin(), context_lengths.end(), static_cast<uint64>(0));
+
+  byte* data_ptr = block.begin();
+  byte* const block_end = block.begin() + block_size;
+  std::vector<byte> ransBuffer, bits;
+  byte symbolOf[kScale], lengthClassOf[kScale];
+
+  for (size_t i = 0; i < context_lengths.size(); ++i) {
+    if (context_lengths[i] == 0) continue;
+
+    uint64 nRuns = utils::unpackInteger(readPackedInteger(in));
+    uint32 symFreq[256], symStart[256];
+    uint32 lenFreq[kLengthAlphabet], lenStart[kLengthAlphabet];
+    readFrequencies(symFreq, 256, in);
+    readFrequencies(lenFreq, kLengthAlphabet, in);
+    cumulativeFrequencies(symFreq, 256, symStart);
+    cumulativeFrequencies(lenFreq, kLengthAlphabet, lenStart);
+    buildSymbolTable(symFreq, symStart, 256, symbolOf);
+    buildSymbolTable(lenFreq, lenStart, kLengthAlphabet, lengthClassOf);
+
+    readBytes(ransBuffer, in);
+    readBytes(bits, in);
+    /* Both states are flushed as four bytes. */
+    if (ransBuffer.size() < 16) truncated();
+
+    /* A run takes at most two bytes from each state and four bytes of
+     * length bits, so the eight bytes of padding cover the reads of a run
+     * past the end of a corrupted stream. */
+    const byte* ptr = &ransBuffer[0];
+    const byte* ransEnd = ptr + ransBuffer.size() - 8;
+    uint32 symbolState = ransInit(ptr);
+    uint32 lengthState = ransInit(ptr);
+    const byte* bitPtr = &bits[0];
+    const byte* bitsEnd = bitPtr + bits.size() - 8;
+    uint64 buffer = 0;
+    int32 bitsInBuffer = 0;
+    for (uint64 k = 0; k < nRuns; ++k) {
+      byte c = ransGet(symbolState, ptr, symbolOf, symStart, symFreq);
+      int32 n = ransGet(lengthState, ptr, lengthClassOf, lenStart, lenFreq);
+      while (bitsInBuffer < n) {
+        buffer = (buffer << 8) | *bitPtr++;
+        bitsInBuffer += 8;
+      }
+      bitsInBuffer -= n;
+      uint64 length = (static_cast<uint64>(1) << n)
+          | ((buffer >> bitsInBuffer) & ((static_cast<uint64>(1) << n) - 1));
+      if (ptr > ransEnd || bitPtr > bitsEnd ||
+          length > static_cast<uint64>(block_end - data_ptr))
+        truncated();
+      std::fill(data_ptr, data_ptr + length, c);
+      data_ptr += length;
+    }
+  }
+  if (data_ptr != block_end) truncated();
+  block.setSize(block_size);
+}
+
+RansDecoder::RansDecoder() {}
+
+RansDecoder::~RansDecoder() {}
+
+} // namespace bwtc
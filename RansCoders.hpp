@@ -0,0 +1,97 @@
+/**
+ * @file RansCoders.hpp
+ *
+ * @section LICENSE
+ *
+ * This file is part of bwtc.
+ *
+ * bwtc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bwtc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bwtc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Header for entropy coder using interleaved rANS over the runs of the
+ * transformed block.
+ *
+ */
+
+#ifndef BWTC_RANS_CODERS_HPP_
+#define BWTC_RANS_CODERS_HPP_
+
+#include "EntropyCoders.hpp"
+#include "HuffmanCoders.hpp"
+#include "globaldefs.hpp"
+#include "Streams.hpp"
+#include "BWTBlock.hpp"
+
+#include <vector>
+
+namespace bwtc {
+
+/**Codes the runs of each context block with static symbol frequencies.
+ * Symbol of each run is coded with one rANS state and the position of the
+ * highest one-bit of the run length with another, the rest of the bits of
+ * the run length are stored as such. The two states are interleaved into a
+ * single byte stream, so decoding a run has two independent dependency
+ * chains.
+ */
+class RansEncoder : public EntropyEncoder {
+ public:
+  RansEncoder();
+  ~RansEncoder();
+
+  size_t transformAndEncode(BWTBlock& block, BWTManager& bwtm,
+                            OutStream* out);
+  uint64 maxSizeInBytes(uint64 block_size, const BWTManager& bwtm,
+                        uint64 output) const;
+  uint64 heldSizeInBytes(uint64 block_size) const;
+
+  void encodeData(const byte* data, const std::vector<uint64>& stats,
+                  uint64 blockSize, OutStream* out);
+  void writeBlockHeader(const BWTBlock& b, std::vector<uint64>& stats,
+                        OutStream* out);
+  void finishBlock(OutStream* out);
+
+ private:
+  long int m_headerPosition;
+  uint64 m_compressedBlockLength;
+  /* Runs of a context block and the classes of their lengths. They are kept
+   * from one block to the next and they only grow, see RunBuffer. */
+  RunBuffer m_runs;
+  std::vector<byte> m_lengthClasses;
+
+  void writeFrequencies(const uint32* freqs, uint32 alphabet, OutStream* out);
+  void writeBytes(const byte* begin, const byte* end, OutStream* out);
+  RansEncoder(const RansEncoder&);
+  RansEncoder& operator=(const RansEncoder&);
+};
+
+class RansDecoder : public EntropyDecoder {
+ public:
+  RansDecoder();
+  ~RansDecoder();
+
+  void decodeBlock(BWTBlock& block, InStream* in);
+  uint64 readBlockHeader(BWTBlock& block, std::vector<uint64>* stats,
+                         InStream* in);
+
+ private:
+  void readFrequencies(uint32* freqs, uint32 alphabet, InStream* in);
+  void readBytes(std::vector<byte>& to, InStream* in);
+  RansDecoder(const RansDecoder&);
+  RansDecoder& operator=(const RansDecoder&);
+};
+
+} // namespace bwtc
+
+#endif
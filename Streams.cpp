@@ -33,6 +33,13 @@
 #include <string>
 #include <algorithm>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
 #include "globaldefs.hpp"
 #include "Streams.hpp"
 
@@ -79,6 +86,14 @@ void RawOutStream::writeByte(byte b) {
   }
 }
 
+void RawOutStream::releaseWriteWindow(byte* pos) {
+  m_filled = pos - m_buffer;
+  if (m_filled == kBufferSize) {
+    fwrite(m_buffer, 1, m_filled, m_fileptr);
+    m_filled = 0;
+  }
+}
+
 void RawOutStream::flush() {
   if (m_filled > 0) {
     fwrite(m_buffer, 1, m_filled, m_fileptr);
@@ -108,7 +123,11 @@ void RawOutStream::write48bits(uint64 to_written, long int position) {
   flush();
   long int current = ftell(m_fileptr);
   // fseeking with negative offset from SEEK_CUR might be faster.
-  fseek(m_fileptr, position, SEEK_SET);
+  if (current < 0 || fseek(m_fileptr, position, SEEK_SET) != 0) {
+    fprintf(stderr, "%s: output is not seekable\n",
+            m_name.empty() ? "stdout" : m_name.c_str());
+    exit(1);
+  }
   for(int i = 5; i >= 0; --i) {
     byte b = 0xFF & (to_written >> i*8);
     fputc(b, m_fileptr);
@@ -116,6 +135,117 @@ void RawOutStream::write48bits(uint64 to_written, long int position) {
   fseek(m_fileptr, current, SEEK_SET);
 }
 
+AsyncOutStream::AsyncOutStream(const std::string& file_name, uint32 buffers)
+    : m_name(file_name), m_current(0), m_filled(0), m_position(0),
+      m_finished(false)
+{
+  assert(buffers >= 2);
+  if (m_name != "") {
+    m_fileptr = fopen(m_name.c_str(), "w");
+    if (!m_fileptr) {
+      perror(m_name.c_str());
+      exit(1);
+    }
+  } else {
+    m_fileptr = stdout;
+  }
+  m_position = std::max(ftell(m_fileptr), 0L);
+  for (uint32 i = 0; i < buffers; ++i) {
+    m_buffers.push_back(new byte[kBufferSize]);
+    m_free.push_back(m_buffers.back());
+  }
+  m_current = m_free.back();
+  m_free.pop_back();
+  m_writer = boost::thread(boost::bind(&AsyncOutStream::writerLoop, this));
+}
+
+AsyncOutStream::~AsyncOutStream() {
+  PROFILE("AsyncOutStream::~AsyncOutStream()");
+  flush();
+  {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_finished = true;
+  }
+  m_bufferQueued.notify_one();
+  m_writer.join();
+  if (m_fileptr != stdout) {
+    fclose(m_fileptr);
+  }
+  for (size_t i = 0; i < m_buffers.size(); ++i) delete [] m_buffers[i];
+}
+
+void AsyncOutStream::writerLoop() {
+  while (true) {
+    std::pair<byte*, uint32> buffer;
+    {
+      boost::unique_lock<boost::mutex> lock(m_mutex);
+      while (m_queue.empty() && !m_finished) m_bufferQueued.wait(lock);
+      if (m_queue.empty()) return;
+      buffer = m_queue.front();
+    }
+    if (fwrite(buffer.first, 1, buffer.second, m_fileptr) != buffer.second) {
+      perror(m_name.empty() ? "stdout" : m_name.c_str());
+      exit(1);
+    }
+    {
+      boost::lock_guard<boost::mutex> lock(m_mutex);
+      /* Buffer is removed from the queue only after it is written, so the
+       * queue is empty exactly when everything is in the file. */
+      m_queue.pop_front();
+      m_free.push_back(buffer.first);
+    }
+    m_bufferWritten.notify_one();
+  }
+}
+
+void AsyncOutStream::submit() {
+  boost::unique_lock<boost::mutex> lock(m_mutex);
+  m_queue.push_back(std::make_pair(m_current, m_filled));
+  m_bufferQueued.notify_one();
+  m_position += m_filled;
+  m_filled = 0;
+  while (m_free.empty()) m_bufferWritten.wait(lock);
+  m_current = m_free.back();
+  m_free.pop_back();
+}
+
+void AsyncOutStream::waitUntilWritten() {
+  boost::unique_lock<boost::mutex> lock(m_mutex);
+  while (!m_queue.empty()) m_bufferWritten.wait(lock);
+}
+
+void AsyncOutStream::writeBlock(const byte *begin, const byte *end) {
+  while (begin != end) {
+    size_t bytes = std::min(static_cast<size_t>(end - begin),
+                            static_cast<size_t>(kBufferSize - m_filled));
+    std::copy(begin, begin + bytes, m_current + m_filled);
+    m_filled += bytes;
+    begin += bytes;
+    if (m_filled == kBufferSize) submit();
+  }
+}
+
+void AsyncOutStream::flush() {
+  if (m_filled > 0) submit();
+  waitUntilWritten();
+  fflush(m_fileptr);
+}
+
+void AsyncOutStream::write48bits(uint64 to_written, long int position) {
+  assert((to_written & (((uint64)0xFFFF) << 48)) == 0);
+  flush();
+  if (fseek(m_fileptr, position, SEEK_SET) != 0) {
+    fprintf(stderr, "%s: output is not seekable\n",
+            m_name.empty() ? "stdout" : m_name.c_str());
+    exit(1);
+  }
+  for(int i = 5; i >= 0; --i) {
+    byte b = 0xFF & (to_written >> i*8);
+    fputc(b, m_fileptr);
+  }
+  fseek(m_fileptr, m_position, SEEK_SET);
+}
+
 uint64 RawInStream::read48bits() {
   uint64 result = 0;
   for(int i = 0; i < 6; ++i) {
@@ -154,9 +284,19 @@ RawInStream::~RawInStream() {
   delete[] m_bigbuf;
 }
 
+/* Bytes still in the buffer are copied first, the rest of a large block is
+ * read straight into its destination. */
 size_t RawInStream::readBlock(byte* to, size_t max_block_size) {
   assert(m_bitsInBuffer == 0);
-  uint64 have_read = 0;
+  size_t have_read = std::min(max_block_size,
+                              static_cast<size_t>(std::max(m_bigbuf_left, 0)));
+  std::copy(m_bigbuf + m_bigbuf_pos, m_bigbuf + m_bigbuf_pos + have_read, to);
+  m_bigbuf_pos += have_read;
+  m_bigbuf_left -= have_read;
+  if (max_block_size - have_read >= kBigbufSize) {
+    have_read += fread(to + have_read, 1, max_block_size - have_read,
+                       m_fileptr);
+  }
   int32 c;
   while (have_read < max_block_size && (c = fetchByte()) != EOF) {
     to[have_read++] = static_cast<byte>(c);
@@ -164,6 +304,17 @@ size_t RawInStream::readBlock(byte* to, size_t max_block_size) {
   return have_read;
 }
 
+/* Size of a regular file is known, otherwise the stream can't tell. */
+uint64 RawInStream::bytesLeft() {
+  struct stat st;
+  if (fstat(fileno(m_fileptr), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return InStream::bytesLeft();
+  }
+  off_t pos = ftello(m_fileptr);
+  if (pos < 0 || pos > st.st_size) return InStream::bytesLeft();
+  return st.st_size - pos + std::max(m_bigbuf_left, 0);
+}
+
 int32 RawInStream::fetchByte() {
   if (m_bigbuf_left <= 0) {
     m_bigbuf_pos = 0;
@@ -174,6 +325,17 @@ int32 RawInStream::fetchByte() {
   return m_bigbuf[m_bigbuf_pos++];
 }
 
+const byte* RawInStream::readWindow(const byte** end) {
+  assert(m_bitsInBuffer == 0);
+  if (m_bigbuf_left <= 0) {
+    m_bigbuf_pos = 0;
+    m_bigbuf_left = fread(m_bigbuf, 1, kBigbufSize, m_fileptr);
+    if (m_bigbuf_left < 0) m_bigbuf_left = 0;
+  }
+  *end = m_bigbuf + m_bigbuf_pos + m_bigbuf_left;
+  return m_bigbuf + m_bigbuf_pos;
+}
+
 int32 RawInStream::peekByte() {
   if (m_bigbuf_left <= 0) {
     m_bigbuf_pos = 0;
@@ -183,5 +345,101 @@ int32 RawInStream::peekByte() {
   return m_bigbuf[m_bigbuf_pos];
 }
 
-} //namespace bwtc
+MmapInStream::MmapInStream(const std::string &file_name) :
+    m_name(file_name), m_fd(-1), m_mapped(false), m_data(0), m_size(0),
+    m_pos(0), m_pageSize(sysconf(_SC_PAGESIZE)), m_buffer(0),
+    m_bitsInBuffer(0)
+{
+  m_fd = open(m_name.c_str(), O_RDONLY);
+  if (m_fd < 0) {
+    perror(m_name.c_str());
+    exit(1);
+  }
+  struct stat st;
+  if (fstat(m_fd, &st) != 0 || !S_ISREG(st.st_mode)) return;
+  m_size = st.st_size;
+  if (m_size == 0) {
+    m_mapped = true;
+    return;
+  }
+  void *data = mmap(0, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+  if (data == MAP_FAILED) {
+    m_size = 0;
+    return;
+  }
+  madvise(data, m_size, MADV_SEQUENTIAL);
+  m_data = static_cast<const byte*>(data);
+  m_mapped = true;
+}
 
+MmapInStream::~MmapInStream() {
+  if (m_data) munmap(const_cast<byte*>(m_data), m_size);
+  if (m_fd >= 0) close(m_fd);
+}
+
+size_t MmapInStream::readBlock(byte *to, size_t max_block_size) {
+  assert(m_bitsInBuffer == 0);
+  size_t bytes = std::min(max_block_size, m_size - m_pos);
+  std::copy(m_data + m_pos, m_data + m_pos + bytes, to);
+  m_pos += bytes;
+  return bytes;
+}
+
+uint64 MmapInStream::read48bits() {
+  uint64 result = 0;
+  for(int i = 0; i < 6; ++i) {
+    result <<= 8;
+    result |= fetchByte();
+  }
+  return result;
+}
+
+/* The block is mapped to the beginning of an anonymous mapping which is
+ * one byte longer than the block. This way the additional byte exists even
+ * if the block ends at the end of the file on a page boundary. */
+byte* MmapInStream::mapBlock(size_t max_block_size, size_t* block_size) {
+  assert(m_bitsInBuffer == 0);
+  *block_size = 0;
+  size_t bytes = std::min(max_block_size, m_size - m_pos);
+  if (bytes == 0) return 0;
+
+  size_t offset = m_pos % m_pageSize;
+  size_t length = offset + bytes + 1;
+  void *area = mmap(0, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (area == MAP_FAILED) return 0;
+  void *file = mmap(area, offset + bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED, m_fd, m_pos - offset);
+  if (file == MAP_FAILED) {
+    munmap(area, length);
+    return 0;
+  }
+  /* Whole block is going to be used, so the kernel may start reading it
+   * already (this overlaps the I/O with the encoding of the previous block
+   * when reading ahead, see Compressor). */
+  madvise(file, offset + bytes, MADV_SEQUENTIAL);
+  madvise(file, offset + bytes, MADV_WILLNEED);
+  m_pos += bytes;
+  *block_size = bytes;
+  return static_cast<byte*>(area) + offset;
+}
+
+void MmapInStream::unmapBlock(byte* begin, size_t block_size) {
+  size_t offset = reinterpret_cast<size_t>(begin) % m_pageSize;
+  munmap(begin - offset, offset + block_size + 1);
+}
+
+OutStream* giveOutStream(const std::string& file_name) {
+  return new AsyncOutStream(file_name);
+}
+
+InStream* giveInStream(const std::string& file_name) {
+  if (file_name != "") {
+    MmapInStream *in = new MmapInStream(file_name);
+    if (in->isMapped()) return in;
+    delete in;
+  }
+  return new RawInStream(file_name);
+}
+
+} //namespace bwtc
@@ -29,12 +29,20 @@
 #define BWTC_STREAMS_HPP_
 
 #include <cstdio>
+#include <algorithm>
 #include <cassert>
+#include <deque>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 #include "globaldefs.hpp"
 
 namespace bwtc {
@@ -47,6 +55,25 @@ class OutStream {
   virtual long int getPos() = 0;
   virtual void write48bits(uint64 to_written, long int position) = 0;
   virtual void flush() = 0;
+
+  /**Gives a direct access to the buffer of the stream for writing. Bytes
+   * written to the window are appended to the stream when the window is
+   * given back with releaseWriteWindow, which has to be done before any
+   * other call to the stream.
+   *
+   * @param end end of the window is stored here
+   * @return beginning of the window, equal to *end if the stream doesn't
+   *         support windows
+   */
+  virtual byte* writeWindow(byte** end) {
+    *end = 0;
+    return 0;
+  }
+  /**@param pos end of the written part of the window */
+  virtual void releaseWriteWindow(byte* /*pos*/) {}
+
+  /**Memory used by the buffers of the stream. */
+  virtual uint64 bufferSizeInBytes() const { return 0; }
 };
 
 class InStream {
@@ -58,6 +85,41 @@ class InStream {
   virtual void flushBuffer() = 0;
   virtual uint64 read48bits() = 0;
   virtual bool compressedDataEnding() = 0;
+
+  /**Gives an upper bound for the number of bytes left in the stream. The
+   * streams which can't tell it, such as pipes, give the largest value. */
+  virtual uint64 bytesLeft() { return std::numeric_limits<uint64>::max(); }
+
+  /**Gives a direct access to the next at most max_block_size bytes of the
+   * stream, if the stream supports it. The returned memory is private to
+   * the caller and writable, including one additional byte after the
+   * block. It has to be given back with unmapBlock.
+   *
+   * @param block_size number of bytes in the block is stored here
+   * @return beginning of the block or 0 if the stream doesn't support
+   *         mapping or there is no data left
+   */
+  virtual byte* mapBlock(size_t /*max_block_size*/, size_t* block_size) {
+    *block_size = 0;
+    return 0;
+  }
+  virtual void unmapBlock(byte* /*begin*/, size_t /*block_size*/) {}
+
+  /**Gives a direct access to the buffered bytes of the stream for reading.
+   * Bytes read from the window are consumed when the window is given back
+   * with releaseReadWindow, which has to be done before any other call to
+   * the stream. The stream has to be at byte boundary.
+   *
+   * @param end end of the window is stored here
+   * @return beginning of the window, equal to *end if there is no data
+   *         left or the stream doesn't support windows
+   */
+  virtual const byte* readWindow(const byte** end) {
+    *end = 0;
+    return 0;
+  }
+  /**@param pos end of the consumed part of the window */
+  virtual void releaseReadWindow(const byte* /*pos*/) {}
 };
 
 /**
@@ -95,6 +157,14 @@ class RawOutStream : public OutStream {
   virtual void write48bits(uint64 to_written, long int position);
   virtual void flush();
 
+  virtual byte* writeWindow(byte** end) {
+    *end = m_buffer + kBufferSize;
+    return m_buffer + m_filled;
+  }
+  virtual void releaseWriteWindow(byte* pos);
+
+  virtual uint64 bufferSizeInBytes() const { return kBufferSize; }
+
  private:
   static const uint32 kBufferSize = 1 << 16; // 64KB
 
@@ -107,6 +177,137 @@ class RawOutStream : public OutStream {
   RawOutStream(const RawOutStream& os);
 };
 
+/**
+ * AsyncOutStream writes data into file or std::cout in a background thread.
+ *
+ * The data is collected into large buffers. Full buffers are given to the
+ * writer thread and the writing continues into the next free buffer, so the
+ * blocking fwrite-calls overlap with the encoding. The caller has to wait
+ * only when all of the buffers are waiting to be written.
+ *
+ * write48bits needs to seek, so it waits until the buffered data is written.
+ *
+ * @see RawOutStream
+ */
+class AsyncOutStream : public OutStream {
+ public:
+  explicit AsyncOutStream(const std::string& file_name,
+                          uint32 buffers = kDefaultBuffers);
+  virtual ~AsyncOutStream();
+
+  virtual inline void writeByte(byte b) {
+    m_current[m_filled++] = b;
+    if (m_filled == kBufferSize) submit();
+  }
+
+  virtual void writeBlock(const byte *begin, const byte *end);
+
+  virtual long int getPos() { return m_position + m_filled; }
+  virtual void write48bits(uint64 to_written, long int position);
+  virtual void flush();
+
+  virtual byte* writeWindow(byte** end) {
+    *end = m_current + kBufferSize;
+    return m_current + m_filled;
+  }
+  virtual void releaseWriteWindow(byte* pos) {
+    m_filled = pos - m_current;
+    if (m_filled == kBufferSize) submit();
+  }
+
+  virtual uint64 bufferSizeInBytes() const {
+    return static_cast<uint64>(kBufferSize)*m_buffers.size();
+  }
+
+ private:
+  static const uint32 kBufferSize = 1 << 20; // 1MB
+  static const uint32 kDefaultBuffers = 4;
+
+  std::string m_name;
+  FILE *m_fileptr;
+  /* Buffer under filling. It is owned by the caller, others are either free
+   * or queued for the writer thread. */
+  byte *m_current;
+  uint32 m_filled;
+  /* Position of the beginning of m_current in the file. */
+  long int m_position;
+  std::vector<byte*> m_buffers;
+
+  boost::mutex m_mutex;
+  boost::condition_variable m_bufferQueued;
+  boost::condition_variable m_bufferWritten;
+  std::deque<std::pair<byte*, uint32> > m_queue;
+  std::vector<byte*> m_free;
+  bool m_finished;
+  boost::thread m_writer;
+
+  /* Gives the current buffer to the writer thread and takes a free one. */
+  void submit();
+  /* Waits until the writer thread has written all the queued buffers. */
+  void waitUntilWritten();
+  void writerLoop();
+
+  AsyncOutStream& operator=(const AsyncOutStream& os);
+  AsyncOutStream(const AsyncOutStream& os);
+};
+
+/**
+ * MemoryOutStream collects the written data into memory.
+ *
+ * It is used for staging single encoded BWT-block when the blocks are
+ * encoded concurrently: each block is encoded into its own stream and the
+ * contents of the streams are written into the actual output afterwards.
+ */
+class MemoryOutStream : public OutStream {
+ public:
+  MemoryOutStream() {}
+  virtual ~MemoryOutStream() {}
+
+  virtual void writeByte(byte b) { m_data.push_back(b); }
+
+  virtual void writeBlock(const byte *begin, const byte *end) {
+    m_data.insert(m_data.end(), begin, end);
+  }
+
+  virtual long int getPos() { return m_data.size(); }
+
+  virtual void write48bits(uint64 to_written, long int position) {
+    assert((to_written & (((uint64)0xFFFF) << 48)) == 0);
+    assert(position + 6 <= static_cast<long int>(m_data.size()));
+    for(int i = 5; i >= 0; --i) {
+      m_data[position++] = 0xFF & (to_written >> i*8);
+    }
+  }
+
+  virtual void flush() {}
+
+  /* Window is made by growing the vector, the unused part is cut off when
+   * the window is released. */
+  virtual byte* writeWindow(byte** end) {
+    size_t used = m_data.size();
+    m_data.resize(used + kWindowSize);
+    *end = &m_data[0] + m_data.size();
+    return &m_data[0] + used;
+  }
+  virtual void releaseWriteWindow(byte* pos) {
+    m_data.resize(pos - &m_data[0]);
+  }
+
+  const byte* begin() const { return m_data.empty() ? 0 : &m_data[0]; }
+  const byte* end() const { return begin() + m_data.size(); }
+  size_t size() const { return m_data.size(); }
+  /**Empties the stream and frees its memory. */
+  void clear() { std::vector<byte>().swap(m_data); }
+
+ private:
+  static const size_t kWindowSize = 1 << 12;
+
+  std::vector<byte> m_data;
+
+  MemoryOutStream& operator=(const MemoryOutStream& os);
+  MemoryOutStream(const MemoryOutStream& os);
+};
+
 
 class RawInStream : public InStream {
  public:
@@ -139,6 +340,13 @@ class RawInStream : public InStream {
   bool isStdin() const { return m_fileptr == stdin; }
 
   virtual uint64 read48bits();
+  virtual uint64 bytesLeft();
+
+  virtual const byte* readWindow(const byte** end);
+  virtual void releaseReadWindow(const byte* pos) {
+    m_bigbuf_left -= pos - (m_bigbuf + m_bigbuf_pos);
+    m_bigbuf_pos = pos - m_bigbuf;
+  }
 
   virtual bool compressedDataEnding() {
     /* Quick workaround. For some mysterious reason there is single
@@ -169,6 +377,178 @@ class RawInStream : public InStream {
   RawInStream(const RawInStream& os);
 };
 
+/**
+ * MmapInStream reads a regular file through memory mapping.
+ *
+ * Whole file is mapped for reading with MADV_SEQUENTIAL. The blocks given
+ * by mapBlock are separate private mappings of the file, so they can be
+ * modified in place (precompression, BWT) without copying them first, and
+ * the modifications never reach the file or the other blocks.
+ *
+ * @see giveInStream
+ */
+class MmapInStream : public InStream {
+ public:
+  explicit MmapInStream(const std::string &file_name);
+  virtual ~MmapInStream();
+
+  /**Tells whether the file could be mapped. */
+  bool isMapped() const { return m_mapped; }
+
+  virtual size_t readBlock(byte *to, size_t max_block_size);
+
+  virtual inline bool readBit() {
+    if (m_bitsInBuffer == 0) {
+      m_buffer = fetchByte();
+      m_bitsInBuffer = 8;
+    }
+    return (m_buffer >> --m_bitsInBuffer) & 1;
+  }
+
+  virtual inline byte readByte() {
+    assert(m_bitsInBuffer < 8);
+    m_buffer = (m_buffer << 8) | fetchByte();
+    return (m_buffer >> m_bitsInBuffer) & 0xff;
+  }
+
+  virtual inline void flushBuffer() {
+    m_bitsInBuffer = 0;
+  }
+
+  virtual uint64 read48bits();
+
+  virtual bool compressedDataEnding() { return m_pos >= m_size; }
+  virtual uint64 bytesLeft() { return m_size - m_pos; }
+
+  virtual byte* mapBlock(size_t max_block_size, size_t* block_size);
+  virtual void unmapBlock(byte* begin, size_t block_size);
+
+  virtual const byte* readWindow(const byte** end) {
+    assert(m_bitsInBuffer == 0);
+    *end = m_data + m_size;
+    return m_data + m_pos;
+  }
+  virtual void releaseReadWindow(const byte* pos) { m_pos = pos - m_data; }
+
+ private:
+  std::string m_name;
+  int m_fd;
+  bool m_mapped;
+  const byte *m_data;
+  size_t m_size;
+  size_t m_pos;
+  size_t m_pageSize;
+  uint16 m_buffer;
+  byte m_bitsInBuffer;
+
+  /* Reading past the end behaves like RawInStream at the end of file. */
+  byte fetchByte() { return (m_pos < m_size) ? m_data[m_pos++] : 0xff; }
+
+  MmapInStream& operator=(const MmapInStream& os);
+  MmapInStream(const MmapInStream& os);
+};
+
+/**Opens the file for writing. Empty name means standard output. */
+OutStream* giveOutStream(const std::string& file_name);
+
+/**Opens the file for reading. Regular files are memory mapped if possible,
+ * otherwise (and for standard input, given as empty name) RawInStream is
+ * used. */
+InStream* giveInStream(const std::string& file_name);
+
+/**
+ * MemoryInStream reads data from memory. Bit-level reads behave in the same
+ * way as in RawInStream.
+ *
+ * It is used for decoding BWT-blocks concurrently: the encoded blocks are
+ * read from the actual input into their own streams, which are then given
+ * to the decoders in separate threads.
+ */
+class MemoryInStream : public InStream {
+ public:
+  /**Takes the contents of the given vector, leaving it empty. */
+  explicit MemoryInStream(std::vector<byte>& data)
+      : m_pos(0), m_buffer(0), m_bitsInBuffer(0) {
+    m_data.swap(data);
+  }
+  /**Makes room for size bytes, which are filled through data(). */
+  explicit MemoryInStream(size_t size)
+      : m_data(size), m_pos(0), m_buffer(0), m_bitsInBuffer(0) {}
+  virtual ~MemoryInStream() {}
+
+  byte* data() { return m_data.empty() ? 0 : &m_data[0]; }
+
+  virtual size_t readBlock(byte *to, size_t max_block_size) {
+    assert(m_bitsInBuffer == 0);
+    size_t bytes = std::min(max_block_size, m_data.size() - m_pos);
+    std::copy(m_data.begin() + m_pos, m_data.begin() + m_pos + bytes, to);
+    m_pos += bytes;
+    return bytes;
+  }
+
+  virtual inline bool readBit() {
+    if (m_bitsInBuffer == 0) {
+      m_buffer = fetchByte();
+      m_bitsInBuffer = 8;
+    }
+    return (m_buffer >> --m_bitsInBuffer) & 1;
+  }
+
+  virtual inline byte readByte() {
+    assert(m_bitsInBuffer < 8);
+    m_buffer = (m_buffer << 8) | fetchByte();
+    return (m_buffer >> m_bitsInBuffer) & 0xff;
+  }
+
+  virtual inline void flushBuffer() {
+    m_bitsInBuffer = 0;
+  }
+
+  virtual uint64 read48bits() {
+    uint64 result = 0;
+    for(int i = 0; i < 6; ++i) {
+      result <<= 8;
+      result |= fetchByte();
+    }
+    return result;
+  }
+
+  virtual bool compressedDataEnding() { return m_pos >= m_data.size(); }
+  virtual uint64 bytesLeft() { return m_data.size() - m_pos; }
+
+  virtual const byte* readWindow(const byte** end) {
+    assert(m_bitsInBuffer == 0);
+    if (m_data.empty()) {
+      *end = 0;
+      return 0;
+    }
+    *end = &m_data[0] + m_data.size();
+    return &m_data[0] + m_pos;
+  }
+  virtual void releaseReadWindow(const byte* pos) { m_pos = pos - &m_data[0]; }
+
+  /**Starts reading again from the beginning of the data. */
+  void rewind() {
+    m_pos = 0;
+    m_buffer = 0;
+    m_bitsInBuffer = 0;
+  }
+
+ private:
+  std::vector<byte> m_data;
+  size_t m_pos;
+  uint16 m_buffer;
+  byte m_bitsInBuffer;
+
+  /* Reading past the end behaves like RawInStream at the end of file. */
+  byte fetchByte() {
+    return (m_pos < m_data.size()) ? m_data[m_pos++] : 0xff;
+  }
+
+  MemoryInStream& operator=(const MemoryInStream& os);
+  MemoryInStream(const MemoryInStream& os);
+};
+
 } //namespace bwtc
 
 
@@ -126,21 +126,23 @@ void calculateRunFrequencies(uint64 *runFreqs, const byte *src, size_t length)
 }
 
 size_t calculateRunsAndCharacters(uint64 *runFreqs, const byte *src,
-                                  size_t length, std::map<uint32, uint32>& runs)
+                                  size_t length, std::map<uint32, uint64> *runs,
+                                  uint32 maxRunLength)
 {
   size_t totalRuns = 0;
   const byte *prev = src;
   const byte *curr = src+1;
   do {
-    while(curr < src + length && *prev == *curr) ++curr;
+    while(curr < src + length && *prev == *curr &&
+          curr - prev < maxRunLength) ++curr;
     ++totalRuns;
     ++runFreqs[*prev];
-    ++runs[curr - prev];
+    ++runs[*prev][curr - prev];
     prev = curr++;
   } while(curr < src + length);
   if(prev < src + length) {
     ++runFreqs[*prev];
-    ++runs[1];
+    ++runs[*prev][1];
     ++totalRuns;
   }
   return totalRuns;
@@ -155,7 +157,8 @@ uint64 calculateRunFrequenciesAndStoreRuns(uint64 *runFreqs, byte *runseq,
   const byte *prev = src;
   const byte *curr = src+1;
   do {
-    while(curr < src + length && *prev == *curr) ++curr;
+    while(curr < src + length && *prev == *curr &&
+          curr - prev < kMaxRunLength) ++curr;
     ++runFreqs[*prev];
     *ptr++ = *prev;
     runlen[runs_cnt++] = curr - prev;
@@ -472,6 +475,18 @@ void calculateCodeLengths(std::vector<std::pair<uint64, uint32> >& codeLengths,
   if(allocate) delete [] freqs;
 }
 
+void packBits(const std::vector<bool>& bits, std::vector<byte>* to) {
+  for(size_t k = 0; k < bits.size();) {
+    byte b = 0; size_t j = 0;
+    for(; j < 8 && k < bits.size(); ++k, ++j) {
+      b <<= 1;
+      b |= bits[k] ? 1 : 0;
+    }
+    if (j < 8) b <<= (8 - j);
+    to->push_back(b);
+  }
+}
+
 void writePackedInteger(uint64 packed_integer, byte *to) {
   do {
     byte to_written = static_cast<byte>(packed_integer & 0xFF);
@@ -185,8 +185,19 @@ unsigned readAndUnpackInteger(byte *from, uint64 *to);
 
 void calculateRunFrequencies(uint64 *runFreqs, const byte *src, size_t length);
 
+/**Runs longer than this are stored as several runs, so that the lengths fit
+ * into 31 bits also in the blocks larger than kMaxSmallBlockSize. */
+const uint32 kMaxRunLength = 0x7fffffff;
+
+/**Counts the runs of each symbol into runFreqs and into runs[symbol] by the
+ * length of run, so runs has to have room for 256 maps. Runs are split at
+ * maxRunLength as in WaveletTree::pushRun.
+ *
+ * @return total number of runs
+ */
 size_t calculateRunsAndCharacters(uint64 *runFreqs, const byte *src,
-                                  size_t length, std::map<uint32, uint32>& runs);
+                                  size_t length, std::map<uint32, uint64> *runs,
+                                  uint32 maxRunLength = kMaxRunLength);
 
 uint64 calculateRunFrequenciesAndStoreRuns(uint64 *runFreqs, byte *runseq,
   uint32 *runlen,  const byte *src, size_t length);
@@ -408,6 +419,14 @@ inline void unaryCode(BitVector& to, size_t n) {
   to.push_back(true);
 }
 
+/**Packs the bits into bytes, most significant bit first. The last byte is
+ * padded with zeros.
+ *
+ * @param bits Bits to pack.
+ * @param to The bytes are appended here.
+ */
+void packBits(const std::vector<bool>& bits, std::vector<byte>* to);
+
 template <typename Input>
 inline size_t unaryDecode(Input& in) {
   size_t n = 1;
@@ -25,6 +25,7 @@
  */
 
 #include <cassert>
+#include <algorithm>
 
 #include <iterator>
 #include <iostream> // For std::streampos
@@ -36,13 +37,75 @@
 #include "globaldefs.hpp"
 #include "Utils.hpp"
 #include "probmodels/ProbabilityModel.hpp"
+#include "probmodels/Models.hpp"
 #include "WaveletTree.hpp"
 #include "Profiling.hpp"
 
 namespace bwtc {
 
-WaveletEncoder::WaveletEncoder(char prob_model)
-    : m_probModel(giveProbabilityModel(prob_model)),
+namespace {
+
+/* Codes the tree with the models of known types. The type of the model for
+ * internal nodes is resolved once per wavelet tree by visitProbabilityModel,
+ * so that the models can be inlined into the coding loops. */
+template <typename Encoder>
+class TreeEncoding {
+ public:
+  TreeEncoding(WaveletTree<PackedBitVector>& wavelet,
+               Encoder& enc, ProbabilityModel& pm,
+               ProbabilityModel& im, ProbabilityModel& gapm)
+      : m_wavelet(wavelet), m_enc(enc), m_pm(pm), m_im(im), m_gapm(gapm) {}
+
+  template <typename Model>
+  void visit() {
+    StaticModel<Model> pm(m_pm);
+    StaticModel<ModelForIntegerCodes> im(m_im);
+    StaticModel<ModelForGaps> gapm(m_gapm);
+    m_wavelet.encodeTreeBF(m_enc, pm, im, gapm);
+  }
+
+ private:
+  WaveletTree<PackedBitVector>& m_wavelet;
+  Encoder& m_enc;
+  ProbabilityModel& m_pm;
+  ProbabilityModel& m_im;
+  ProbabilityModel& m_gapm;
+};
+
+/* Counterpart of TreeEncoding. */
+template <typename Decoder>
+class TreeDecoding {
+ public:
+  TreeDecoding(WaveletTree<PackedBitVector>& wavelet, size_t rootSize,
+               Decoder& dec, ProbabilityModel& pm,
+               ProbabilityModel& im, ProbabilityModel& gapm)
+      : m_wavelet(wavelet), m_rootSize(rootSize), m_dec(dec), m_pm(pm),
+        m_im(im), m_gapm(gapm) {}
+
+  template <typename Model>
+  void visit() {
+    StaticModel<Model> pm(m_pm);
+    StaticModel<ModelForIntegerCodes> im(m_im);
+    StaticModel<ModelForGaps> gapm(m_gapm);
+    m_wavelet.decodeTreeBF(m_rootSize, m_dec, pm, im, gapm);
+  }
+
+ private:
+  WaveletTree<PackedBitVector>& m_wavelet;
+  size_t m_rootSize;
+  Decoder& m_dec;
+  ProbabilityModel& m_pm;
+  ProbabilityModel& m_im;
+  ProbabilityModel& m_gapm;
+};
+
+} // namespace
+
+WaveletEncoder::WaveletEncoder(char prob_model, bool interleaved,
+                               bool independentBlocks)
+    : m_interleaved(interleaved), m_independentBlocks(independentBlocks),
+      m_modelChoice(prob_model),
+      m_probModel(giveProbabilityModel(prob_model)),
       m_integerProbModel(giveModelForIntegerCodes()),
       m_gapProbModel(giveModelForGaps()),
       m_headerPosition(0), m_compressedBlockLength(0)
@@ -64,7 +127,8 @@ void WaveletEncoder::endContextBlock() {
   m_probModel->resetModel();
   m_integerProbModel->resetModel();
   m_gapProbModel->resetModel();
-  m_destination.finish();
+  if(m_interleaved) m_lanes.finish();
+  else m_destination.finish();
 }
 
 void WaveletDecoder::endContextBlock() {
@@ -72,20 +136,61 @@ void WaveletDecoder::endContextBlock() {
   m_probModel->resetModel();
   m_integerProbModel->resetModel();
   m_gapProbModel->resetModel();
+  if(!m_interleaved) m_source.finish();
+}
+
+/* Some of the models keep part of their state over resetModel() (f.ex. the
+ * current state of FSM8). With independent blocks each BWT-block is started
+ * with freshly created models so that the blocks can be encoded and decoded
+ * in different threads. Otherwise the state is carried over the blocks, as
+ * in the files written before kIndependentBlocks. */
+void WaveletEncoder::resetModels() {
+  delete m_probModel;
+  delete m_integerProbModel;
+  delete m_gapProbModel;
+  m_probModel = giveProbabilityModel(m_modelChoice);
+  m_integerProbModel = giveModelForIntegerCodes();
+  m_gapProbModel = giveModelForGaps();
+}
+
+void WaveletDecoder::resetModels() {
+  delete m_probModel;
+  delete m_integerProbModel;
+  delete m_gapProbModel;
+  m_probModel = giveProbabilityModel(m_modelChoice);
+  m_integerProbModel = giveModelForIntegerCodes();
+  m_gapProbModel = giveModelForGaps();
 }
 
 size_t WaveletEncoder::
 transformAndEncode(BWTBlock& block, BWTManager& bwtm, OutStream* out) {
-  std::vector<uint32> characterFrequencies(256, 0);
+  std::vector<uint64> characterFrequencies(256, 0);
   bwtm.doTransform(block, &characterFrequencies[0]);
 
+  if(m_independentBlocks) resetModels();
   m_destination.connect(out);
+  m_lanes.connect(out);
   writeBlockHeader(block, characterFrequencies, out);
   encodeData(block.begin(), characterFrequencies, out);
   finishBlock(out);
   return m_compressedBlockLength + 6; //Also bytes for the compressedSize
 }
 
+/* Wavelet tree of a context block is built after the transform. The trees
+ * are Huffman-shaped, so they take at most as many bits as a fixed 8-bit
+ * code for the run heads and Elias gamma codes for the run lengths, which
+ * is less than 9.5 bits per byte. The nodes and the padding of their bits
+ * to whole words fit into the rest of 1.5 bytes per byte. The interleaved
+ * coder holds the encoded context block also in its lanes until the lanes
+ * are written out. */
+uint64 WaveletEncoder::
+maxSizeInBytes(uint64 block_size, const BWTManager& bwtm,
+               uint64 output) const {
+  uint64 bytes = block_size + block_size/2 + output;
+  if(m_interleaved) bytes += maxEncodedSize(block_size);
+  return std::max(bytes, bwtm.maxSizeInBytes(block_size));
+}
+
 
 /******************************************************************************
  *            Encoding and decoding single MainBlock                          *
@@ -110,13 +215,13 @@ transformAndEncode(BWTBlock& block, BWTManager& bwtm, OutStream* out) {
 //At the moment we lose at worst case 7 bits when writing the shape of
 //wavelet tree
 void WaveletEncoder::
-encodeData(const byte* block, const std::vector<uint32>& stats, OutStream* out)
+encodeData(const byte* block, const std::vector<uint64>& stats, OutStream* out)
 {
   PROFILE("WaveletEncoder::encodeData");
   size_t beg = 0;
   for(size_t i = 0; i < stats.size(); ++i) {
     if(stats[i] == 0) continue;
-    WaveletTree<std::vector<bool> > wavelet(&block[beg], stats[i]);
+    WaveletTree<PackedBitVector> wavelet(&block[beg], stats[i]);
 
     int bytes;
     writePackedInteger(utils::packInteger(wavelet.bitsInRoot(), &bytes), out);
@@ -126,15 +231,11 @@ encodeData(const byte* block, const std::vector<uint32>& stats, OutStream* out)
     wavelet.treeShape(shape);
 
     // Write shape vector to output
-    for(size_t k = 0; k < shape.size();) {
-      byte b = 0; size_t j = 0;
-      for(; j < 8 && k < shape.size(); ++k, ++j) {
-        b <<= 1;
-        b |= (shape[k])?1:0;
-      }
-      if (j < 8) b <<= (8-j);
-      out->writeByte(b);
-      ++m_compressedBlockLength;
+    std::vector<byte> shapeBytes;
+    utils::packBits(shape, &shapeBytes);
+    if(!shapeBytes.empty()) {
+      out->writeBlock(&shapeBytes[0], &shapeBytes[0] + shapeBytes.size());
+      m_compressedBlockLength += shapeBytes.size();
     }
     if(verbosity > 3) {
       size_t shapeBytes = shape.size()/8;
@@ -143,8 +244,17 @@ encodeData(const byte* block, const std::vector<uint32>& stats, OutStream* out)
       std::clog << "Wavelet tree takes " << wavelet.totalBits()
                 << " bits in total\n";
     }
-    wavelet.encodeTreeBF(m_destination, *m_probModel, *m_integerProbModel,
-                         *m_gapProbModel);
+    if(m_interleaved) {
+      TreeEncoding<InterleavedEncoder> encoding(
+          wavelet, m_lanes, *m_probModel, *m_integerProbModel,
+          *m_gapProbModel);
+      visitProbabilityModel(m_modelChoice, encoding);
+    } else {
+      TreeEncoding<dcsbwt::BitEncoder> encoding(
+          wavelet, m_destination, *m_probModel, *m_integerProbModel,
+          *m_gapProbModel);
+      visitProbabilityModel(m_modelChoice, encoding);
+    }
 
 #ifdef ENTROPY_PROFILER    
     m_bytesForCharacters += wavelet.m_bytesForCharacters;
@@ -158,89 +268,24 @@ encodeData(const byte* block, const std::vector<uint32>& stats, OutStream* out)
 
 void WaveletEncoder::
 finishBlock(OutStream* out) {
-  m_compressedBlockLength += m_destination.counter();
+  m_compressedBlockLength += m_interleaved ? m_lanes.counter()
+                                           : m_destination.counter();
   out->write48bits(m_compressedBlockLength, m_headerPosition);
 }
 
-/*********************************************************************
- * The format of header for single main block is the following:      *
- * - 48 bits for the length of the compressed main block, doesn't    *
- *   include 6 bytes used for this                                   *
- * - byte representing the number of separately encoded sections.    *
- *   zero represents 256                                             *
- * - lengths of the sections which are encoded with same wavelet tree*
- *********************************************************************/
 void WaveletEncoder::
-writeBlockHeader(const BWTBlock& block, std::vector<uint32>& stats,
+writeBlockHeader(const BWTBlock& block, std::vector<uint64>& stats,
                  OutStream* out) {
-  uint64 headerLength = 0;
-  m_headerPosition = out->getPos();
-  for (unsigned i = 0; i < 6; ++i) out->writeByte(0x00); //fill 48 bits
-
-  headerLength += block.writeHeader(out);
-  
-  /* Deduce sections for separate encoding. At the moment uses not-so-well
-   * thought heuristic. */
-  std::vector<uint32> temp; std::vector<uint32>& s = stats;
-  size_t sum = 0;
-  for(size_t i = 0; i < s.size(); ++i) {
-    sum += s[i];
-    if(sum >= 10000) {
-      temp.push_back(sum);
-      sum = 0;
-    }
-  }
-  if (sum != 0) {
-    if(temp.size() > 0) temp.back() += sum;
-    else temp.push_back(sum);
-  }
-  s.resize(temp.size());
-  std::copy(temp.begin(), temp.end(), s.begin());
-  byte len;
-  if(temp.size() == 256) len = 0;
-  else len = temp.size();
-  out->writeByte(len);
-  headerLength += 1;
-
-  assert(s.size() == temp.size());
-  assert(temp.size() <= 256);
-
-  for (size_t i = 0; i < stats.size(); ++i) {
-    int bytes;
-    uint64 packed_cblock_size = utils::packInteger(stats[i], &bytes);
-    headerLength += bytes;
-    writePackedInteger(packed_cblock_size, out);
-  }
-  // TODO: Calculate Runs and their coding
-  
-  m_compressedBlockLength = headerLength;
-
+  m_compressedBlockLength =
+      writeEncodedBlockHeader(block, stats, out, &m_headerPosition);
   m_destination.resetCounter();
-}
-
-/* Integer is written in reversal fashion so that it can be read easier.*/
-void WaveletEncoder::
-writePackedInteger(uint64 packed_integer, OutStream* out) {
-  do {
-    byte to_written = static_cast<byte>(packed_integer & 0xFF);
-    packed_integer >>= 8;
-    out->writeByte(to_written);
-  } while (packed_integer);
+  m_lanes.resetCounter();
 }
 
 uint64
 WaveletDecoder::readBlockHeader(BWTBlock& block, std::vector<uint64>* stats,
                                 InStream* in) {
-  uint64 compressed_length = in->read48bits();
-  block.readHeader(in);
-  
-  byte sections = in->readByte();
-  size_t sects = (sections == 0) ? 256 : sections;
-  for(size_t i = 0; i < sects; ++i) {
-    uint64 value = readPackedInteger(in);
-    stats->push_back(utils::unpackInteger(value));
-  }
-  return compressed_length;
+  return readEncodedBlockHeader(block, stats, in);
 }
 
 void WaveletDecoder::decodeBlock(BWTBlock& block, InStream* in) {
@@ -254,26 +299,39 @@ void WaveletDecoder::decodeBlock(BWTBlock& block, InStream* in) {
     std::clog << "Size of compressed block = " << compr_len << "\n";
   }
 
+  if(m_independentBlocks) resetModels();
+
 #ifndef NDEBUG
   uint64 blockSize = std::accumulate(
       context_lengths.begin(), context_lengths.end(), static_cast<uint64>(0));
 #endif
 
   m_source.connect(in);
-  
+  m_lanes.connect(in);
+
   size_t len = 0;
   for(size_t i = 0; i < context_lengths.size(); ++i) {
     if(context_lengths[i] == 0) continue;
     size_t rootSize = utils::unpackInteger(readPackedInteger(in));
 
-    WaveletTree<std::vector<bool> > wavelet;
+    WaveletTree<PackedBitVector> wavelet;
 
     size_t bits = wavelet.readShape(*in);
 
     in->flushBuffer();
-    m_source.start();
-    wavelet.decodeTreeBF(rootSize, m_source, *m_probModel, *m_integerProbModel,
-                         *m_gapProbModel);
+    if(m_interleaved) {
+      m_lanes.start();
+      TreeDecoding<InterleavedDecoder> decoding(
+          wavelet, rootSize, m_lanes, *m_probModel, *m_integerProbModel,
+          *m_gapProbModel);
+      visitProbabilityModel(m_modelChoice, decoding);
+    } else {
+      m_source.start();
+      TreeDecoding<dcsbwt::BitDecoder> decoding(
+          wavelet, rootSize, m_source, *m_probModel, *m_integerProbModel,
+          *m_gapProbModel);
+      visitProbabilityModel(m_modelChoice, decoding);
+    }
     if(verbosity > 3) {
       size_t shapeBytes = bits/8;
       if(bits%8 > 0) ++shapeBytes;
@@ -290,29 +348,18 @@ void WaveletDecoder::decodeBlock(BWTBlock& block, InStream* in) {
   assert(len == blockSize);
 }
 
-uint64 WaveletDecoder::readPackedInteger(InStream* in) {
-  static const uint64 kEndSymbol = static_cast<uint64>(1) << 63;
-  static const uint64 kEndMask = static_cast<uint64>(1) << 7;
-
-  uint64 packed_integer = 0;
-  bool bits_left = true;
-  int i;
-  for(i = 0; bits_left; ++i) {
-    uint64 read = static_cast<uint64>(in->readByte());
-    bits_left = (read & kEndMask) != 0;
-    packed_integer |= (read << i*8);
-  }
-  if (packed_integer == 0x80) return kEndSymbol;
-  return packed_integer;
-}
 /*********** Encoding and decoding single MainBlock-section ends ********/
 
 WaveletDecoder::WaveletDecoder() :
+    m_interleaved(false), m_independentBlocks(false), m_modelChoice('B'),
     m_probModel(0), m_integerProbModel(giveModelForIntegerCodes()),
     m_gapProbModel(giveModelForGaps())
 {}
 
-WaveletDecoder::WaveletDecoder(char decoder) :
+WaveletDecoder::WaveletDecoder(char decoder, bool interleaved,
+                               bool independentBlocks) :
+    m_interleaved(interleaved), m_independentBlocks(independentBlocks),
+    m_modelChoice(decoder),
     m_probModel(giveProbabilityModel(decoder)),
     m_integerProbModel(giveModelForIntegerCodes()),
     m_gapProbModel(giveModelForGaps())
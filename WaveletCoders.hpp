@@ -40,25 +40,46 @@
 
 namespace bwtc {
 
+/**Number of lanes used by the interleaved range coder. */
+const unsigned kWaveletCoderLanes = 4;
+
 class WaveletEncoder : public EntropyEncoder {
  public:
-  WaveletEncoder(char probModel);
+  /**@param probModel Choice of the probability model, see
+   *                  giveProbabilityModel.
+   * @param interleaved If true, bits are coded with InterleavedBitEncoder
+   *                    instead of BitEncoder.
+   * @param independentBlocks If true, each BWT-block is started with fresh
+   *                          models, see kIndependentBlocks. */
+  WaveletEncoder(char probModel, bool interleaved = false,
+                 bool independentBlocks = false);
   ~WaveletEncoder();
 
-  void encodeData(const byte* data, const std::vector<uint32>& stats,
+  void encodeData(const byte* data, const std::vector<uint64>& stats,
                   OutStream* out);
-  void writeBlockHeader(const BWTBlock& b, std::vector<uint32>& stats,
+  void writeBlockHeader(const BWTBlock& b, std::vector<uint64>& stats,
                         OutStream* out);
   void finishBlock(OutStream* out);
 
   size_t transformAndEncode(BWTBlock& block, BWTManager& bwtm,
                             OutStream* out);
-  
-  void writePackedInteger(uint64 packed_integer, OutStream* out);
+  uint64 maxSizeInBytes(uint64 block_size, const BWTManager& bwtm,
+                        uint64 output) const;
+
   void endContextBlock();
 
  private:
+  typedef dcsbwt::InterleavedBitEncoder<kWaveletCoderLanes>
+  InterleavedEncoder;
+
   dcsbwt::BitEncoder m_destination;
+  InterleavedEncoder m_lanes;
+  /** Is m_lanes used instead of m_destination. */
+  bool m_interleaved;
+  /** Are the models created again for each BWT-block. */
+  bool m_independentBlocks;
+  /** Choice of the probability model for internal nodes. */
+  char m_modelChoice;
   /** Probability model for internal nodes in wavelet tree. */
   ProbabilityModel* m_probModel;
   /** Probability model for integer code nodes in wavelet tree. */
@@ -68,6 +89,8 @@ class WaveletEncoder : public EntropyEncoder {
   long int m_headerPosition;
   uint64 m_compressedBlockLength;
  
+  void resetModels();
+
   WaveletEncoder(const WaveletEncoder&);
   WaveletEncoder& operator=(const WaveletEncoder&);
 };
@@ -75,10 +98,9 @@ class WaveletEncoder : public EntropyEncoder {
 class WaveletDecoder : public EntropyDecoder {
  public:
   WaveletDecoder();
-  WaveletDecoder(char probModel);
+  WaveletDecoder(char probModel, bool interleaved = false,
+                 bool independentBlocks = false);
   ~WaveletDecoder();
-  /* If end symbol is encountered, then the most significant bit is activated */
-  uint64 readPackedInteger(InStream *in);
   /* Reads and decodes block from stream to block given as a parameter. */
   void decodeBlock(BWTBlock& block, InStream* in);
   /* Returns length of the compressed sequence and stores lengths of the context
@@ -87,7 +109,17 @@ class WaveletDecoder : public EntropyDecoder {
   void endContextBlock();
 
  private:
+  typedef dcsbwt::InterleavedBitDecoder<kWaveletCoderLanes>
+  InterleavedDecoder;
+
   dcsbwt::BitDecoder m_source;
+  InterleavedDecoder m_lanes;
+  /** Is m_lanes used instead of m_source. */
+  bool m_interleaved;
+  /** Are the models created again for each BWT-block. */
+  bool m_independentBlocks;
+  /** Choice of the probability model for internal nodes. */
+  char m_modelChoice;
   /** Probability model for internal nodes in wavelet tree. */
   ProbabilityModel* m_probModel;
   /** Probability model for integer code nodes in wavelet tree. */
@@ -95,6 +127,8 @@ class WaveletDecoder : public EntropyDecoder {
   /** Probability model for bits coming after gaps. */
   ProbabilityModel* m_gapProbModel;
 
+  void resetModels();
+
   WaveletDecoder(const WaveletDecoder&);
   WaveletDecoder& operator=(const WaveletDecoder&);
 };
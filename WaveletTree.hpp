@@ -33,6 +33,7 @@
 #define BWTC_WAVELET_TREE_HPP_
 
 #include "globaldefs.hpp"
+#include "PackedBitVector.hpp"
 #include "Utils.hpp"
 #include "Profiling.hpp"
 
@@ -50,6 +51,8 @@
 
 namespace bwtc {
 
+/**Node of a pointer-linked tree, as given by WaveletTree::createHuffmanShape.
+ * WaveletTree itself keeps its nodes in an array (see WaveletNode). */
 template <typename BitVector>
 struct TreeNode {
   TreeNode() : m_left(0), m_right(0), m_hasSymbol(false) {}
@@ -60,7 +63,6 @@ struct TreeNode {
   ~TreeNode() {}
 
   size_t rank(bool bit, size_t i) const;
-  size_t totalBits() const;
 
   BitVector m_bitVector;
   TreeNode<BitVector>* m_left;
@@ -84,13 +86,85 @@ size_t TreeNode<BitVector>::rank(bool bit, size_t i) const {
   return sum;
 }
 
+/**Reads the bits of a bitvector in order, as the tree coders do. The
+ * generic version reads them one by one with operator[]. */
 template <typename BitVector>
-size_t TreeNode<BitVector>::totalBits() const {
-  size_t bits = m_bitVector.size();
-  if(m_left) bits += m_left->totalBits();
-  if(m_right) bits += m_right->totalBits();
-  return bits;
-}
+class BitVectorReader {
+ public:
+  explicit BitVectorReader(const BitVector& bv) : m_bv(bv), m_pos(0) {}
+  bool next() { return m_bv[m_pos++]; }
+
+ private:
+  const BitVector& m_bv;
+  size_t m_pos;
+};
+
+/**PackedBitVector is read a word at a time. */
+template <>
+class BitVectorReader<PackedBitVector> {
+ public:
+  explicit BitVectorReader(const PackedBitVector& bv)
+      : m_bv(bv), m_next(0), m_word(0), m_bits(0) {}
+  bool next() {
+    if(m_bits == 0) {
+      m_word = m_bv.word(m_next++);
+      m_bits = 64;
+    }
+    bool bit = m_word & 1;
+    m_word >>= 1;
+    --m_bits;
+    return bit;
+  }
+
+ private:
+  const PackedBitVector& m_bv;
+  size_t m_next;
+  uint64 m_word;
+  unsigned m_bits;
+};
+
+/**Node of WaveletTree. The nodes of a tree are kept in one array in level
+ * order and the children are given as indices to it. The root is at index 0
+ * and it is never a child, so 0 also stands for a missing child. The bits of
+ * the node are the m_size first bits of the words starting from m_offset in
+ * the bit arena of the tree.
+ */
+struct WaveletNode {
+  WaveletNode() : m_offset(0), m_size(0), m_left(0), m_right(0), m_symbol(0),
+                  m_hasSymbol(false) {}
+  explicit WaveletNode(uint32 symbol)
+      : m_offset(0), m_size(0), m_left(0), m_right(0), m_symbol(symbol),
+        m_hasSymbol(true) {}
+
+  uint64 m_offset;
+  uint64 m_size;
+  uint32 m_left;
+  uint32 m_right;
+  uint32 m_symbol;
+  bool m_hasSymbol;
+};
+
+/**Reads the bits of a node from the bit arena in order, a word at a time. */
+class ArenaReader {
+ public:
+  explicit ArenaReader(const uint64 *words)
+      : m_next(words), m_word(0), m_bits(0) {}
+  bool next() {
+    if(m_bits == 0) {
+      m_word = *m_next++;
+      m_bits = 64;
+    }
+    bool bit = m_word & 1;
+    m_word >>= 1;
+    --m_bits;
+    return bit;
+  }
+
+ private:
+  const uint64 *m_next;
+  uint64 m_word;
+  unsigned m_bits;
+};
 
 /**This wavelet tree is used for storing the sequence
  * (<a1, n1>, <a2, n2>, ...) where a's are alphabets of the source alphabet
@@ -110,7 +184,15 @@ size_t TreeNode<BitVector>::totalBits() const {
  * runs). In this implementation the wavelet tree has always at least two
  * nodes (root and a leaf).
  *
- * Template parameter BitVector has to implement the following member-functions:
+ * The nodes are kept in one array in level order, followed by the integer
+ * code tree, and the bits of all of the nodes in one arena of words. The
+ * encoder knows the number of runs of each symbol and length before pushing
+ * anything, so it creates every node and counts its bits first and allocates
+ * the arena once. The decoder allocates the bits of a node when it comes to
+ * decode them.
+ *
+ * BitVector is used for the codes and for the helper vectors of the coders.
+ * It has to implement the following member-functions:
  *   BitVector();
  *   BitVector& operator=(const BitVector&);
  *   void push_back(bool);
@@ -118,14 +200,16 @@ size_t TreeNode<BitVector>::totalBits() const {
  *   void reserve(size_t size);
  *   size_t size();
  *   bool operator[](size_t index);
+ * PackedBitVector is the preferred choice, std::vector<bool> works also.
  */
 template <typename BitVector>
 class WaveletTree {
  public:
   WaveletTree();
-  WaveletTree(const byte *src, size_t length);
+  /**@param maxRunLength Longer runs are pushed as several runs. */
+  WaveletTree(const byte *src, size_t length,
+              uint32 maxRunLength = utils::kMaxRunLength);
   ~WaveletTree();
-  void pushRun(byte symbol, size_t runLength);
 
   /**Writes encoding of the shape of tree into given vector. The shape of
    * the tree is in form presented in "Housekeeping for Prefix Codes" by
@@ -133,15 +217,12 @@ class WaveletTree {
   template <typename Output>
   void treeShape(Output& vector) const;
 
-  size_t bitsInRoot() const { return m_root->m_bitVector.size(); }
-  size_t totalBits() const { return m_root->totalBits(); }
+  size_t bitsInRoot() const { return m_nodes[kRoot].m_size; }
+  size_t totalBits() const;
 
   template <typename OutputIterator>
   size_t message(OutputIterator out) const;
 
-  /** Push the runs of the string into tree */
-  void pushMessage(const byte* src, size_t length);
-
   /**Reads the shape of wavelet tree from some source and constructs
    * the correct shape.
    *
@@ -223,24 +304,79 @@ class WaveletTree {
 #endif
   
  private:
-  TreeNode<BitVector>* m_root;
+  static const uint32 kRoot = 0;
+
+  /* Nodes of the tree in level order, followed by the nodes of the integer
+   * code tree. The decoder appends the nodes of the run lengths as it
+   * creates them. */
+  std::vector<WaveletNode> m_nodes;
+  /* Bits of all of the nodes, see WaveletNode. */
+  std::vector<uint64> m_bits;
   BitVector m_codes[256];
 
   // Parameter of fixed integer codes. Supported values are: 0 -- 15
   uint32 m_W;
+  uint32 m_maxRunLength;
 
 #ifdef OPTIMIZED_INTEGER_CODE
   std::map<uint32, BitVector> m_integerCodes;
   // used for tracking the code in decoder
-  TreeNode<BitVector>* m_integerCodeTree;
+  uint32 m_integerCodeTree;
 #endif
 
-  TreeNode<BitVector> *pushBits(const BitVector& bits);
-  static void pushBits(TreeNode<BitVector> *node, const BitVector& bits);
-  static void pushBits(TreeNode<BitVector> *node, const BitVector& bits,
-                       uint32 symbol);
+  uint32 createNode();
+  uint32 createNode(uint32 symbol);
+  uint32 child(uint32 node, bool bit, bool create);
+
+  /**Gives the node room for the given number of bits from the end of the
+   * arena. */
+  void allocateBits(uint32 node, uint64 bits);
+
+  const uint64 *bitsOf(const WaveletNode& node) const {
+    return &m_bits[0] + node.m_offset;
+  }
+
+  bool bitAt(const WaveletNode& node, uint64 i) const {
+    return (m_bits[node.m_offset + i/64] >> (i%64)) & 1;
+  }
+
+  void pushBit(uint32 node, bool bit) {
+    WaveletNode& n = m_nodes[node];
+    m_bits[n.m_offset + n.m_size/64] |=
+        static_cast<uint64>(bit) << (n.m_size%64);
+    ++n.m_size;
+  }
 
-  static void destroy(TreeNode<BitVector>* node);
+  /**Counts the bits which the runs of the symbols will push into the nodes
+   * and creates the nodes of their integer codes. Then the nodes are put into
+   * level order and the arena is allocated, so that pushMessage only needs
+   * to set the bits.
+   *
+   * @param runs Numbers of runs of each symbol by the length of run.
+   */
+  void countBits(const std::map<uint32, uint64> *runs);
+
+  uint32 countBits(uint32 node, const BitVector& bits, uint64 count,
+                   bool create);
+
+  /**Renumbers the nodes so that the tree is in level order and the integer
+   * code tree follows it. */
+  void levelOrder();
+  void appendLevelOrder(uint32 root, std::vector<uint32>& order) const;
+
+  /** Push the runs of the string into tree */
+  void pushMessage(const byte* src, size_t length);
+
+  /**Runs longer than m_maxRunLength are pushed as several runs. */
+  void pushRun(byte symbol, size_t runLength);
+
+  uint32 pushBits(uint32 node, const BitVector& bits);
+
+  template <typename BVectors>
+  void collectCodes(BVectors& codes, uint32 node) const;
+
+  template <typename BVectors>
+  void collectCodes(BVectors& codes, BitVector& vec, uint32 node) const;
 
   /**Recursive function which is used in assigning codes and constructing the
    * tree based on the lengths of codes.
@@ -251,9 +387,9 @@ class WaveletTree {
    * @param bits How many bits are appended into the current element.
    * @return Next element (index) to handle.
    */
-  static size_t assignPrefixCodes(
+  size_t assignPrefixCodes(
       std::vector<std::pair<uint64, uint32> >& lengths,
-      TreeNode<BitVector>* node, size_t elem, size_t bits);
+      uint32 node, size_t elem, size_t bits);
 
   /**Finds good parameters for semi-fixed coding.
    *
@@ -281,31 +417,33 @@ WaveletTree<BitVector>::WaveletTree() :
 #ifdef ENTROPY_PROFILER
     m_bytesForCharacters(0), m_bytesForRuns(0),
 #endif
-    m_W(0)
+    m_W(0), m_maxRunLength(utils::kMaxRunLength)
 {
 #ifdef OPTIMIZED_INTEGER_CODE
   m_integerCodeTree = 0;
 #endif
-  m_root = new TreeNode<BitVector>();
+  createNode();
 }
 
 #ifdef OPTIMIZED_INTEGER_CODE
 
 template <typename BitVector>
-WaveletTree<BitVector>::WaveletTree(const byte *src, size_t length) :
+WaveletTree<BitVector>::WaveletTree(const byte *src, size_t length,
+                                    uint32 maxRunLength) :
 #ifdef ENTROPY_PROFILER
     m_bytesForCharacters(0), m_bytesForRuns(0),
 #endif
-    m_W(0)
+    m_W(0), m_maxRunLength(maxRunLength)
 {
   PROFILE("WaveletTree::WaveletTree");
+  createNode();
   uint64 runFreqs[256] = {0};
 
-  // Frequencies of run lengths are collected into map. They are indexed
-  // by the length of run.
-  std::map<uint32, uint32> runDistribution;
+  // Frequencies of run lengths of each symbol are collected into maps. They
+  // are indexed by the length of run.
+  std::vector<std::map<uint32, uint64> > runs(256);
   size_t totalRuns = utils::calculateRunsAndCharacters(
-      runFreqs, src, length, runDistribution);
+      runFreqs, src, length, &runs[0], m_maxRunLength);
 
   // Calculate codes for the byte-alphabet (top part of Wavelet-tree)
   std::vector<std::pair<uint64, uint32> > codeLengths;
@@ -314,11 +452,17 @@ WaveletTree<BitVector>::WaveletTree(const byte *src, size_t length) :
   assignPrefixCodes(codeLengths);
 
   {
+    std::map<uint32, uint64> runDistribution;
+    for(size_t i = 0; i < 256; ++i) {
+      for(std::map<uint32, uint64>::const_iterator it = runs[i].begin();
+          it != runs[i].end(); ++it)
+        runDistribution[it->first] += it->second;
+    }
     assert(runDistribution.size() > 0);
     std::vector<std::pair<uint64, uint32> > integerCodeLengths;
     std::vector<uint64> freqs;
     std::vector<uint32> integers;
-    for(std::map<uint32, uint32>::const_iterator it = runDistribution.begin();
+    for(std::map<uint32, uint64>::const_iterator it = runDistribution.begin();
         it != runDistribution.end(); ++it) {
 #ifdef SEMI_FIXED_CODE
       integerCodeLengths.push_back(std::make_pair(it->second, it->first));
@@ -331,13 +475,13 @@ WaveletTree<BitVector>::WaveletTree(const byte *src, size_t length) :
 #ifdef SEMI_FIXED_CODE
     m_W = findParametersForSemiFixedCodes(integerCodeLengths, totalRuns);
 
-    m_integerCodeTree = new TreeNode<BitVector>();
+    m_integerCodeTree = createNode();
     if(integerCodeLengths.size() > 0) {
       assignPrefixCodes(integerCodeLengths, m_integerCodeTree, 0, 0);
       collectCodes(m_integerCodes, m_integerCodeTree);
     } else {
-      m_integerCodeTree->m_symbol = 0;
-      m_integerCodeTree->m_hasSymbol = true;
+      m_nodes[m_integerCodeTree].m_symbol = 0;
+      m_nodes[m_integerCodeTree].m_hasSymbol = true;
       m_integerCodes[0].reserve(0); //Force the vector to be initialized
     }
 #else
@@ -348,13 +492,14 @@ WaveletTree<BitVector>::WaveletTree(const byte *src, size_t length) :
     /* Hu-Tucker-codes for integers
     utils::calculateHuTuckerLengths(integerCodeLengths, &freqs[0], integers);
     */
-    m_integerCodeTree = new TreeNode<BitVector>();
+    m_integerCodeTree = createNode();
     assignPrefixCodes(integerCodeLengths, m_integerCodeTree, 0, 0);
     collectCodes(m_integerCodes, m_integerCodeTree);
 #endif
   }
   
-  collectCodes(m_codes, m_root);
+  collectCodes(m_codes, kRoot);
+  countBits(&runs[0]);
 
   pushMessage(src, length);
 }
@@ -362,15 +507,20 @@ WaveletTree<BitVector>::WaveletTree(const byte *src, size_t length) :
 #else //ifndef OPTIMIZED_INTEGER_CODE
 
 template <typename BitVector>
-WaveletTree<BitVector>::WaveletTree(const byte *src, size_t length)
+WaveletTree<BitVector>::WaveletTree(const byte *src, size_t length,
+                                    uint32 maxRunLength) :
 #ifdef ENTROPY_PROFILER
-    : m_bytesForCharacters(0), m_bytesForRuns(0)
+    m_bytesForCharacters(0), m_bytesForRuns(0),
 #endif
+    m_maxRunLength(maxRunLength)
 {
   PROFILE("WaveletTree::WaveletTree");
+  createNode();
   uint64 runFreqs[256] = {0};
 
-  utils::calculateRunFrequencies(runFreqs, src, length);
+  std::vector<std::map<uint32, uint64> > runs(256);
+  utils::calculateRunsAndCharacters(runFreqs, src, length, &runs[0],
+                                    m_maxRunLength);
 
   // Calculate codes for the byte-alphabet (top part of Wavelet-tree)
   std::vector<std::pair<uint64, uint32> > codeLengths;
@@ -378,30 +528,171 @@ WaveletTree<BitVector>::WaveletTree(const byte *src, size_t length)
 
   assignPrefixCodes(codeLengths);
   
-  collectCodes(m_codes, m_root);
+  collectCodes(m_codes, kRoot);
+  countBits(&runs[0]);
 
   pushMessage(src, length);
 }
 #endif
 
 template <typename BitVector>
-WaveletTree<BitVector>::~WaveletTree() {
-  destroy(m_root);
-#ifdef OPTIMIZED_INTEGER_CODE
-  destroy(m_integerCodeTree);
-#endif  
+WaveletTree<BitVector>::~WaveletTree() {}
+
+template <typename BitVector>
+uint32 WaveletTree<BitVector>::createNode() {
+  m_nodes.push_back(WaveletNode());
+  return m_nodes.size() - 1;
+}
+
+/**Gives a leaf node representing the symbol. */
+template <typename BitVector>
+uint32 WaveletTree<BitVector>::createNode(uint32 symbol) {
+  m_nodes.push_back(WaveletNode(symbol));
+  return m_nodes.size() - 1;
+}
+
+/**Gives the child of node on the side of bit, or 0 if there is none and
+ * create is false. References to the nodes are not valid after this. */
+template <typename BitVector>
+uint32 WaveletTree<BitVector>::child(uint32 node, bool bit, bool create) {
+  uint32 next = bit ? m_nodes[node].m_right : m_nodes[node].m_left;
+  if(next == 0 && create) {
+    next = createNode();
+    if(bit) m_nodes[node].m_right = next;
+    else m_nodes[node].m_left = next;
+  }
+  return next;
+}
+
+template <typename BitVector>
+void WaveletTree<BitVector>::allocateBits(uint32 node, uint64 bits) {
+  m_nodes[node].m_offset = m_bits.size();
+  m_bits.resize(m_bits.size() + (bits + 63)/64, 0);
+}
+
+template <typename BitVector>
+size_t WaveletTree<BitVector>::totalBits() const {
+  size_t bits = 0;
+  for(size_t i = 0; i < m_nodes.size(); ++i) bits += m_nodes[i].m_size;
+  return bits;
+}
+
+template <typename BitVector>
+void WaveletTree<BitVector>::countBits(const std::map<uint32, uint64> *runs)
+{
+  for(size_t s = 0; s < 256; ++s) {
+    if(runs[s].empty()) continue;
+    uint64 symbolRuns = 0;
+    for(std::map<uint32, uint64>::const_iterator it = runs[s].begin();
+        it != runs[s].end(); ++it)
+      symbolRuns += it->second;
+    uint32 node = countBits(kRoot, m_codes[s], symbolRuns, false);
+    node = child(node, m_codes[s].back(), false);
+    assert(m_nodes[node].m_hasSymbol);
+
+    for(std::map<uint32, uint64>::const_iterator it = runs[s].begin();
+        it != runs[s].end(); ++it) {
+#ifndef OPTIMIZED_INTEGER_CODE
+      BitVector integerCode;
+      gammaCode(integerCode, it->first);
+      countBits(node, integerCode, it->second, true);
+#else
+#ifdef SEMI_FIXED_CODE
+      BitVector integerCode;
+      if(m_integerCodes.find(it->first) == m_integerCodes.end()) {
+        integerCode = m_integerCodes[0];
+        fixedIntegerCode(integerCode, it->first, m_W);
+      } else {
+        integerCode = m_integerCodes[it->first];
+      }
+#else
+      const BitVector& integerCode = m_integerCodes[it->first];
+#endif
+      // The leaf after the code tells the length of run
+      uint32 last = countBits(node, integerCode, it->second, true);
+      if(!child(last, integerCode.back(), false)) {
+        uint32 leaf = createNode(it->first);
+        if(integerCode.back()) m_nodes[last].m_right = leaf;
+        else m_nodes[last].m_left = leaf;
+      }
+#endif
+    }
+  }
+
+  levelOrder();
+  uint64 words = 0;
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+    words += (m_nodes[i].m_size + 63)/64;
+  m_bits.reserve(words);
+  for(size_t i = 0; i < m_nodes.size(); ++i) {
+    allocateBits(i, m_nodes[i].m_size);
+    m_nodes[i].m_size = 0;
+  }
 }
 
+/**Adds count bits to each node on the path of bits starting from node. The
+ * child after the last bit is not visited.
+ *
+ * @param create Whether to create the missing nodes on the path.
+ * @return Node which gets the last bit.
+ */
 template <typename BitVector>
-void WaveletTree<BitVector>::destroy(TreeNode<BitVector>* node) {
-  if(node->m_left) destroy(node->m_left);
-  if(node->m_right) destroy(node->m_right);
-  delete node;
+uint32 WaveletTree<BitVector>::countBits(uint32 node, const BitVector& bits,
+                                         uint64 count, bool create)
+{
+  assert(bits.size() > 0);
+  for(size_t i = 0; i < bits.size() - 1; ++i) {
+    m_nodes[node].m_size += count;
+    node = child(node, bits[i], create);
+    assert(node);
+  }
+  m_nodes[node].m_size += count;
+  return node;
+}
+
+template <typename BitVector>
+void WaveletTree<BitVector>::appendLevelOrder(
+    uint32 root, std::vector<uint32>& order) const
+{
+  order.push_back(root);
+  for(size_t i = order.size() - 1; i < order.size(); ++i) {
+    const WaveletNode& node = m_nodes[order[i]];
+    if(node.m_left) order.push_back(node.m_left);
+    if(node.m_right) order.push_back(node.m_right);
+  }
+}
+
+template <typename BitVector>
+void WaveletTree<BitVector>::levelOrder() {
+  std::vector<uint32> order;
+  order.reserve(m_nodes.size());
+  appendLevelOrder(kRoot, order);
+#ifdef OPTIMIZED_INTEGER_CODE
+  // The integer code tree is not reachable from the root
+  if(m_integerCodeTree != kRoot) appendLevelOrder(m_integerCodeTree, order);
+#endif
+
+  // Missing children stay 0, as the root keeps its index
+  std::vector<uint32> index(m_nodes.size(), 0);
+  for(size_t i = 0; i < order.size(); ++i) index[order[i]] = i;
+
+  std::vector<WaveletNode> nodes;
+  nodes.reserve(order.size());
+  for(size_t i = 0; i < order.size(); ++i) {
+    WaveletNode node = m_nodes[order[i]];
+    node.m_left = index[node.m_left];
+    node.m_right = index[node.m_right];
+    nodes.push_back(node);
+  }
+  m_nodes.swap(nodes);
+#ifdef OPTIMIZED_INTEGER_CODE
+  m_integerCodeTree = index[m_integerCodeTree];
+#endif
 }
 
 template <typename BitVector> template <typename Input>
 size_t WaveletTree<BitVector>::readShape(Input& input) {
-  assert(m_root->m_left == 0 && m_root->m_right == 0);
+  assert(m_nodes.size() == 1);
   size_t maxSym = input.readByte();
   size_t symbols = input.readByte();
   if(symbols == 0) symbols = 256;
@@ -423,7 +714,7 @@ size_t WaveletTree<BitVector>::readShape(Input& input) {
   }
 
   assignPrefixCodes(codeLengths);
-  collectCodes(m_codes, m_root);
+  collectCodes(m_codes, kRoot);
   
 #ifdef OPTIMIZED_INTEGER_CODE
 
@@ -451,12 +742,12 @@ size_t WaveletTree<BitVector>::readShape(Input& input) {
         integerCodeLengths.push_back(std::make_pair(len, integers[i]));
       }
       std::sort(integerCodeLengths.begin(), integerCodeLengths.end());
-      m_integerCodeTree = new TreeNode<BitVector>();
+      m_integerCodeTree = createNode();
       
       assignPrefixCodes(integerCodeLengths, m_integerCodeTree, 0, 0);
       collectCodes(m_integerCodes, m_integerCodeTree);
     } else {
-      m_integerCodeTree = new TreeNode<BitVector>(0);
+      m_integerCodeTree = createNode(0);
       //Force the vector to be initialized
       m_integerCodes[0].reserve(0);
     }
@@ -486,15 +777,16 @@ size_t WaveletTree<BitVector>::readShape(Input& input) {
     }
 
     std::sort(integerCodeLengths.begin(), integerCodeLengths.end());
-    m_integerCodeTree = new TreeNode<BitVector>();
+    m_integerCodeTree = createNode();
 
     assignPrefixCodes(integerCodeLengths, m_integerCodeTree, 0, 0);
     collectCodes(m_integerCodes, m_integerCodeTree);
 
-    assert(!m_integerCodeTree->m_hasSymbol);
+    assert(!m_nodes[m_integerCodeTree].m_hasSymbol);
 #endif
   }
 #endif
+  levelOrder();
   return bitsRead;
 }
 
@@ -650,7 +942,7 @@ void WaveletTree<BitVector>::encodeTreeBF(Encoder& enc, ProbabilisticModel& pm,
   PROFILE("WaveletTree::encodeTreeBF");
   /* Additional bitvector is used to encode gaps and continuous runs in the
    * parent's bitvector. */
-  typedef std::pair<TreeNode<BitVector>*, BitVector> InternalNode;
+  typedef std::pair<uint32, BitVector> InternalNode;
   /* TODO: If needing optimization helper bitvectors can be represented
    * using single larger bitvector. Now we just make redundant copies of
    * bitvectors.
@@ -661,27 +953,30 @@ void WaveletTree<BitVector>::encodeTreeBF(Encoder& enc, ProbabilisticModel& pm,
 #endif
 
   std::queue<InternalNode> queue;
-  std::list<TreeNode<BitVector>*> integerCodeNodes;
+  std::list<uint32> integerCodeNodes;
   {
     // Root node
     InternalNode left, right;
-    bool prev = !m_root->m_bitVector[0];
-    for(size_t i = 0; i < m_root->m_bitVector.size(); ++i) {
-      bool bit = m_root->m_bitVector[i];
+    const WaveletNode& root = m_nodes[kRoot];
+    bool prev = !bitAt(root, 0);
+    ArenaReader bits(bitsOf(root));
+    for(size_t i = 0; i < root.m_size; ++i) {
+      bool bit = bits.next();
       enc.encode(bit, pm.probabilityOfOne());
       pm.update(bit);
       BitVector& bv = bit? right.second : left.second;
       bv.push_back(prev != bit);
       prev = bit;
     }
-    if(m_root->m_left) {
-      if(m_root->m_left->m_hasSymbol) integerCodeNodes.push_back(m_root->m_left);
-      else { left.first = m_root->m_left; queue.push(left); }
+    if(root.m_left) {
+      if(m_nodes[root.m_left].m_hasSymbol)
+        integerCodeNodes.push_back(root.m_left);
+      else { left.first = root.m_left; queue.push(left); }
     }
-    if(m_root->m_right) {
-      if(m_root->m_right->m_hasSymbol)
-        integerCodeNodes.push_back(m_root->m_right);
-      else { right.first = m_root->m_right; queue.push(right); }
+    if(root.m_right) {
+      if(m_nodes[root.m_right].m_hasSymbol)
+        integerCodeNodes.push_back(root.m_right);
+      else { right.first = root.m_right; queue.push(right); }
     }
   }
 
@@ -693,31 +988,37 @@ void WaveletTree<BitVector>::encodeTreeBF(Encoder& enc, ProbabilisticModel& pm,
 
     InternalNode left, right;
     InternalNode& node = queue.front();
-    bool prev = !node.first->m_bitVector[0];
-    if(node.first->m_left->m_hasSymbol || node.first->m_right->m_hasSymbol) {
+    const WaveletNode& current = m_nodes[node.first];
+    const WaveletNode& leftChild = m_nodes[current.m_left];
+    const WaveletNode& rightChild = m_nodes[current.m_right];
+    bool prev = !bitAt(current, 0);
+    ArenaReader bits(bitsOf(current));
+    BitVectorReader<BitVector> gaps(node.second);
+    if(leftChild.m_hasSymbol || rightChild.m_hasSymbol) {
 
       // Both children are symbol nodes, hence only "after gaps"
       // are needed to encode
-      if(node.first->m_left->m_hasSymbol && node.first->m_right->m_hasSymbol) {
-        for(size_t i = 0; i  < node.first->m_bitVector.size(); ++i) {
-          if(!node.second[i]) continue; //node.first->m_bitVector[i] is known
-          bool bit = node.first->m_bitVector[i];
+      if(leftChild.m_hasSymbol && rightChild.m_hasSymbol) {
+        for(size_t i = 0; i  < current.m_size; ++i) {
+          bool bit = bits.next();
+          if(!gaps.next()) continue; //bit is known from the gaps
 
           enc.encode(bit, gapm.probabilityOfOne());
           gapm.update(bit);
 
         }
-        integerCodeNodes.push_back(node.first->m_left);
-        integerCodeNodes.push_back(node.first->m_right);
+        integerCodeNodes.push_back(current.m_left);
+        integerCodeNodes.push_back(current.m_right);
         
-      } else if(node.first->m_left->m_hasSymbol) {
-        right.first = node.first->m_right;
-
-        for(size_t i = 0; i < node.first->m_bitVector.size(); ++i) {
-          bool bit = node.first->m_bitVector[i];
-          if(bit) right.second.push_back(prev != bit || node.second[i]);
-          if(prev || node.second[i]) {
-            if(node.second[i]) {
+      } else if(leftChild.m_hasSymbol) {
+        right.first = current.m_right;
+
+        for(size_t i = 0; i < current.m_size; ++i) {
+          bool bit = bits.next();
+          bool gap = gaps.next();
+          if(bit) right.second.push_back(prev != bit || gap);
+          if(prev || gap) {
+            if(gap) {
               enc.encode(bit, gapm.probabilityOfOne());
               gapm.update(bit);
               pm.updateState(bit);
@@ -729,16 +1030,17 @@ void WaveletTree<BitVector>::encodeTreeBF(Encoder& enc, ProbabilisticModel& pm,
           prev = bit; 
         }
         queue.push(right);
-        integerCodeNodes.push_back(node.first->m_left);
+        integerCodeNodes.push_back(current.m_left);
       } else {
         // Shouldn't never happen, because we use canonical Huffman code
         assert(0);
       }
       
     } else {
-      for(size_t i = 0; i < node.first->m_bitVector.size(); ++i) {
-        bool bit = node.first->m_bitVector[i];
-        if(node.second[i]) {
+      for(size_t i = 0; i < current.m_size; ++i) {
+        bool bit = bits.next();
+        bool gap = gaps.next();
+        if(gap) {
           enc.encode(bit, gapm.probabilityOfOne());
           gapm.update(bit);
           pm.updateState(bit);
@@ -747,12 +1049,12 @@ void WaveletTree<BitVector>::encodeTreeBF(Encoder& enc, ProbabilisticModel& pm,
           pm.update(bit);
         }
         BitVector& bv = bit? right.second : left.second;
-        bv.push_back(prev != bit || node.second[i]);
+        bv.push_back(prev != bit || gap);
         prev = bit;
       }
-      left.first = node.first->m_left;
+      left.first = current.m_left;
       queue.push(left);
-      right.first = node.first->m_right;
+      right.first = current.m_right;
       queue.push(right);
     }
     queue.pop();
@@ -765,40 +1067,44 @@ void WaveletTree<BitVector>::encodeTreeBF(Encoder& enc, ProbabilisticModel& pm,
 #endif
   
   // Synchronized integer-coding phase (symbol nodes and integer-code nodes)
-  std::list<TreeNode<BitVector>*> left, right;
+  std::list<uint32> left, right;
   while(!integerCodeNodes.empty() || !left.empty() || !right.empty()) {
     integerCodeNodes.splice(integerCodeNodes.end(), left);
     integerCodeNodes.splice(integerCodeNodes.end(), right);
     gm.resetModel();
     while(!integerCodeNodes.empty()) {
 
-      TreeNode<BitVector>* node = integerCodeNodes.front();
-      for(size_t i = 0; i < node->m_bitVector.size(); ++i) {
-        enc.encode(node->m_bitVector[i], gm.probabilityOfOne());
-        gm.update(node->m_bitVector[i]);
+      const WaveletNode& node = m_nodes[integerCodeNodes.front()];
+      ArenaReader bits(bitsOf(node));
+      for(size_t i = 0; i < node.m_size; ++i) {
+        bool bit = bits.next();
+        enc.encode(bit, gm.probabilityOfOne());
+        gm.update(bit);
       }
       integerCodeNodes.pop_front();
 #ifdef OPTIMIZED_INTEGER_CODE
 #ifndef SEMI_FIXED_CODE      
-      if(node->m_left && !node->m_left->m_hasSymbol)
-        left.push_back(node->m_left);
-      if(node->m_right && !node->m_right->m_hasSymbol)
-        right.push_back(node->m_right);
+      if(node.m_left && !m_nodes[node.m_left].m_hasSymbol)
+        left.push_back(node.m_left);
+      if(node.m_right && !m_nodes[node.m_right].m_hasSymbol)
+        right.push_back(node.m_right);
 #else
-      if(node->m_left &&
-         (!node->m_left->m_hasSymbol ||
-          (node->m_left->m_hasSymbol && node->m_left->m_symbol == 0)))
-        left.push_back(node->m_left);
-      if(node->m_right &&
-         (!node->m_right->m_hasSymbol ||
-          (node->m_right->m_hasSymbol && node->m_right->m_symbol == 0)))
-        right.push_back(node->m_right);
+      if(node.m_left &&
+         (!m_nodes[node.m_left].m_hasSymbol ||
+          (m_nodes[node.m_left].m_hasSymbol &&
+           m_nodes[node.m_left].m_symbol == 0)))
+        left.push_back(node.m_left);
+      if(node.m_right &&
+         (!m_nodes[node.m_right].m_hasSymbol ||
+          (m_nodes[node.m_right].m_hasSymbol &&
+           m_nodes[node.m_right].m_symbol == 0)))
+        right.push_back(node.m_right);
 #endif      
 #else      
-      if(node->m_left)
-        left.push_back(node->m_left);
-      if(node->m_right)
-        right.push_back(node->m_right);
+      if(node.m_left)
+        left.push_back(node.m_left);
+      if(node.m_right)
+        right.push_back(node.m_right);
 #endif
     }
   }
@@ -813,9 +1119,9 @@ template<typename BitVector>
 #ifndef OPTIMIZED_INTEGER_CODE
 // Used for gamma codes, tracks progression of the code with variables
 struct IntegerNode {
-  IntegerNode(TreeNode<BitVector>* node, size_t bits, size_t len, byte status)
+  IntegerNode(uint32 node, size_t bits, size_t len, byte status)
       : m_node(node), m_bits(bits), m_gammaLen(len), m_gammaStatus(status) {}
-  TreeNode<BitVector> *m_node;
+  uint32 m_node;
   size_t m_bits;
   size_t m_gammaLen;
   byte m_gammaStatus; // Flag telling in what phase of gamma-code decoding is
@@ -825,11 +1131,11 @@ struct IntegerNode {
 // Used for more general integer codes. Tracks progression of the code by
 // following the corresponding integer code tree
 struct IntegerNode {
-  IntegerNode(TreeNode<BitVector>* node, TreeNode<BitVector>* intNode,
+  IntegerNode(uint32 node, uint32 intNode,
               size_t bits)
       : m_node(node), m_intNode(intNode), m_bits(bits) {}
-  TreeNode<BitVector> *m_node;
-  TreeNode<BitVector> *m_intNode;
+  uint32 m_node;
+  uint32 m_intNode;
   size_t m_bits;
 };
 #else
@@ -837,13 +1143,13 @@ struct IntegerNode {
 // integer code tree. In addition it is needed to know if we are in the fixed-code
 // part and how many leading ones the code has.
 struct IntegerNode {
-  IntegerNode(TreeNode<BitVector>* node, TreeNode<BitVector>* intNode,
+  IntegerNode(uint32 node, uint32 intNode,
               size_t bits,
               uint32 leadingOnes, byte codeStatus)
       : m_node(node), m_intNode(intNode), m_bits(bits),
         m_leadingOnes(leadingOnes), m_codeStatus(codeStatus) {}
-  TreeNode<BitVector> *m_node;
-  TreeNode<BitVector> *m_intNode;
+  uint32 m_node;
+  uint32 m_intNode;
   size_t m_bits;
   uint32 m_leadingOnes;
   byte m_codeStatus;
@@ -864,7 +1170,7 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
                                           GapModel& gapm)
 {
   //TODO: If needed optimize redundant copying of bitvectors!
-  typedef std::pair<TreeNode<BitVector>*, BitVector> InternalNode; 
+  typedef std::pair<uint32, BitVector> InternalNode;
   
   std::queue<InternalNode> queue;
   std::list<IntegerNode<BitVector> > integerCodeNodes;
@@ -873,9 +1179,10 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
   {
     BitVector left, right;
 
+    allocateBits(kRoot, rootSize);
     bool prev = dec.decode(pm.probabilityOfOne());
     pm.update(prev);
-    m_root->m_bitVector.push_back(prev);
+    pushBit(kRoot, prev);
 
     if(prev) right.push_back(true);
     else left.push_back(true);
@@ -883,44 +1190,46 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
     for(size_t i = 1; i < rootSize; ++i) {
       bool bit = dec.decode(pm.probabilityOfOne());
       pm.update(bit);
-      m_root->m_bitVector.push_back(bit);
+      pushBit(kRoot, bit);
       BitVector& gVector = bit? right: left;
       gVector.push_back(prev != bit);
       prev = bit;
     }
+    const uint32 leftChild = m_nodes[kRoot].m_left;
+    const uint32 rightChild = m_nodes[kRoot].m_right;
     // Left node has to always exist
-    if(m_root->m_left->m_hasSymbol) {
+    if(m_nodes[leftChild].m_hasSymbol) {
       integerCodeNodes.push_back(
 #ifndef OPTIMIZED_INTEGER_CODE
-        IntegerNode<BitVector>(m_root->m_left, left.size(), 0, 0));
+        IntegerNode<BitVector>(leftChild, left.size(), 0, 0));
 #else
 #ifndef SEMI_FIXED_CODE
-        IntegerNode<BitVector>(m_root->m_left, m_integerCodeTree, left.size()));
+        IntegerNode<BitVector>(leftChild, m_integerCodeTree, left.size()));
 #else
-        IntegerNode<BitVector>(m_root->m_left, m_integerCodeTree, left.size(),
+        IntegerNode<BitVector>(leftChild, m_integerCodeTree, left.size(),
                                0, 0));
 #endif
 #endif      
     } else {
-      queue.push(std::make_pair(m_root->m_left, left));
+      queue.push(std::make_pair(leftChild, left));
     }
     
     if(right.size() > 0) {
-      if(m_root->m_right->m_hasSymbol) {
+      if(m_nodes[rightChild].m_hasSymbol) {
         integerCodeNodes.push_back(
 #ifndef OPTIMIZED_INTEGER_CODE
-          IntegerNode<BitVector>(m_root->m_right, right.size(), 0, 0));
+          IntegerNode<BitVector>(rightChild, right.size(), 0, 0));
 #else
 #ifndef SEMI_FIXED_CODE
-          IntegerNode<BitVector>(m_root->m_right, m_integerCodeTree,
+          IntegerNode<BitVector>(rightChild, m_integerCodeTree,
                                  right.size()));
 #else
-          IntegerNode<BitVector>(m_root->m_right, m_integerCodeTree,
+          IntegerNode<BitVector>(rightChild, m_integerCodeTree,
                                  right.size(), 0, 0));
 #endif
 #endif      
       } else {
-        queue.push(std::make_pair(m_root->m_right, right));
+        queue.push(std::make_pair(rightChild, right));
       }
     }
   }
@@ -933,49 +1242,54 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
 
       BitVector left, right;
       InternalNode& node = queue.front();
+      allocateBits(node.first, node.second.size());
+      const uint32 leftChild = m_nodes[node.first].m_left;
+      const uint32 rightChild = m_nodes[node.first].m_right;
+      BitVectorReader<BitVector> gaps(node.second);
       // Node must have both left and right child
-      if(node.first->m_left->m_hasSymbol || node.first->m_right->m_hasSymbol) {
-        if(node.first->m_left->m_hasSymbol && node.first->m_right->m_hasSymbol) {
+      if(m_nodes[leftChild].m_hasSymbol || m_nodes[rightChild].m_hasSymbol) {
+        if(m_nodes[leftChild].m_hasSymbol && m_nodes[rightChild].m_hasSymbol) {
           size_t ones = 0;
           bool prev = true;
           for(size_t i = 0; i < node.second.size(); ++i) {
-            if(!node.second[i]) {
+            if(!gaps.next()) {
               prev = !prev;
             } else {
               prev = dec.decode(gapm.probabilityOfOne());
               gapm.update(prev);
             }
-            node.first->m_bitVector.push_back(prev);
+            pushBit(node.first, prev);
             if(prev) ++ones;
           }
           integerCodeNodes.push_back(IntegerNode<BitVector>(
 #ifndef OPTIMIZED_INTEGER_CODE
-              node.first->m_left, node.second.size() - ones, 0, 0));
+              leftChild, node.second.size() - ones, 0, 0));
 #else
 #ifndef SEMI_FIXED_CODE
-              node.first->m_left, m_integerCodeTree, node.second.size() - ones));
+              leftChild, m_integerCodeTree, node.second.size() - ones));
 #else
-      node.first->m_left, m_integerCodeTree, node.second.size() - ones,0,0));
+      leftChild, m_integerCodeTree, node.second.size() - ones,0,0));
 #endif
 #endif
           integerCodeNodes.push_back(IntegerNode<BitVector>(
 #ifndef OPTIMIZED_INTEGER_CODE
-              node.first->m_right, ones, 0, 0));
+              rightChild, ones, 0, 0));
 #else
 #ifndef SEMI_FIXED_CODE
-              node.first->m_right, m_integerCodeTree, ones));
+              rightChild, m_integerCodeTree, ones));
 #else
-              node.first->m_right, m_integerCodeTree, ones, 0, 0));
+              rightChild, m_integerCodeTree, ones, 0, 0));
 #endif
 #endif
         } else {
-          assert(!node.first->m_right->m_hasSymbol);
+          assert(!m_nodes[rightChild].m_hasSymbol);
           bool prev = true;
           for(size_t i = 0; i < node.second.size(); ++i) {
             bool bit;
-            if(!node.second[i] && !prev) {
+            bool gap = gaps.next();
+            if(!gap && !prev) {
               bit = true;
-            } else if(node.second[i]) {
+            } else if(gap) {
               bit = dec.decode(gapm.probabilityOfOne());
               gapm.update(bit);
               pm.updateState(bit);
@@ -983,29 +1297,30 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
               bit = dec.decode(pm.probabilityOfOne());
               pm.update(bit);
             }
-            node.first->m_bitVector.push_back(bit);
-            if(bit) right.push_back(prev != bit || node.second[i]);
+            pushBit(node.first, bit);
+            if(bit) right.push_back(prev != bit || gap);
             prev = bit;
           }
           integerCodeNodes.push_back(IntegerNode<BitVector>(
 #ifndef OPTIMIZED_INTEGER_CODE
-            node.first->m_left, node.second.size() - right.size(), 0, 0));
+            leftChild, node.second.size() - right.size(), 0, 0));
 #else
 #ifndef SEMI_FIXED_CODE
-            node.first->m_left, m_integerCodeTree,
+            leftChild, m_integerCodeTree,
                 node.second.size() - right.size()));
 #else
-            node.first->m_left, m_integerCodeTree,
+            leftChild, m_integerCodeTree,
               node.second.size() - right.size(),0 ,0));
 #endif
 #endif
-          queue.push(std::make_pair(node.first->m_right, right));
+          queue.push(std::make_pair(rightChild, right));
         }
       } else { //both children are also internal nodes
         bool prev = true;
         for(size_t i = 0; i < node.second.size(); ++i) {
           bool bit;
-          if(node.second[i]) {
+          bool gap = gaps.next();
+          if(gap) {
             bit = dec.decode(gapm.probabilityOfOne());
             gapm.update(bit);
             pm.updateState(bit);
@@ -1013,13 +1328,13 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
             bit = dec.decode(pm.probabilityOfOne());
             pm.update(bit);
           }
-          node.first->m_bitVector.push_back(bit);
+          pushBit(node.first, bit);
           BitVector& gapVector = bit? right: left;
-          gapVector.push_back(prev != bit || node.second[i]);
+          gapVector.push_back(prev != bit || gap);
           prev = bit;
         }
-        queue.push(std::make_pair(node.first->m_left, left));
-        queue.push(std::make_pair(node.first->m_right, right));
+        queue.push(std::make_pair(leftChild, left));
+        queue.push(std::make_pair(rightChild, right));
       }
       queue.pop();
     }
@@ -1037,28 +1352,29 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
 #ifdef OPTIMIZED_INTEGER_CODE
 #ifndef SEMI_FIXED_CODE
         assert(node.m_intNode);
-        if(node.m_intNode->m_hasSymbol) {
-          node.m_node->m_hasSymbol = true;
-          node.m_node->m_symbol = node.m_intNode->m_symbol;
+        if(m_nodes[node.m_intNode].m_hasSymbol) {
+          m_nodes[node.m_node].m_hasSymbol = true;
+          m_nodes[node.m_node].m_symbol = m_nodes[node.m_intNode].m_symbol;
           continue;
         }
 #else
-        if(node.m_intNode && node.m_intNode->m_hasSymbol) {
-          node.m_node->m_hasSymbol = true;
+        if(node.m_intNode && m_nodes[node.m_intNode].m_hasSymbol) {
+          m_nodes[node.m_node].m_hasSymbol = true;
           if(m_integerCodes.size() > 1) {
             //If using plain gamma codes we would override the old symbol
-            node.m_node->m_symbol = node.m_intNode->m_symbol;
+            m_nodes[node.m_node].m_symbol = m_nodes[node.m_intNode].m_symbol;
           }
-          if(node.m_intNode->m_symbol != 0) continue;
+          if(m_nodes[node.m_intNode].m_symbol != 0) continue;
         }
 #endif
 #endif        
         size_t ones = 0;
+        allocateBits(node.m_node, node.m_bits);
         for(size_t i = 0; i < node.m_bits; ++i) {
           bool bit = dec.decode(gm.probabilityOfOne());
           gm.update(bit);
           if(bit) ++ones;
-          node.m_node->m_bitVector.push_back(bit);
+          pushBit(node.m_node, bit);
         }
         
 #ifndef OPTIMIZED_INTEGER_CODE
@@ -1066,10 +1382,9 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
 
         
         if(node.m_bits > ones && node.m_gammaStatus != 0) {
-          if(!node.m_node->m_left)
-            node.m_node->m_left = new TreeNode<BitVector>();
+          const uint32 leftChild = child(node.m_node, false, true);
 
-          IntegerNode<BitVector> lnode(node.m_node->m_left, node.m_bits - ones,
+          IntegerNode<BitVector> lnode(leftChild, node.m_bits - ones,
                                      node.m_gammaLen, node.m_gammaStatus);
           if(node.m_gammaStatus == 1) {
             lnode.m_gammaStatus = 2;
@@ -1080,10 +1395,9 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
         }
 
         if(ones > 0) {
-          if(!node.m_node->m_right)
-            node.m_node->m_right = new TreeNode<BitVector>();
+          const uint32 rightChild = child(node.m_node, true, true);
 
-          IntegerNode<BitVector> rnode(node.m_node->m_right, ones,
+          IntegerNode<BitVector> rnode(rightChild, ones,
                                        node.m_gammaLen, node.m_gammaStatus);
           if(node.m_gammaStatus == 0) {
             rnode.m_gammaLen = 1;
@@ -1097,23 +1411,22 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
         }
 #else
         if(node.m_bits > ones) {
-          if(!node.m_node->m_left)
-            node.m_node->m_left = new TreeNode<BitVector>();
+          const uint32 leftChild = child(node.m_node, false, true);
 
 #ifndef SEMI_FIXED_CODE
-          assert(node.m_intNode->m_left);
-          IntegerNode<BitVector> lnode(node.m_node->m_left,
-                                       node.m_intNode->m_left,
+          assert(m_nodes[node.m_intNode].m_left);
+          IntegerNode<BitVector> lnode(leftChild,
+                                       m_nodes[node.m_intNode].m_left,
                                        node.m_bits - ones);
           left.push_back(lnode);
 #else
 
-          IntegerNode<BitVector> lnode(node.m_node->m_left,
-                                       node.m_intNode?node.m_intNode->m_left:0,
+          IntegerNode<BitVector> lnode(leftChild,
+                                       node.m_intNode?m_nodes[node.m_intNode].m_left:0,
                                        node.m_bits - ones, node.m_leadingOnes,
                                        node.m_codeStatus);
 
-          if(!node.m_intNode || !node.m_intNode->m_left) {
+          if(!node.m_intNode || !m_nodes[node.m_intNode].m_left) {
             if(node.m_codeStatus == 0) {
               lnode.m_codeStatus = 2;
               lnode.m_leadingOnes = m_W;
@@ -1133,23 +1446,22 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
         }
 
         if(ones > 0) {
-          if(!node.m_node->m_right)
-            node.m_node->m_right = new TreeNode<BitVector>();
+          const uint32 rightChild = child(node.m_node, true, true);
 
 #ifndef SEMI_FIXED_CODE
-          assert(node.m_intNode->m_right);
-          IntegerNode<BitVector> rnode(node.m_node->m_right,
-                                       node.m_intNode->m_right,
+          assert(m_nodes[node.m_intNode].m_right);
+          IntegerNode<BitVector> rnode(rightChild,
+                                       m_nodes[node.m_intNode].m_right,
                                        ones);
           right.push_back(rnode);
 #else
 
-          IntegerNode<BitVector> rnode(node.m_node->m_right,
-                                       node.m_intNode?node.m_intNode->m_right:0,
+          IntegerNode<BitVector> rnode(rightChild,
+                                       node.m_intNode?m_nodes[node.m_intNode].m_right:0,
                                        ones, node.m_leadingOnes,
                                        node.m_codeStatus);
 
-          if(!node.m_intNode || !node.m_intNode->m_right) {
+          if(!node.m_intNode || !m_nodes[node.m_intNode].m_right) {
             if(node.m_codeStatus == 0) {
               rnode.m_codeStatus = 1;
               ++rnode.m_leadingOnes;
@@ -1173,86 +1485,32 @@ void WaveletTree<BitVector>::decodeTreeBF(size_t rootSize,
   }
 }
 
-/** Pushes bitvector to tree by starting from the root. Assumes that every
- *  node on the path exists. This is used when pushing characters into the tree
- *  whose shape is already formed and codes are chosen by this shape.
- *
- * @param bits BitVector representing the symbol to be pushed.
- * @return Node which is at the depth bits.size() when the root is at depth 0.
- *         This node should have symbol (ie. m_hasSymbol == true).
- */
-template <typename BitVector>
-TreeNode<BitVector> *WaveletTree<BitVector>::pushBits(const BitVector& bits)
-{
-  TreeNode<BitVector> *node = m_root;
-  for(size_t i = 0; i < bits.size(); ++i) {
-    node->m_bitVector.push_back(bits[i]);
-    if(bits[i]) {
-      assert(node->m_right);
-      node = node->m_right;
-    } else {
-      assert(node->m_left);
-      node = node->m_left;
-    }
-  }
-  return node;
-}
-
-
-/** Pushes bitvector to tree by starting the node given. Creates new nodes if
- *  they don't exist on the path. However this doesn't create the leaf node which
- *  would come after storing all of the bits in their respectable nodes.
+/** Pushes bitvector to tree by starting from the given node. Every node on
+ *  the path has been created by countBits, which also made room for the bits.
  *
  * @param node Node to start.
  * @param bits Bits to push to the tree.
+ * @return Node which is at the depth bits.size() when the given node is at
+ *         depth 0, or 0 if there is no such node.
  */
 template <typename BitVector>
-void
-WaveletTree<BitVector>::pushBits(TreeNode<BitVector> *node, const BitVector& bits)
-{
-  assert(node);
-  assert(bits.size() > 0);
-  for(size_t i = 0; i < bits.size() - 1; ++i) {
-    node->m_bitVector.push_back(bits[i]);
-    if(bits[i]) {
-      if(!node->m_right) node->m_right = new TreeNode<BitVector>();
-      node = node->m_right;
-    } else {
-      if(!node->m_left) node->m_left = new TreeNode<BitVector>();
-      node = node->m_left;
-    }
-  }
-  node->m_bitVector.push_back(bits.back());
-}
-
-template <typename BitVector> void
-WaveletTree<BitVector>::pushBits(TreeNode<BitVector> *node, const BitVector& bits,
-                                 uint32 symbol)
+uint32 WaveletTree<BitVector>::pushBits(uint32 node, const BitVector& bits)
 {
-  assert(node);
-  assert(bits.size() > 0);
-  for(size_t i = 0; i < bits.size() - 1; ++i) {
-    node->m_bitVector.push_back(bits[i]);
-    if(bits[i]) {
-      if(!node->m_right) node->m_right = new TreeNode<BitVector>();
-      node = node->m_right;
-    } else {
-      if(!node->m_left) node->m_left = new TreeNode<BitVector>();
-      node = node->m_left;
-    }
+  for(size_t i = 0; i < bits.size(); ++i) {
+    assert(node || i == 0);
+    pushBit(node, bits[i]);
+    node = bits[i] ? m_nodes[node].m_right : m_nodes[node].m_left;
   }
-  node->m_bitVector.push_back(bits.back());
-  if(bits.back() && !node->m_right)
-    node->m_right = new TreeNode<BitVector>(symbol);
-  else if(!bits.back() && !node->m_left)
-    node->m_left = new TreeNode<BitVector>(symbol);
+  return node;
 }
 
 template <typename BitVector>
 void WaveletTree<BitVector>::pushRun(byte symbol, size_t runLength)
 {
-  TreeNode<BitVector> *node = pushBits(m_codes[symbol]);
-  assert(node->m_hasSymbol);
+  for(; runLength > m_maxRunLength; runLength -= m_maxRunLength)
+    pushRun(symbol, m_maxRunLength);
+  uint32 node = pushBits(kRoot, m_codes[symbol]);
+  assert(m_nodes[node].m_hasSymbol);
 #ifndef OPTIMIZED_INTEGER_CODE
   BitVector integerCode;
   gammaCode(integerCode, runLength);
@@ -1260,112 +1518,119 @@ void WaveletTree<BitVector>::pushRun(byte symbol, size_t runLength)
 #else
 
 #ifdef SEMI_FIXED_CODE
-  if(m_integerCodes.find(runLength) == m_integerCodes.end()) {
+  typename std::map<uint32, BitVector>::const_iterator it =
+      m_integerCodes.find(runLength);
+  if(it == m_integerCodes.end()) {
     BitVector integerCode(m_integerCodes[0]);
     fixedIntegerCode(integerCode, runLength, m_W);
-    pushBits(node, integerCode, runLength);
+    pushBits(node, integerCode);
   } else {
-    pushBits(node, m_integerCodes[runLength], runLength);
+    pushBits(node, it->second);
   }
 #else
-  pushBits(node, m_integerCodes[runLength], runLength);
+  pushBits(node, m_integerCodes[runLength]);
 #endif
 
 #endif  
 }
 
+/**Position in the child is the number of ones (or zeros) read from the
+ * parent before the current bit, so the number of one-bits read from each
+ * node so far is kept in an array beside the nodes. */
 template <typename BitVector> template <typename OutputIterator>
 size_t WaveletTree<BitVector>::message(OutputIterator out) const {
+  PROFILE("WaveletTree::message");
+  const WaveletNode * const nodes = &m_nodes[0];
+  std::vector<uint64> onesRead(m_nodes.size(), 0);
+  uint64 * const ones = &onesRead[0];
+
   size_t len = 0;
-  size_t msgSize = m_root->m_bitVector.size();
-  std::map<TreeNode<BitVector>*, size_t> bitsSeen;
+  size_t msgSize = nodes[kRoot].m_size;
   for(size_t j = 0; j < msgSize; ++j) {
     bool bit;
-    TreeNode<BitVector> *node = m_root;
+    uint32 node = kRoot;
     size_t i = j;
     do {
-      bit = node->m_bitVector[i];
+      bit = bitAt(nodes[node], i);
       // Update bits seen and perform rank
-      if(bit) i = bitsSeen[node]++;
-      else i = i - bitsSeen[node]; 
-      node = bit?node->m_right:node->m_left;
-    } while(!node->m_hasSymbol);
-    byte symbol = node->m_symbol;
+      if(bit) i = ones[node]++;
+      else i = i - ones[node];
+      node = bit ? nodes[node].m_right : nodes[node].m_left;
+    } while(!nodes[node].m_hasSymbol);
+    byte symbol = nodes[node].m_symbol;
 
     // Decoding of integer-code
 #ifndef OPTIMIZED_INTEGER_CODE
     size_t runBits = 0;
-    bit = node->m_bitVector[i];
+    bit = bitAt(nodes[node], i);
     while(bit) {
-      i = bitsSeen[node]++;
-      node = bit?node->m_right:node->m_left;
+      i = ones[node]++;
+      node = nodes[node].m_right;
       ++runBits;
-      bit = node->m_bitVector[i];
+      bit = bitAt(nodes[node], i);
     }
     size_t runLength = 1;
     for(size_t k = 0; k < runBits; ++k) {
       runLength <<= 1;
-      if(bit) i = bitsSeen[node]++;
-      else i = i - bitsSeen[node]; 
-      node = bit?node->m_right:node->m_left;
-      bit = node->m_bitVector[i];
+      if(bit) i = ones[node]++;
+      else i = i - ones[node];
+      node = bit ? nodes[node].m_right : nodes[node].m_left;
+      bit = bitAt(nodes[node], i);
       runLength |= (bit?1:0);
     }
 #else
     size_t runLength = 0;
 #ifdef SEMI_FIXED_CODE
-    if(!m_integerCodeTree->m_hasSymbol) {
+    if(!nodes[m_integerCodeTree].m_hasSymbol) {
       // We are not using plain gamma codes so we can proceed
       do {
-        bit = node->m_bitVector[i];
-        
+        bit = bitAt(nodes[node], i);
         if(bit) {
-          i = bitsSeen[node]++;
-          assert(node->m_right);
-          node = node->m_right;
+          i = ones[node]++;
+          assert(nodes[node].m_right);
+          node = nodes[node].m_right;
         } else {
-          i = i - bitsSeen[node];
-          assert(node->m_left);
-          node = node->m_left;
+          i = i - ones[node];
+          assert(nodes[node].m_left);
+          node = nodes[node].m_left;
         }
-      } while(!node->m_hasSymbol);
-      runLength = node->m_symbol;
+      } while(!nodes[node].m_hasSymbol);
+      runLength = nodes[node].m_symbol;
     }
     if(runLength == 0) {
       size_t leadingOnes = 0;
-      bit = node->m_bitVector[i];
+      bit = bitAt(nodes[node], i);
       while(bit) {
         ++leadingOnes;
-        i = bitsSeen[node]++;
-        node = bit?node->m_right:node->m_left;
-        bit = node->m_bitVector[i];
+        i = ones[node]++;
+        node = nodes[node].m_right;
+        bit = bitAt(nodes[node], i);
       }
-      
+
       for(size_t k = 0; k < leadingOnes + m_W; ++k) {
         runLength <<= 1;
-        if(bit) i = bitsSeen[node]++;
-        else i = i - bitsSeen[node];
-        node = bit?node->m_right:node->m_left;
-        bit = node->m_bitVector[i];
+        if(bit) i = ones[node]++;
+        else i = i - ones[node];
+        node = bit ? nodes[node].m_right : nodes[node].m_left;
+        bit = bitAt(nodes[node], i);
         runLength |= (bit?1:0);
       }
       runLength += fixedIntegerCodeTranslation(leadingOnes, m_W);
     }
-#else     
+#else
     do {
-      bit = node->m_bitVector[i];
-
+      bit = bitAt(nodes[node], i);
       if(bit) {
-        i = bitsSeen[node]++;
-        assert(node->m_right);
-        node = node->m_right;
+        i = ones[node]++;
+        assert(nodes[node].m_right);
+        node = nodes[node].m_right;
       } else {
-        i = i - bitsSeen[node];
-        assert(node->m_left);
-        node = node->m_left;
+        i = i - ones[node];
+        assert(nodes[node].m_left);
+        node = nodes[node].m_left;
       }
-    } while(!node->m_hasSymbol);
-    runLength = node->m_symbol;
+    } while(!nodes[node].m_hasSymbol);
+    runLength = nodes[node].m_symbol;
 #endif
 
 #endif //OPTIMIZED_INTEGER_CODE
@@ -1442,13 +1707,15 @@ void WaveletTree<BitVector>::assignPrefixCodes(
     std::vector<std::pair<uint64, uint32> >& lengths)
 {
   std::sort(lengths.begin(), lengths.end());
-  m_root = new TreeNode<BitVector>();
-  assignPrefixCodes(lengths, m_root, 0, 0);
+  assert(m_nodes.size() == 1);
+  assignPrefixCodes(lengths, kRoot, 0, 0);
 }
 
+/* Nodes are created before they are linked to their parent, as creating a
+ * node may move the others. */
 template <typename BitVector>
 size_t WaveletTree<BitVector>::assignPrefixCodes(
-    std::vector<std::pair<uint64, uint32> >& lengths, TreeNode<BitVector>* node,
+    std::vector<std::pair<uint64, uint32> >& lengths, uint32 node,
     size_t elem, size_t bits)
 {
   if(elem >= lengths.size()) return elem;
@@ -1458,25 +1725,28 @@ size_t WaveletTree<BitVector>::assignPrefixCodes(
     return elem + 1;
   } else */
   if(bits == lengths[elem].first - 1) {
-    if(!node->m_left) {
-      node->m_left = new TreeNode<BitVector>(lengths[elem].second);
+    uint32 leaf = createNode(lengths[elem].second);
+    if(!m_nodes[node].m_left) {
+      m_nodes[node].m_left = leaf;
       elem = assignPrefixCodes(lengths, node, elem+1, bits);
     } else {
-      assert(!node->m_right);
-      node->m_right = new TreeNode<BitVector>(lengths[elem].second);
+      assert(!m_nodes[node].m_right);
+      m_nodes[node].m_right = leaf;
       ++elem;
     }
     return elem;
   }
   assert(bits < lengths[elem].first - 1);
-  if(!node->m_left) {
-    node->m_left = new TreeNode<BitVector>();
-    elem = assignPrefixCodes(lengths, node->m_left, elem, bits + 1);
+  if(!m_nodes[node].m_left) {
+    uint32 left = createNode();
+    m_nodes[node].m_left = left;
+    elem = assignPrefixCodes(lengths, left, elem, bits + 1);
   }
-  assert(!node->m_right);
+  assert(!m_nodes[node].m_right);
   if(elem < lengths.size()) {
-    node->m_right = new TreeNode<BitVector>();
-    elem = assignPrefixCodes(lengths, node->m_right, elem, bits + 1);
+    uint32 right = createNode();
+    m_nodes[node].m_right = right;
+    elem = assignPrefixCodes(lengths, right, elem, bits + 1);
   }
   return elem;
 }
@@ -1549,6 +1819,35 @@ WaveletTree<BitVector>::collectCodes(BVectors& codes, BitVector& vec,
 }
 
 
+template <typename BitVector> template <typename BVectors>
+void WaveletTree<BitVector>::collectCodes(BVectors& codes, uint32 node) const
+{
+  BitVector vec;
+  collectCodes(codes, vec, node);
+}
+
+template <typename BitVector>
+template <typename BVectors> void
+WaveletTree<BitVector>::collectCodes(BVectors& codes, BitVector& vec,
+                                     uint32 node) const
+{
+  const WaveletNode& n = m_nodes[node];
+  if(n.m_left == 0 && n.m_right == 0) {
+    codes[n.m_symbol] = vec;
+  }
+  if(n.m_left) {
+    vec.push_back(false);
+    collectCodes(codes, vec, n.m_left);
+    vec.pop_back();
+  }
+  if(n.m_right) {
+    vec.push_back(true);
+    collectCodes(codes, vec, n.m_right);
+    vec.pop_back();
+  }
+}
+
+
 template <typename BitVector>
 uint64 WaveletTree<BitVector>::bitsForIntegers(
     uint32 w, uint32 depthForFixedCodes,
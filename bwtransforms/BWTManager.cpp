@@ -30,31 +30,161 @@
 #include "SA-IS-bwt.hpp"
 #include "Divsufsorter.hpp"
 
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
 namespace bwtc {
 
-BWTManager::BWTManager() : m_startingPoints(1) {}
+namespace {
+
+/* Indices of the transformers when choosing automatically. */
+const size_t kDivsufsort = 0;
+const size_t kSais = 1;
+
+/* Smaller blocks are always transformed with divsufsort. */
+const uint32 kMinProbedBlockSize = 1 << 16;
+/* Running times are measured only for blocks at least this large, since
+ * the times of the small blocks are dominated by noise. */
+const uint32 kMinTimedBlockSize = 1 << 20;
+
+/* Parameters of the repetitiveness probe. */
+const uint32 kWindow = 32;
+const uint32 kHashBase = 0x2f0b3c27;
+const int kSampleBits = 6;
+
+/**Estimates the fraction of the block that is covered by repeats of at
+ * least kWindow bytes. Rolling hashes of the windows are sampled based on
+ * their value (1/64 of them), so the same substring is sampled in the same
+ * places wherever it occurs. The estimate is the fraction of the sampled
+ * hashes which are duplicates of an earlier one. */
+double repetitiveness(const byte *data, uint64 length) {
+  uint32 power = 1;
+  for(uint32 i = 0; i < kWindow; ++i) power *= kHashBase;
+
+  std::vector<uint32> samples;
+  samples.reserve((length >> kSampleBits) + 1);
+  uint32 hash = 0;
+  for(uint64 i = 0; i < length; ++i) {
+    hash = hash*kHashBase + data[i];
+    if(i >= kWindow) hash -= data[i - kWindow]*power;
+    if(i + 1 >= kWindow && (hash >> (32 - kSampleBits)) == 0) {
+      samples.push_back(hash);
+    }
+  }
+  if(samples.empty()) return 0.0;
+  std::sort(samples.begin(), samples.end());
+  size_t distinct = std::unique(samples.begin(), samples.end()) -
+      samples.begin();
+  return static_cast<double>(samples.size() - distinct)/samples.size();
+}
+
+} //namespace
+
+BWTManager::BWTManager()
+    : m_startingPoints(1), m_threads(1),
+      m_memoryBudget(~static_cast<uint64>(0)), m_choice(0),
+      m_secondsPerByte(2*kRepetitivenessClasses, 0.0) {}
 
 BWTManager::BWTManager(uint32 startingPoints)
-    : m_startingPoints(startingPoints) {}
+    : m_startingPoints(startingPoints), m_threads(1),
+      m_memoryBudget(~static_cast<uint64>(0)), m_choice(0),
+      m_secondsPerByte(2*kRepetitivenessClasses, 0.0) {}
 
 BWTManager::~BWTManager() {
+  deleteTransformers();
+}
+
+void BWTManager::deleteTransformers() {
   for(size_t i = 0; i < m_transformers.size(); ++i) {
     delete m_transformers[i];
   }
+  m_transformers.clear();
 }
 
 void BWTManager::doTransform(BWTBlock& block) {
   assert(!block.isTransformed());
   block.prepareLFpowers(m_startingPoints);
-  //Something more sophisticated here if choosing algorithm automatically:
-  m_transformers[0]->doTransform(block);
+  int repetitivenessClass;
+  size_t t = chooseTransformer(block, &repetitivenessClass);
+  boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
+  m_transformers[t]->doTransform(block);
+  recordTime(t, repetitivenessClass, block.size(),
+             (boost::posix_time::microsec_clock::universal_time() - start).
+             total_microseconds()*1e-6);
 }
 
-void BWTManager::doTransform(BWTBlock& block, uint32 *freqs) {
+void BWTManager::doTransform(BWTBlock& block, uint64 *freqs) {
   assert(!block.isTransformed());
   block.prepareLFpowers(m_startingPoints);
-  //Something more sophisticated here if choosing algorithm automatically:
-  m_transformers[0]->doTransform(block, freqs);
+  int repetitivenessClass;
+  size_t t = chooseTransformer(block, &repetitivenessClass);
+  boost::posix_time::ptime start =
+      boost::posix_time::microsec_clock::universal_time();
+  m_transformers[t]->doTransform(block, freqs);
+  recordTime(t, repetitivenessClass, block.size(),
+             (boost::posix_time::microsec_clock::universal_time() - start).
+             total_microseconds()*1e-6);
+}
+
+/* Repetitiveness probe is run before the transform, so its samples and the
+ * workspace of the transform are never in memory at the same time. The first
+ * transformer is the one used when the others don't fit. */
+uint64 BWTManager::maxSizeInBytes(uint64 block_size) const {
+  uint64 bytes = m_transformers[0]->maxSizeInBytes(block_size);
+  if(m_transformers.size() > 1) {
+    bytes = std::max(bytes,
+                     ((block_size >> kSampleBits) + 1)*sizeof(uint32));
+  }
+  return bytes;
+}
+
+/* Without measurements, the highly repetitive blocks are given to SA-IS,
+ * since the running time of divsufsort degrades with long repeats. When
+ * only one of the algorithms has been measured for the class of the block,
+ * the other one is tried once for a large enough block. After that the
+ * faster one is used. */
+size_t BWTManager::chooseTransformer(const BWTBlock& block,
+                                     int *repetitivenessClass) {
+  *repetitivenessClass = -1;
+  if(m_transformers.size() == 1) return 0;
+  if(block.size() < kMinProbedBlockSize) return kDivsufsort;
+
+  double r = repetitiveness(block.begin(), block.size());
+  int c = std::min(static_cast<int>(r*kRepetitivenessClasses),
+                   kRepetitivenessClasses - 1);
+  *repetitivenessClass = c;
+
+  size_t choice = (c == kRepetitivenessClasses - 1) ? kSais : kDivsufsort;
+  double chosenTime = m_secondsPerByte[2*c + choice];
+  double otherTime = m_secondsPerByte[2*c + (1 - choice)];
+  if(chosenTime > 0.0) {
+    if(otherTime == 0.0 && block.size() >= kMinTimedBlockSize) {
+      choice = 1 - choice;
+    } else if(otherTime > 0.0 && otherTime < chosenTime) {
+      choice = 1 - choice;
+    }
+  }
+  if(choice == kSais &&
+     m_transformers[kSais]->maxSizeInBytes(block.size()) > m_memoryBudget) {
+    choice = kDivsufsort;
+  }
+  if(verbosity > 2) {
+    std::clog << "Repetitiveness of the block " << r << ", using "
+              << ((choice == kSais) ? "sais" : "divsufsort") << "\n";
+  }
+  return choice;
+}
+
+void BWTManager::recordTime(size_t transformer, int repetitivenessClass,
+                            size_t blockSize, double seconds) {
+  if(repetitivenessClass < 0 || blockSize < kMinTimedBlockSize) return;
+  double& t = m_secondsPerByte[2*repetitivenessClass + transformer];
+  double measured = std::max(seconds/blockSize, 1e-12);
+  t = (t == 0.0) ? measured : (t + measured)/2;
 }
 
 void BWTManager::setStartingPoints(uint32 startingPoints) {
@@ -63,19 +193,35 @@ void BWTManager::setStartingPoints(uint32 startingPoints) {
   m_startingPoints = startingPoints;
 }
 
+void BWTManager::setMemoryBudget(uint64 bytes) {
+  m_memoryBudget = bytes;
+}
+
 uint32 BWTManager::getStartingPoints() const {
   return m_startingPoints;
 }
 
+void BWTManager::setThreads(uint32 threads) {
+  if(threads < 1) threads = 1;
+  if(threads == m_threads) return;
+  m_threads = threads;
+  if(m_choice) initialize(m_choice);
+}
+
 bool BWTManager::isValidChoice(char c) {
   return c == 'd' || c == 's' || c == 'a';
 }
 
 void BWTManager::initialize(char choice) {
+  deleteTransformers();
+  m_choice = choice;
   if(choice == 's') {
     m_transformers.push_back(new SAISBWTransform());
+  } else if(choice == 'a') {
+    m_transformers.push_back(new Divsufsorter(m_threads));
+    m_transformers.push_back(new SAISBWTransform());
   } else {
-    m_transformers.push_back(new Divsufsorter());
+    m_transformers.push_back(new Divsufsorter(m_threads));
   }
 }
 
@@ -22,8 +22,9 @@
  * @section DESCRIPTION
  *
  * Header for BWT-manager. The choice of BWT-algorithm is done in this
- * class. In future, if needed, the choice of the algorithm can be done in
- * fly based on the running times.
+ * class. When the algorithm is chosen automatically, the choice between
+ * divsufsort and SA-IS is done separately for each block based on the
+ * repetitiveness of the block and the running times of the earlier blocks.
  *
  */
 
@@ -45,16 +46,41 @@ class BWTManager {
   ~BWTManager();
 
   void doTransform(BWTBlock& block);
-  void doTransform(BWTBlock& block, uint32 *freqs);
+  void doTransform(BWTBlock& block, uint64 *freqs);
   void initialize(char choice);
   void setStartingPoints(uint32 startingPoints);
   uint32 getStartingPoints() const;
+  /**Sets the number of threads single transform may use. Has effect only
+   * with the OpenMP-enabled divsufsort. */
+  void setThreads(uint32 threads);
+  /**Sets the memory single transform may use. When choosing automatically,
+   * SA-IS is used only for the blocks whose transform fits into it. */
+  void setMemoryBudget(uint64 bytes);
+  /**Upper bound for the memory used by the transform of a block of
+   * block_size bytes. When choosing automatically, the bound is the one of
+   * divsufsort, see setMemoryBudget. */
+  uint64 maxSizeInBytes(uint64 block_size) const;
 
   static bool isValidChoice(char c);
   
  private:
+  /** Number of classes the blocks are divided into by repetitiveness. */
+  static const int kRepetitivenessClasses = 4;
+
   std::vector<BWTransform*> m_transformers;
   uint32 m_startingPoints;
+  uint32 m_threads;
+  uint64 m_memoryBudget;
+  char m_choice;
+  /** Running times (seconds per byte) of the transformers for each class
+   *  of repetitiveness, zero if there is no measurement yet. */
+  std::vector<double> m_secondsPerByte;
+
+  void deleteTransformers();
+  /** Chooses the transformer for the block and tells its class. */
+  size_t chooseTransformer(const BWTBlock& block, int *repetitivenessClass);
+  void recordTime(size_t transformer, int repetitivenessClass,
+                  size_t blockSize, double seconds);
 };
 
 }  //namespace bwtc
@@ -28,8 +28,11 @@
 #include <algorithm>
 #include <vector>
 
+#include <boost/bind.hpp>
+
 #include "../globaldefs.hpp"
 #include "../BWTBlock.hpp"
+#include "../MemoryAccountant.hpp"
 #include "BWTransform.hpp"
 #include "SA-IS-bwt.hpp"
 #include "Divsufsorter.hpp"
@@ -49,7 +52,7 @@ void BWTransform::doTransform(BWTBlock& block) {
   *block.end() = next;
 }
 
-void BWTransform::doTransform(BWTBlock& block, uint32 freqs[256]) {
+void BWTransform::doTransform(BWTBlock& block, uint64 freqs[256]) {
   std::reverse(block.begin(), block.end());
   byte next = *block.end();
   *block.end() = 0;
@@ -63,6 +66,16 @@ void BWTransform::doTransform(BWTBlock& block, uint32 freqs[256]) {
   *block.end() = next;
 }
 
+uint64 BWTransform::maxBlockSize(uint64 memory_budget) const {
+  MemoryAccountant memory(memory_budget);
+  return memory.largestBlock(
+      boost::bind(&BWTransform::maxSizeInBytes, this, _1), 1, kMaxBlockSize);
+}
+
+uint64 BWTransform::suggestedBlockSize(uint64 memory_budget) const {
+  return maxBlockSize(memory_budget);
+}
+
 BWTransform* giveTransformer(char transform) {
   (void) transform;
   if(transform != 's') {
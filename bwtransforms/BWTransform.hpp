@@ -50,19 +50,26 @@ class BWTransform {
   BWTransform() {}
   virtual ~BWTransform() {}
   
+  /**Transforms length bytes from begin. Transforms of more than
+   * kMaxSmallBlockSize + 1 bytes are computed with 64-bit indices. */
   virtual
-  void doTransform(byte *begin, uint32 length, std::vector<uint32>& LF) const = 0;
+  void doTransform(byte *begin, uint64 length, std::vector<uint64>& LF) const = 0;
 
   virtual
-  void doTransform(byte *begin, uint32 length, std::vector<uint32>& LF,
-                   uint32 freqs[256]) const = 0;
+  void doTransform(byte *begin, uint64 length, std::vector<uint64>& LF,
+                   uint64 freqs[256]) const = 0;
 
   void doTransform(BWTBlock& block);
-  void doTransform(BWTBlock& block, uint32 freqs[256]);
+  void doTransform(BWTBlock& block, uint64 freqs[256]);
 
+  /**Upper bound for the memory used by the transform of a block of
+   * block_size bytes, excluding the block itself. */
   virtual uint64 maxSizeInBytes(uint64 block_size) const = 0;
-  virtual uint64 maxBlockSize(uint64 memory_budget) const = 0;
-  virtual uint64 suggestedBlockSize(uint64 memory_budget) const = 0;
+  /**Largest block whose transform fits into memory_budget bytes. */
+  virtual uint64 maxBlockSize(uint64 memory_budget) const;
+  /**Block size which the transform prefers for the given budget. By default
+   * the largest one which fits. */
+  virtual uint64 suggestedBlockSize(uint64 memory_budget) const;
 
  private:
   BWTransform(const BWTransform&);
@@ -33,10 +33,12 @@
 #include <vector>
 
 #include "BWTransform.hpp"
+#include "LargeArray.hpp"
 #include "../globaldefs.hpp"
 #include "../Profiling.hpp"
 
 #include "divsufsort.h"
+#include "divsufsort64.h"
 
 using bwtc::uint64;
 using bwtc::int64;
@@ -46,29 +48,61 @@ using bwtc::Max;
 
 namespace bwtc {
 
+/**
+ * BWT with libdivsufsort. When the library is compiled with OpenMP
+ * (bwtransforms_omp), sorting of the type B* substrings uses the given
+ * number of threads. Otherwise the number of threads is ignored.
+ *
+ * Blocks larger than kMaxSmallBlockSize are sorted with the 64-bit version
+ * of the library, which takes twice the memory for the suffix array.
+ */
 class Divsufsorter : public BWTransform {
  public:
-  Divsufsorter() {}
+  explicit Divsufsorter(uint32 threads = 1) : m_threads(threads) {}
   virtual ~Divsufsorter() {}
 
   void
-  doTransform(byte *begin, uint32 length, std::vector<uint32>& LFpowers) const {
+  doTransform(byte *begin, uint64 length, std::vector<uint64>& LFpowers) const {
     PROFILE("Divsufsorter::doTransform");
-    divbwt(begin, begin, 0, length, &LFpowers[0], LFpowers.size());
+    if(length <= kMaxSmallBlockSize + 1) {
+      LargeArray<saidx_t> SA(length + 1);
+      divbwt(begin, begin, SA.get(), length, &LFpowers[0], LFpowers.size(),
+             m_threads);
+    } else {
+      LargeArray<saidx64_t> SA(length + 1);
+      divbwt64(begin, begin, SA.get(), length, &LFpowers[0], LFpowers.size(),
+               m_threads);
+    }
   }
 
   void
-  doTransform(byte *begin, uint32 length, std::vector<uint32>& LFpowers,
-              uint32 *freqs) const {
+  doTransform(byte *begin, uint64 length, std::vector<uint64>& LFpowers,
+              uint64 *freqs) const {
     PROFILE("Divsufsorter::doTransform");
-    divbwtf(begin, begin, 0, length, &LFpowers[0], LFpowers.size(), freqs);
+    if(length <= kMaxSmallBlockSize + 1) {
+      LargeArray<saidx_t> SA(length + 1);
+      divbwtf(begin, begin, SA.get(), length, &LFpowers[0], LFpowers.size(),
+              freqs, m_threads);
+    } else {
+      LargeArray<saidx64_t> SA(length + 1);
+      divbwtf64(begin, begin, SA.get(), length, &LFpowers[0], LFpowers.size(),
+                freqs, m_threads);
+    }
   }
 
-  /* The following values aren't correct */
-  virtual uint64 maxSizeInBytes(uint64) const { return 0; }
-  virtual uint64 maxBlockSize(uint64) const { return 0; }
-  virtual uint64 suggestedBlockSize(uint64) const { return 0; }
-  
+  /* Suffix array for the block and the sentinel, and the buckets which
+   * divbwt allocates. */
+  virtual uint64 maxSizeInBytes(uint64 block_size) const {
+    uint64 entry = (block_size <= kMaxSmallBlockSize) ? sizeof(saidx_t)
+                                                      : sizeof(saidx64_t);
+    return (block_size + 2 + kBucketEntries)*entry;
+  }
+
+ private:
+  /* Sizes of bucket_A and bucket_B in divsufsort.c. */
+  static const uint64 kBucketEntries = 256 + 256*256;
+
+  uint32 m_threads;
 };
 } // namespace bwtc
 
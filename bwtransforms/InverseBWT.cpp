@@ -28,20 +28,69 @@
 
 #include <cassert>
 
+#include <algorithm>
 #include <numeric>  // for partial_sum
 #include <vector>
 
+#include <boost/bind.hpp>
+
 #include "../globaldefs.hpp"
 #include "InverseBWT.hpp"
+#include "LargeArray.hpp"
 #include "MtlSaInverseBWT.hpp"
 #include "../BWTBlock.hpp"
+#include "../MemoryAccountant.hpp"
 #include "../Profiling.hpp"
 
 namespace bwtc {
 
-InverseBWTransform* giveInverseTransformer() {
-  //return new FastInverseBWTransform();
-  return new MtlSaInverseBWTransform();
+namespace {
+
+/* Superblocks of the milestone index of FastInverseBWTransform. */
+const int kSuperblockBits = 24;
+const uint32 kSuperblockMask = (1 << kSuperblockBits) - 1;
+/* Offset of the milestone telling that the ranks don't wrap around in the
+ * superblock. */
+const uint32 kNoWrap = 1 << kSuperblockBits;
+const uint32 kOffsetMask = 2*kNoWrap - 1;
+
+/* Step of the walk of FastInverseBWTransform: writes the character at
+ * position to dest and returns the next position. */
+inline uint32 inverseStep(const uint32 *bwt_rank_low24,
+                          const uint32 *milestones, const uint32 *count,
+                          uint32 position, byte *dest) {
+  uint32 bwt_and_rank = bwt_rank_low24[position];
+  uint32 ch = bwt_and_rank >> 24;
+  uint32 milestone = milestones[((position >> kSuperblockBits) << 8) + ch];
+  uint32 rank_hi = (milestone >> 25) +
+      ((position & kSuperblockMask) >= (milestone & kOffsetMask));
+  *dest = ch;
+  return count[ch] + (rank_hi << 24) + (bwt_and_rank & 0x00FFFFFF);
+}
+
+} //namespace
+
+InverseBWTransform* giveInverseTransformer(uint32 threads, uint64 block_size,
+                                           uint64 memory_budget) {
+  std::vector<InverseBWTransform*> candidates;
+  candidates.push_back(new MtlSaInverseBWTransform(threads));
+  if (threads > 1) candidates.push_back(new MtlSaInverseBWTransform(1));
+  candidates.push_back(new FastInverseBWTransform());
+  size_t chosen = 0;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (candidates[i]->maxSizeInBytes(block_size) <= memory_budget) {
+      chosen = i;
+      break;
+    }
+    if (candidates[i]->maxSizeInBytes(block_size) <
+        candidates[chosen]->maxSizeInBytes(block_size)) {
+      chosen = i;
+    }
+  }
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (i != chosen) delete candidates[i];
+  }
+  return candidates[chosen];
 }
 
 void InverseBWTransform::doTransform(BWTBlock& block) {
@@ -50,19 +99,41 @@ void InverseBWTransform::doTransform(BWTBlock& block) {
   doTransform(block.begin(), block.size()+1, block.LFpowers());
 }
 
-uint64 FastInverseBWTransform::maxBlockSize(uint64 memory_budget) const {
-  memory_budget -= kMemoryOverhead;
-  return memory_budget / sizeof(uint32);
+uint64 InverseBWTransform::maxBlockSize(uint64 memory_budget) const {
+  MemoryAccountant memory(memory_budget);
+  return memory.largestBlock(
+      boost::bind(&InverseBWTransform::maxSizeInBytes, this, _1), 1,
+      kMaxBlockSize);
+}
+
+/* Ranks of the positions and the milestone index. */
+uint64 FastInverseBWTransform::maxSizeInBytes(uint64 block_size) const {
+  if (block_size > kMaxSmallBlockSize) {
+    return WideInverseBWTransform().maxSizeInBytes(block_size);
+  }
+  return (block_size + 1)*sizeof(uint32) +
+      ((block_size >> kSuperblockBits) + 1)*256*sizeof(uint32);
 }
 
 void FastInverseBWTransform::doTransform(
-    byte* bwt, uint32 bwt_size, const std::vector<uint32>& LFpowers)
+    byte* bwt, uint64 bwt_size64, const std::vector<uint64>& LFpowers)
 {
+  if (bwt_size64 > kMaxSmallBlockSize + 1) {
+    WideInverseBWTransform().doTransform(bwt, bwt_size64, LFpowers);
+    return;
+  }
   PROFILE("FastInverseBWTransform::doTransform");
+  uint32 bwt_size = bwt_size64;
   uint32 eob_position = LFpowers[0];
-  // rank[i] will be the number of occurrences of bwt[i] in bwt[0..i-1]
-  std::vector<uint32> bwt_rank_low24(bwt_size);
-  std::vector<uint32> rank_milestone_buffer[256];
+  // bwt_rank_low24[i] holds bwt[i] in the highest 8 bits and the lowest 24
+  // bits of its rank (the number of occurrences of bwt[i] in bwt[0..i-1]).
+  LargeArray<uint32> bwt_rank_low24(bwt_size);
+  // The rest of the rank is given by the milestone index. Within a
+  // superblock of 2^24 positions the low 24 bits of the rank of a character
+  // wrap around at most once, so milestones[(s << 8) + c] holds the high
+  // bits of the ranks of c at the beginning of superblock s in its highest
+  // 7 bits, and the offset of the wrap (or kNoWrap) in the rest.
+  std::vector<uint32> milestones(((bwt_size >> kSuperblockBits) + 1) << 8);
 
   // count[] serves two purposes:
   // 1. When the scan of the BWT reaches position i,
@@ -76,42 +147,103 @@ void FastInverseBWTransform::doTransform(
   bwt_rank_low24[eob_position] = 0;
   count[0] = 1;
   // count other characters
-  for (uint32 position = 0; position < bwt_size; ++position) {
-    if (position != eob_position) {
-      uint32 ch = static_cast<byte>(bwt[position]);
-      uint32 rank = count[ch + 1];
-      uint32 rank_low24 = rank & 0x00FFFFFF;
-      //uint32 rank_hi8 = rank >> 24;
-      bwt_rank_low24[position] = (ch << 24) + rank_low24;
-      if (0 == rank_low24) {
-        rank_milestone_buffer[ch].push_back(position);
+  for (uint32 begin = 0; begin < bwt_size; begin += kNoWrap) {
+    uint32 end = std::min(bwt_size - begin, kNoWrap) + begin;
+    uint32 *milestone = &milestones[(begin >> kSuperblockBits) << 8];
+    for (int ch = 0; ch < 256; ++ch) {
+      milestone[ch] = ((count[ch + 1] >> 24) << 25) | kNoWrap;
+    }
+    for (uint32 position = begin; position < end; ++position) {
+      if (position != eob_position) {
+        uint32 ch = static_cast<byte>(bwt[position]);
+        uint32 rank = count[ch + 1]++;
+        uint32 rank_low24 = rank & 0x00FFFFFF;
+        bwt_rank_low24[position] = (ch << 24) + rank_low24;
+        if (0 == rank_low24 && (rank >> 24) != (milestone[ch] >> 25)) {
+          milestone[ch] = (milestone[ch] & ~kOffsetMask) |
+              (position & kSuperblockMask);
+        }
       }
-      ++count[ch + 1];
     }
   }
   std::partial_sum(count.begin(), count.end(), count.begin());
   assert(count[256] == bwt_size);
 
-  for (int ch = 0; ch < 256; ++ch) {
-    rank_milestone_buffer[ch].push_back(bwt_size);
+  // The output is restored in independent blocks like in MTL-SA: walk
+  // starting from LFpowers[k] gives the output from position
+  // k*block_size - 1 onwards. The first block starts from LF[eob_position],
+  // which is 0. The walks are interleaved, so that the cache misses of the
+  // different blocks overlap.
+  uint32 starting_positions = LFpowers.size();
+  uint32 block_size = bwt_size / starting_positions;
+  if (block_size <= 1) {
+    starting_positions = 1;
+    block_size = bwt_size;
+  }
+  std::vector<uint32> positions(LFpowers.begin(),
+                                LFpowers.begin() + starting_positions);
+  std::vector<byte*> dest(starting_positions);
+  positions[0] = 0;
+  dest[0] = bwt;
+  for (uint32 k = 1; k < starting_positions; ++k) {
+    dest[k] = bwt + k*block_size - 1;
   }
+  const uint32 *rank_ptr = bwt_rank_low24.get();
+  const uint32 *milestone_ptr = &milestones[0];
+  const uint32 *count_ptr = &count[0];
 
-  uint32 index = 0;
+  // The first block is one shorter than the others, and the last one
+  // continues to the end of the output.
+  for (uint32 step = 1; step < block_size; ++step) {
+    for (uint32 k = 0; k < starting_positions; ++k) {
+      positions[k] = inverseStep(rank_ptr, milestone_ptr, count_ptr,
+                                 positions[k], dest[k]++);
+    }
+  }
+  for (uint32 k = 1; k < starting_positions; ++k) {
+    positions[k] = inverseStep(rank_ptr, milestone_ptr, count_ptr,
+                               positions[k], dest[k]++);
+  }
+  uint32 last = starting_positions - 1;
+  while (dest[last] < bwt + bwt_size - 1) {
+    positions[last] = inverseStep(rank_ptr, milestone_ptr, count_ptr,
+                                  positions[last], dest[last]++);
+  }
+}
+
+uint64 WideInverseBWTransform::maxSizeInBytes(uint64 block_size) const {
+  return (block_size + 1 + 257)*sizeof(uint64);
+}
+
+void WideInverseBWTransform::doTransform(
+    byte* bwt, uint64 bwt_size, const std::vector<uint64>& LFpowers)
+{
+  PROFILE("WideInverseBWTransform::doTransform");
+  static const uint64 kRankMask = (static_cast<uint64>(1) << 56) - 1;
+  uint64 eob_position = LFpowers[0];
+  LargeArray<uint64> bwt_rank(bwt_size);
+
+  // See FastInverseBWTransform::doTransform for the meaning of count.
+  std::vector<uint64> count(257, 0);
+  bwt_rank[eob_position] = 0;
+  count[0] = 1;
+  for (uint64 position = 0; position < bwt_size; ++position) {
+    if (position != eob_position) {
+      uint64 ch = bwt[position];
+      bwt_rank[position] = (ch << 56) | count[ch + 1]++;
+    }
+  }
+  std::partial_sum(count.begin(), count.end(), count.begin());
+  assert(count[256] == bwt_size);
 
-  uint32 position = 0;
+  uint64 index = 0;
+  uint64 position = 0;
   while (position != eob_position) {
-    uint32 bwt_and_rank = bwt_rank_low24[position];
-    uint32 ch = bwt_and_rank >> 24;
+    uint64 bwt_and_rank = bwt_rank[position];
+    byte ch = bwt_and_rank >> 56;
     bwt[index++] = ch;
-    uint32 rank_low24 = bwt_and_rank & 0x00FFFFFF;
-    uint32 rank_hi8 = 0;
-    while (rank_milestone_buffer[ch][rank_hi8 + 1] <= position) ++rank_hi8;
-    position = count[ch] + (rank_hi8 << 24) + rank_low24;
+    position = count[ch] + (bwt_and_rank & kRankMask);
   }
-  // If the BWT or the EOB position contain errors (or are garbage),
-  // it is likely that the cycle ends prematurely.
-  // In this case, we return false.
-  //assert(index == bwt_size);
 }
 
 } //namespace bwtc
@@ -27,6 +27,7 @@
 #ifndef BWTC_INVERSE_BWT_HPP_
 #define BWTC_INVERSE_BWT_HPP_
 
+#include <limits>
 #include <vector>
 
 #include "../globaldefs.hpp"
@@ -45,10 +46,14 @@ namespace bwtc {
 class InverseBWTransform {
  public:
   virtual ~InverseBWTransform() {}
-  virtual uint64 maxBlockSize(uint64 memory_budget) const = 0;
+  /**Upper bound for the memory used by the inverse transform of a block of
+   * block_size bytes, excluding the block itself. */
+  virtual uint64 maxSizeInBytes(uint64 block_size) const = 0;
+  /**Largest block whose inverse transform fits into memory_budget bytes. */
+  virtual uint64 maxBlockSize(uint64 memory_budget) const;
 
-  virtual void doTransform(byte *bwt, uint32 n,
-                           const std::vector<uint32>& LFpow) = 0;
+  virtual void doTransform(byte *bwt, uint64 n,
+                           const std::vector<uint64>& LFpow) = 0;
 
   void doTransform(BWTBlock& block);
 
@@ -58,6 +63,12 @@ class InverseBWTransform {
  * This is the algorithm mergeTL in Sewards' paper with some additional
  * heuristics to be able to handle very large blocks.
  *
+ * Takes 4 bytes per position: the character and the lowest 24 bits of its
+ * rank. The rest of the rank comes from a milestone index of 256 entries
+ * per 2^24 positions. The output is restored from all the starting points
+ * at once like in MtlSaInverseBWTransform, which makes it a slower but
+ * smaller alternative to it.
+ *
  * For original implementation see 
  * @see http://code.google.com/p/dcs-bwt-compressor/ 
  */
@@ -65,16 +76,42 @@ class FastInverseBWTransform : public InverseBWTransform {
  public:
   FastInverseBWTransform() {}
   virtual ~FastInverseBWTransform() {}
-  virtual uint64 maxBlockSize(uint64 memory_budget) const;
+  virtual uint64 maxSizeInBytes(uint64 block_size) const;
   virtual void doTransform(byte* source_bwt,
-                           uint32 bwt_size,
-                           const std::vector<uint32>& LFpowers);
- private:
-  static const int64 kMemoryOverhead = 1 << 20;
+                           uint64 bwt_size,
+                           const std::vector<uint64>& LFpowers);
 };
 
-/* For example memory budget would be a good parameter.. */
-InverseBWTransform* giveInverseTransformer();
+/**
+ * Inverse transform for the blocks larger than kMaxSmallBlockSize. Each
+ * position of the BWT is stored into a 64-bit entry holding the character
+ * in the highest 8 bits and its rank in the rest, so there is no need for
+ * the rank milestones of FastInverseBWTransform. Takes 8 bytes per
+ * position and uses only the first starting point.
+ */
+class WideInverseBWTransform : public InverseBWTransform {
+ public:
+  WideInverseBWTransform() {}
+  virtual ~WideInverseBWTransform() {}
+  virtual uint64 maxSizeInBytes(uint64 block_size) const;
+  virtual void doTransform(byte* source_bwt,
+                           uint64 bwt_size,
+                           const std::vector<uint64>& LFpowers);
+};
+
+/**Gives the inverse transform for the blocks of block_size bytes. The
+ * fastest one is MtlSaInverseBWTransform using given number of threads. If
+ * its footprint doesn't fit into memory_budget bytes, it is given with a
+ * single thread or replaced with FastInverseBWTransform, which uses less
+ * memory for the large blocks. If none of them fits, the one using least
+ * memory is given.
+ *
+ * @param memory_budget Memory available for the transform excluding the
+ *                      block itself.
+ */
+InverseBWTransform* giveInverseTransformer(
+    uint32 threads = 1, uint64 block_size = 0,
+    uint64 memory_budget = std::numeric_limits<uint64>::max());
 
 } //namespace bwtc
 #endif
@@ -0,0 +1,159 @@
+/**
+ * @file LargeArray.cpp
+ *
+ * @section LICENSE
+ *
+ * This file is part of bwtc.
+ *
+ * bwtc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bwtc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bwtc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Implementation of the allocation of the large arrays on huge pages.
+ */
+
+#include "LargeArray.hpp"
+#include "../globaldefs.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace bwtc {
+
+namespace {
+
+uint64 normalPageSize() {
+  long size = sysconf(_SC_PAGESIZE);
+  return (size > 0) ? size : 4096;
+}
+
+/* Size of the explicitly reserved huge pages given by MAP_HUGETLB, as told
+ * by /proc/meminfo. */
+uint64 readHugetlbPageSize() {
+  std::ifstream meminfo("/proc/meminfo");
+  std::string key;
+  uint64 kilobytes;
+  while(meminfo >> key) {
+    if(key == "Hugepagesize:" && meminfo >> kilobytes) return kilobytes << 10;
+    meminfo.ignore(256, '\n');
+  }
+  return 2 << 20;
+}
+
+uint64 hugetlbPageSize() {
+  static const uint64 size = readHugetlbPageSize();
+  return size;
+}
+
+/* Size of the transparent huge pages. It need not be the same as the size
+ * of the reserved ones, which may be for example 1 GB. */
+uint64 readTransparentHugePageSize() {
+  std::ifstream file("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+  uint64 bytes;
+  if(file >> bytes && bytes > 0) return bytes;
+  return 2 << 20;
+}
+
+uint64 transparentHugePageSize() {
+  static const uint64 size = readTransparentHugePageSize();
+  return size;
+}
+
+/* Arrays smaller than this are allocated with malloc. */
+uint64 smallestHugePage() {
+  return std::min(hugetlbPageSize(), transparentHugePageSize());
+}
+
+/* Transparent huge pages are used for the areas given to madvise, unless
+ * they are disabled altogether. */
+bool transparentHugePages() {
+  std::ifstream enabled("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string setting;
+  while(enabled >> setting) {
+    if(setting == "[never]") return false;
+  }
+  return enabled.eof();
+}
+
+uint64 roundUp(uint64 bytes, uint64 pageSize) {
+  return (bytes + pageSize - 1)/pageSize*pageSize;
+}
+
+} //namespace
+
+void* allocateLarge(uint64 bytes, uint64* pageSize) {
+  if(bytes < smallestHugePage()) {
+    *pageSize = normalPageSize();
+    void* data = std::malloc(bytes > 0 ? bytes : 1);
+    if(!data) throw std::bad_alloc();
+    return data;
+  }
+  void* data = MAP_FAILED;
+  *pageSize = normalPageSize();
+#ifdef MAP_HUGETLB
+  uint64 hugetlbPage = hugetlbPageSize();
+  if(bytes >= hugetlbPage) {
+    data = mmap(0, roundUp(bytes, hugetlbPage), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(data != MAP_FAILED) *pageSize = hugetlbPage;
+  }
+#endif
+  if(data == MAP_FAILED) {
+    /* Transparent huge pages need an aligned area, so the mapping is made
+     * one huge page longer and trimmed. */
+    uint64 hugePage = transparentHugePageSize();
+    uint64 length = roundUp(bytes, hugePage);
+    byte* area = static_cast<byte*>(
+        mmap(0, length + hugePage, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if(area == MAP_FAILED) throw std::bad_alloc();
+    uint64 head = (hugePage - reinterpret_cast<uint64>(area) % hugePage) %
+        hugePage;
+    if(head > 0) munmap(area, head);
+    munmap(area + head + length, hugePage - head);
+    data = area + head;
+#ifdef MADV_HUGEPAGE
+    if(madvise(data, length, MADV_HUGEPAGE) == 0 && transparentHugePages()) {
+      *pageSize = hugePage;
+    }
+#endif
+  }
+  if(verbosity > 1) {
+    std::clog << "Using " << (*pageSize >> 10) << " kB pages for "
+              << bytes << " bytes." << std::endl;
+  }
+  return data;
+}
+
+/* A mapping of reserved huge pages has their page size. Other mappings were
+ * rounded up to the size of the transparent huge pages, which gives the same
+ * length when the two sizes are equal. */
+void freeLarge(void* data, uint64 bytes, uint64 pageSize) {
+  if(bytes < smallestHugePage()) {
+    std::free(data);
+  } else if(pageSize == hugetlbPageSize()) {
+    munmap(data, roundUp(bytes, pageSize));
+  } else {
+    munmap(data, roundUp(bytes, transparentHugePageSize()));
+  }
+}
+
+} //namespace bwtc
@@ -0,0 +1,78 @@
+/**
+ * @file LargeArray.hpp
+ *
+ * @section LICENSE
+ *
+ * This file is part of bwtc.
+ *
+ * bwtc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bwtc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bwtc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Allocation of the large arrays of the transforms on huge pages.
+ */
+
+#ifndef BWTC_LARGE_ARRAY_HPP_
+#define BWTC_LARGE_ARRAY_HPP_
+
+#include "../globaldefs.hpp"
+
+namespace bwtc {
+
+/**Allocates memory for a large array which is accessed almost randomly,
+ * like the suffix arrays and the arrays of the inverse transforms. With the
+ * blocks of hundreds of megabytes most of these accesses miss TLB, so the
+ * arrays of at least one huge page are placed on huge pages when possible:
+ * first explicitly reserved ones (MAP_HUGETLB), then transparent huge pages
+ * (MADV_HUGEPAGE). Otherwise normal pages are used. The memory is not
+ * initialized.
+ *
+ * @param bytes Size of the array.
+ * @param pageSize Set to the size of the pages backing the array.
+ * @throws std::bad_alloc if the memory can't be allocated.
+ */
+void* allocateLarge(uint64 bytes, uint64* pageSize);
+
+/**Frees the memory given by allocateLarge for the array of given size and
+ * the page size reported by allocateLarge. */
+void freeLarge(void* data, uint64 bytes, uint64 pageSize);
+
+/**Array of size elements allocated with allocateLarge. */
+template <typename T>
+class LargeArray {
+ public:
+  explicit LargeArray(uint64 size)
+      : m_size(size), m_pageSize(0),
+        m_data(static_cast<T*>(allocateLarge(size*sizeof(T), &m_pageSize))) {}
+  ~LargeArray() { freeLarge(m_data, m_size*sizeof(T), m_pageSize); }
+
+  T* get() { return m_data; }
+  const T* get() const { return m_data; }
+  T& operator[](uint64 i) { return m_data[i]; }
+  const T& operator[](uint64 i) const { return m_data[i]; }
+  uint64 size() const { return m_size; }
+  uint64 pageSize() const { return m_pageSize; }
+
+ private:
+  uint64 m_size;
+  uint64 m_pageSize;
+  T* m_data;
+
+  LargeArray(const LargeArray&);
+  LargeArray& operator=(const LargeArray&);
+};
+
+} //namespace bwtc
+
+#endif
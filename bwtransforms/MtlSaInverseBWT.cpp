@@ -25,17 +25,30 @@
  * Implementation of the MTL-SA algorithm for inverting BWT.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <numeric>  // For partial_sum.
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 #include "../globaldefs.hpp"
+#include "LargeArray.hpp"
 #include "MtlSaInverseBWT.hpp"
 #include "../Profiling.hpp"
 
 namespace bwtc {
 
-uint64 MtlSaInverseBWTransform::maxBlockSize(uint64 memory_budget) const {
-  return memory_budget / sizeof(uint32);
+/* The data array of doTransform and the tables of pairs: one shared and
+ * two for each chunk when computing the data in parallel. */
+uint64 MtlSaInverseBWTransform::maxSizeInBytes(uint64 block_size) const {
+  if (block_size > kMaxSmallBlockSize) {
+    return WideInverseBWTransform().maxSizeInBytes(block_size);
+  }
+  uint64 pairTables = (m_threads > 1) ? 2*m_threads + 1 : 1;
+  return 3*((block_size + 2)/2)*sizeof(uint32)
+      + pairTables*(256*256 + 1)*sizeof(uint32);
 }
 
 void computeData(const byte *bwt, uint64 bwt_size, uint32 *data,
@@ -243,54 +256,216 @@ void computeData(const byte *bwt, uint64 bwt_size, uint32 *data,
   }
 }
 
-void MtlSaInverseBWTransform::doTransform(byte* bwt, uint32 bwt_size,
-    const std::vector<uint32> &LFpowers) {
-  PROFILE("MtlSaInverseBWTransform::doTransform");
-  assert(bwt_size >= 2);
-  assert(LFpowers.size() > 0);
-  uint32 eob_position = LFpowers[0];
+namespace {
 
-  // We use 'data' to store:
-  //   a) LF^2[i] (4 bytes),
-  //   b) a pair (bwt[LF[i]], bwt[i]) (2 bytes)
-  // for each position i = 0, .., bwt_size - 1. In total the array takes roughly
-  // 6 * bwt_size bytes. Having this array enables restoring the original string
-  // two characters at a time.
-  // Information a) and b) for position i is always accessed together. To reduce
-  // the number of cache misses the following layout is used:
-  //
-  //   layout  | - - - - | - - | - - | - - - - | - - - - | - - | - - | - - - -|
-  //   bytes        4       2     2       4         4       2     2       4
-  //   meaning   LF^2[0]   P[0]  P[1]  LF^2[1]   LF^2[2]   P[2]  P[3]  LF^2[3]
-  //
-  // Where P[i] is a pair (bwt[LF[i]], bwt[i]).
-  uint32 *data = new uint32[3 * ((bwt_size + 1) / 2)];
-  computeData(bwt, bwt_size, data, eob_position);
+// Below smaller blocks computeData is not worth splitting between threads.
+const uint32 kMinParallelBlockSize = 1 << 16;
 
-  uint32 *data_ptr = &data[0];
-  byte *result_ptr = bwt;
-  uint32 starting_positions = LFpowers.size();
-  uint32 block_size = bwt_size / starting_positions;
-  uint32 to_restore = bwt_size - 1;
+// Positions of the pair and LF^2 of the given position in the layout used by
+// computeData (see MtlSaInverseBWTransform::doTransform).
+inline uint16 *pairSlot(uint32 *data, uint32 position) {
+  return (uint16 *)(data + 3 * (position / 2) + 1) + (position & 1);
+}
 
-  // Stores the set of current LF powers (one per block).
-  uint32 positions[starting_positions];
-  std::copy(LFpowers.begin(), LFpowers.end(), positions);
+inline uint32 *lf2Slot(uint32 *data, uint32 position) {
+  return data + 3 * (position / 2) + ((position & 1) << 1);
+}
 
-  // If the block size is small, don't deploy parallel inversion.
-  if (block_size <= 1) {
-    starting_positions = 1;
-    block_size = bwt_size;
+// Chunk of BWT handled by single thread in computeDataInParallel.
+struct DataChunk {
+  uint32 begin, end;
+  // Character frequencies of the chunk, later the ranks at the beginning of
+  // the chunk.
+  std::vector<uint32> rank;
+  // Frequencies of (first column, last column) -pairs in the chunk.
+  std::vector<uint32> pairs_count;
+  // Frequencies of the stored pairs in the chunk, later the positions
+  // where LF^2 of the first occurrence of each pair in the chunk points to.
+  std::vector<uint32> pairs_next;
+  // Position whose LF is the EOB position, if it is in this chunk.
+  uint32 second_eob_pair;
+  bool has_second_eob_pair;
+};
+
+void countChunk(const byte *bwt, uint32 eob_position, DataChunk *chunk) {
+  chunk->rank.assign(256, 0);
+  uint32 *rank_ptr = &chunk->rank[0];
+  for (uint32 position = chunk->begin; position < chunk->end; ++position) {
+    if (position != eob_position) ++rank_ptr[bwt[position]];
+  }
+}
+
+// Corresponds to the scan over BWT in computeData. Position 0 is handled as
+// any other position except that it isn't counted to the pairs_count.
+void scanChunk(const byte *bwt, uint32 eob_position, const uint32 *count_ptr,
+    bool little_endian, uint32 *data, DataChunk *chunk) {
+  chunk->pairs_count.assign(256 * 256 + 1, 0);
+  chunk->pairs_next.assign(256 * 256, 0);
+  chunk->has_second_eob_pair = false;
+  uint32 *rank_ptr = &chunk->rank[0];
+  uint32 *pairs_count_ptr = &chunk->pairs_count[0];
+  uint32 *pairs_freq_ptr = &chunk->pairs_next[0];
+
+  int32 first_column_ch = 0;
+  while (count_ptr[first_column_ch + 1] <= chunk->begin) {
+    ++first_column_ch;
+  }
+  for (uint32 position = chunk->begin; position < chunk->end; ++position) {
+    if (position == eob_position) {
+      *pairSlot(data, position) = little_endian ? (bwt[0] << 8) : bwt[0];
+      continue;
+    }
+    uint32 bwt_current = bwt[position];
+    uint32 LF_current = rank_ptr[bwt_current];
+    uint32 bwt_previous = bwt[LF_current];
+    uint16 pair = little_endian ? bwt_current + (bwt_previous << 8)
+                                : (bwt_current << 8) + bwt_previous;
+    *pairSlot(data, position) = pair;
+    ++pairs_freq_ptr[pair];
+    ++rank_ptr[bwt_current];
+    if (position == 0) continue;
+    if (LF_current == eob_position) {
+      chunk->second_eob_pair = position;
+      chunk->has_second_eob_pair = true;
+    }
+    while (count_ptr[first_column_ch + 1] <= position) {
+      ++first_column_ch;
+    }
+    ++pairs_count_ptr[(first_column_ch << 8) + bwt_current + 1];
+  }
+}
+
+// Corresponds to the last loop of computeData.
+void computeChunkLF2(uint32 *data, uint32 first_eob_pair,
+    uint32 second_eob_pair, uint32 LF_0, DataChunk *chunk) {
+  uint32 *pairs_next_ptr = &chunk->pairs_next[0];
+  for (uint32 position = chunk->begin; position < chunk->end; ++position) {
+    if (position == first_eob_pair) {
+      *lf2Slot(data, position) = LF_0;
+    } else if (position == second_eob_pair) {
+      *lf2Slot(data, position) = 0;
+    } else {
+      *lf2Slot(data, position) = pairs_next_ptr[*pairSlot(data, position)]++;
+    }
+  }
+}
+
+// Computes the same as computeData but splits the BWT into chunks which are
+// processed concurrently. The ranks and pair counts at the beginning of each
+// chunk are found by computing prefix sums over the tables of the chunks.
+void computeDataInParallel(const byte *bwt, uint32 bwt_size, uint32 *data,
+    uint32 eob_position, uint32 threads) {
+  uint16 value = 1;
+  bool little_endian = ((unsigned char *)&value)[0];
+
+  // Chunk boundaries are even, so that the pairs of a position and its
+  // neighbour are in the same chunk as in the layout of data.
+  std::vector<DataChunk> chunks(threads);
+  uint32 chunk_size = ((bwt_size / threads) + 1) & ~1;
+  for (uint32 t = 0; t < threads; ++t) {
+    chunks[t].begin = std::min((uint64)t * chunk_size, (uint64)bwt_size);
+    chunks[t].end = std::min((uint64)(t + 1) * chunk_size, (uint64)bwt_size);
+  }
+  chunks.back().end = bwt_size;
+
+  boost::thread_group counters;
+  for (uint32 t = 0; t < threads; ++t) {
+    counters.create_thread(boost::bind(&countChunk, bwt, eob_position,
+                                       &chunks[t]));
+  }
+  counters.join_all();
+
+  std::vector<uint32> count(256 + 1, 0);
+  count[0] = 1;
+  for (uint32 t = 0; t < threads; ++t) {
+    for (uint32 ch = 0; ch < 256; ++ch) count[ch + 1] += chunks[t].rank[ch];
+  }
+  std::partial_sum(count.begin(), count.end(), count.begin());
+  assert(count[256] == bwt_size);
+
+  for (uint32 ch = 0; ch < 256; ++ch) {
+    uint32 rank = count[ch];
+    for (uint32 t = 0; t < threads; ++t) {
+      uint32 chunk_count = chunks[t].rank[ch];
+      chunks[t].rank[ch] = rank;
+      rank += chunk_count;
+    }
+  }
+  uint32 LF_0 = count[bwt[0]];
+
+  boost::thread_group scanners;
+  for (uint32 t = 0; t < threads; ++t) {
+    scanners.create_thread(boost::bind(&scanChunk, bwt, eob_position,
+        &count[0], little_endian, data, &chunks[t]));
+  }
+  scanners.join_all();
+
+  std::vector<uint32> pairs_count(256 * 256 + 1, 0);
+  uint32 first_eob_pair = eob_position;
+  uint32 second_eob_pair = 0;
+  for (uint32 t = 0; t < threads; ++t) {
+    for (uint32 i = 0; i < pairs_count.size(); ++i) {
+      pairs_count[i] += chunks[t].pairs_count[i];
+    }
+    if (chunks[t].has_second_eob_pair) {
+      second_eob_pair = chunks[t].second_eob_pair;
+    }
   }
+  if (little_endian) {
+    for (uint32 low = 0; low < 256; ++low) {
+      for (uint32 high = low + 1; high < 256; ++high) {
+        std::swap(pairs_count[(low << 8) + high + 1],
+                  pairs_count[(high << 8) + low + 1]);
+      }
+    }
+  }
+  ++pairs_count[0];
+  if (little_endian) {
+    ++pairs_count[bwt[0] << 8];
+  } else {
+    ++pairs_count[(255 << 8) + bwt[0]];
+  }
+  std::partial_sum(pairs_count.begin(), pairs_count.end(), pairs_count.begin());
 
+  // The pair of the second EOB position doesn't take a slot in LF^2.
+  for (uint32 t = 0; t < threads; ++t) {
+    if (chunks[t].begin <= second_eob_pair && second_eob_pair < chunks[t].end) {
+      --chunks[t].pairs_next[*pairSlot(data, second_eob_pair)];
+    }
+  }
+  for (uint32 pair = 0; pair < 256 * 256; ++pair) {
+    uint32 next = pairs_count[pair];
+    for (uint32 t = 0; t < threads; ++t) {
+      uint32 chunk_count = chunks[t].pairs_next[pair];
+      chunks[t].pairs_next[pair] = next;
+      next += chunk_count;
+    }
+  }
+
+  boost::thread_group lf2_computers;
+  for (uint32 t = 0; t < threads; ++t) {
+    lf2_computers.create_thread(boost::bind(&computeChunkLF2, data,
+        first_eob_pair, second_eob_pair, LF_0, &chunks[t]));
+  }
+  lf2_computers.join_all();
+}
+
+/* Restores the blocks [first_block, last_block) of the output. The blocks
+ * are independent of each other, so different ranges of blocks can be
+ * restored concurrently. The thread handling the last block restores also
+ * the remaining characters at the end of the output. */
+void restoreBlocks(const uint32 *data_ptr, byte *result_ptr, uint32 *positions,
+    uint32 first_block, uint32 last_block, uint32 starting_positions,
+    uint32 block_size, uint32 to_restore) {
   // Stores pointers to positions in text that are about to be restored.
-  uint16 *dest_ptr[starting_positions];
-  for (uint32 i = 0; i < starting_positions; ++i) {
-    dest_ptr[i] = (uint16 *)(result_ptr + i * block_size - 1);
+  std::vector<uint16 *> dest(last_block - first_block);
+  uint16 **dest_ptr = &dest[0];
+  for (uint32 i = first_block; i < last_block; ++i) {
+    dest_ptr[i - first_block] = (uint16 *)(result_ptr + i * block_size - 1);
   }
 
   // Restore the first pair from each block.
-  for (uint32 block_id = 0; block_id < starting_positions; ++block_id) {
+  for (uint32 block_id = first_block; block_id < last_block; ++block_id) {
     uint32 position = positions[block_id];
     uint32 base = 3 * (position / 2);
     uint32 offset = position & 1;
@@ -299,25 +474,25 @@ void MtlSaInverseBWTransform::doTransform(byte* bwt, uint32 bwt_size,
     positions[block_id] = next_position;
     if (block_id == 0) {
       // Skip the EOB symbol.
-      ++dest_ptr[block_id];
+      ++dest_ptr[block_id - first_block];
       result_ptr[0] = ((unsigned char *)&char_pair)[1];
     } else { 
       // Not the first pair, decode as normal.
-      *dest_ptr[block_id]++ = char_pair;
+      *dest_ptr[block_id - first_block]++ = char_pair;
     }
   }
 
   // Restore the main part of each block, two characters at a time,
   // simultaneously from multiple starting positions.
   for (uint32 filled = 1; filled < block_size / 2; ++filled) {
-    for (uint32 block_id = 0; block_id < starting_positions; ++block_id) {
+    for (uint32 block_id = first_block; block_id < last_block; ++block_id) {
       uint32 position = positions[block_id];
       uint32 base = 3 * (position / 2);
       uint32 offset = position & 1;
       uint32 next_position = data_ptr[base + (offset << 1)];
       uint16 char_pair = ((uint16 *)(data_ptr + base + 1))[offset];
       positions[block_id] = next_position;
-      *dest_ptr[block_id]++ = char_pair;
+      *dest_ptr[block_id - first_block]++ = char_pair;
     }
   }
 
@@ -325,7 +500,9 @@ void MtlSaInverseBWTransform::doTransform(byte* bwt, uint32 bwt_size,
   // block. This loop takes case of that. The last block is handled separately
   // because it might contain more than one remaining character.
   if (block_size & 1) {
-    for (uint32 block_id = 0; block_id + 1 < starting_positions; ++block_id) {
+    for (uint32 block_id = first_block;
+         block_id < last_block && block_id + 1 < starting_positions;
+         ++block_id) {
       uint32 position = positions[block_id];
       uint32 base = 3 * (position / 2);
       uint32 offset = position & 1;
@@ -335,6 +512,8 @@ void MtlSaInverseBWTransform::doTransform(byte* bwt, uint32 bwt_size,
     }
   }
 
+  if (last_block != starting_positions) return;
+
   // Restore the remaining characters from the last (longest) block,
   // possibly except the last character, if the last block has odd length.
   uint32 index = (starting_positions - 1) * block_size - 1 + 2 * (block_size / 2);
@@ -345,7 +524,7 @@ void MtlSaInverseBWTransform::doTransform(byte* bwt, uint32 bwt_size,
     uint32 next_position = data_ptr[base + (offset << 1)];
     uint16 char_pair = ((uint16 *)(data_ptr + base + 1))[offset];
     positions[starting_positions - 1] = next_position;
-    *dest_ptr[starting_positions - 1]++ = char_pair;
+    *dest_ptr[last_block - 1 - first_block]++ = char_pair;
     index += 2;
   }
 
@@ -357,9 +536,75 @@ void MtlSaInverseBWTransform::doTransform(byte* bwt, uint32 bwt_size,
     uint16 char_pair = ((uint16 *)(data_ptr + base + 1))[offset];
     result_ptr[to_restore - 1] = ((unsigned char *)&char_pair)[0];
   }
+}
+
+} //namespace
+
+void MtlSaInverseBWTransform::doTransform(byte* bwt, uint64 bwt_size64,
+    const std::vector<uint64> &LFpowers) {
+  if (bwt_size64 > kMaxSmallBlockSize + 1) {
+    WideInverseBWTransform().doTransform(bwt, bwt_size64, LFpowers);
+    return;
+  }
+  PROFILE("MtlSaInverseBWTransform::doTransform");
+  uint32 bwt_size = bwt_size64;
+  assert(bwt_size >= 2);
+  assert(LFpowers.size() > 0);
+  uint32 eob_position = LFpowers[0];
+
+  // We use 'data' to store:
+  //   a) LF^2[i] (4 bytes),
+  //   b) a pair (bwt[LF[i]], bwt[i]) (2 bytes)
+  // for each position i = 0, .., bwt_size - 1. In total the array takes roughly
+  // 6 * bwt_size bytes. Having this array enables restoring the original string
+  // two characters at a time.
+  // Information a) and b) for position i is always accessed together. To reduce
+  // the number of cache misses the following layout is used:
+  //
+  //   layout  | - - - - | - - | - - | - - - - | - - - - | - - | - - | - - - -|
+  //   bytes        4       2     2       4         4       2     2       4
+  //   meaning   LF^2[0]   P[0]  P[1]  LF^2[1]   LF^2[2]   P[2]  P[3]  LF^2[3]
+  //
+  // Where P[i] is a pair (bwt[LF[i]], bwt[i]).
+  LargeArray<uint32> data_array(3 * ((bwt_size + 1) / 2));
+  uint32 *data = data_array.get();
+  if (m_threads > 1 && bwt_size >= kMinParallelBlockSize) {
+    computeDataInParallel(bwt, bwt_size, data, eob_position,
+                          std::min(m_threads, bwt_size / kMinParallelBlockSize));
+  } else {
+    computeData(bwt, bwt_size, data, eob_position);
+  }
 
-  delete[] data;
+  uint32 starting_positions = LFpowers.size();
+  uint32 block_size = bwt_size / starting_positions;
+  uint32 to_restore = bwt_size - 1;
+
+  // Stores the set of current LF powers (one per block).
+  std::vector<uint32> positions(LFpowers.begin(), LFpowers.end());
+
+  // If the block size is small, don't deploy parallel inversion.
+  if (block_size <= 1) {
+    starting_positions = 1;
+    block_size = bwt_size;
+  }
+
+  // Blocks are divided evenly between the threads. Each thread restores
+  // its blocks using the same interleaved loop as a single thread would.
+  uint32 threads = std::min(m_threads, starting_positions);
+  if (threads <= 1) {
+    restoreBlocks(data, bwt, &positions[0], 0, starting_positions,
+                  starting_positions, block_size, to_restore);
+  } else {
+    boost::thread_group workers;
+    for (uint32 t = 0; t < threads; ++t) {
+      uint32 first_block = (uint64)t * starting_positions / threads;
+      uint32 last_block = (uint64)(t + 1) * starting_positions / threads;
+      workers.create_thread(boost::bind(&restoreBlocks, data, bwt,
+          &positions[0], first_block, last_block, starting_positions,
+          block_size, to_restore));
+    }
+    workers.join_all();
+  }
 }
 
 } //namespace bwtc
-
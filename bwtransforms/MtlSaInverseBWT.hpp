@@ -37,15 +37,26 @@ namespace bwtc {
 /**
  * Inverse Burrows-Wheeler transform using the MTL-SA algorithm described in
  * "Slashing the Time for BWT Inversion" by Karkkainen, Kempa and Puglisi.
+ *
+ * The output is restored in independent blocks, one per starting point.
+ * When given more than one thread, the blocks are divided between the
+ * threads.
+ *
+ * The algorithm uses 32-bit indices, so blocks larger than
+ * kMaxSmallBlockSize are given to WideInverseBWTransform.
  */
 class MtlSaInverseBWTransform : public InverseBWTransform {
  public:
-  MtlSaInverseBWTransform() {}
+  explicit MtlSaInverseBWTransform(uint32 threads = 1)
+      : m_threads(threads) {}
   virtual ~MtlSaInverseBWTransform() {}
-  virtual uint64 maxBlockSize(uint64 memory_budget) const;
+  virtual uint64 maxSizeInBytes(uint64 block_size) const;
   virtual void doTransform(byte* source_bwt,
-                           uint32 bwt_size,
-                           const std::vector<uint32> &LFpowers);
+                           uint64 bwt_size,
+                           const std::vector<uint64> &LFpowers);
+
+ private:
+  uint32 m_threads;
 };
 
 } //namespace bwtc
@@ -29,6 +29,7 @@
 #include <vector>
 
 #include "BWTransform.hpp"
+#include "LargeArray.hpp"
 #include "SA-IS-bwt.hpp"
 #include "sais.hxx"
 #include "../globaldefs.hpp"
@@ -38,19 +39,41 @@ namespace bwtc {
 
 SAISBWTransform::SAISBWTransform() {}
 
+/* Suffix array for the block and the sentinel, and the buckets. On the
+ * first level of recursion the alphabet may have up to half of the length
+ * of the input, and its buckets are allocated separately when they don't
+ * fit into the free part of the suffix array. */
+uint64 SAISBWTransform::maxSizeInBytes(uint64 block_size) const {
+  uint64 entry = (block_size <= kMaxSmallBlockSize) ? sizeof(int)
+                                                    : sizeof(int64);
+  uint64 length = block_size + 1;
+  return (length + length/2 + 2*256)*entry;
+}
+
 void SAISBWTransform::
-doTransform(byte *begin, uint32 length, std::vector<uint32>& LFpowers) const {
+doTransform(byte *begin, uint64 length, std::vector<uint64>& LFpowers) const {
   PROFILE("SAISBWTransform::doTransform");
-  std::vector<int> SA(length);
-  saisxx_bwt(begin, begin, &SA[0], (int)length, LFpowers);
+  if(length <= kMaxSmallBlockSize + 1) {
+    LargeArray<int> SA(length);
+    saisxx_bwt(begin, begin, SA.get(), (int)length, LFpowers);
+  } else {
+    LargeArray<int64> SA(length);
+    saisxx_bwt(begin, begin, SA.get(), (int64)length, LFpowers);
+  }
 }
 
 void SAISBWTransform::
-doTransform(byte *begin, uint32 length, std::vector<uint32>& LFpowers,
-            uint32 *freqs) const {
+doTransform(byte *begin, uint64 length, std::vector<uint64>& LFpowers,
+            uint64 *freqs) const {
   PROFILE("SAISBWTransform::doTransform");
-  std::vector<int> SA(length);
-  saisxx_bwt(begin, begin, &SA[0], (int)length, LFpowers, 256, freqs);
+  if(length <= kMaxSmallBlockSize + 1) {
+    LargeArray<int> SA(length);
+    saisxx_bwt(begin, begin, SA.get(), (int)length, LFpowers, 256, freqs);
+  } else {
+    LargeArray<int64> SA(length);
+    saisxx_bwt(begin, begin, SA.get(), (int64)length, LFpowers,
+               static_cast<int64>(256), freqs);
+  }
 }
 
 } //namespace bwtc
@@ -54,17 +54,13 @@ class SAISBWTransform : public BWTransform {
   SAISBWTransform();
   virtual ~SAISBWTransform() {}
   void
-  doTransform(byte *begin, uint32 length, std::vector<uint32>& LFpowers) const;
+  doTransform(byte *begin, uint64 length, std::vector<uint64>& LFpowers) const;
 
   void
-  doTransform(byte *begin, uint32 length, std::vector<uint32>& LFpowers,
-              uint32* freqs) const;
+  doTransform(byte *begin, uint64 length, std::vector<uint64>& LFpowers,
+              uint64* freqs) const;
 
-  /* The following values aren't correct */
-  virtual uint64 maxSizeInBytes(uint64) const { return 0; }
-  virtual uint64 maxBlockSize(uint64) const { return 0; }
-  virtual uint64 suggestedBlockSize(uint64) const { return 0; }
-  
+  virtual uint64 maxSizeInBytes(uint64 block_size) const;
 };
 } // namespace bwtc
 
@@ -34,12 +34,13 @@
 
 /*- Private Functions -*/
 
-/* Sorts suffixes of type B*. */
+/* Sorts suffixes of type B*. With OpenMP, nthreads threads are used for
+   sorting the B* substrings (0 means the default of OpenMP). */
 static
 saidx_t
 sort_typeBstar(const sauchar_t *T, saidx_t *SA,
                saidx_t *bucket_A, saidx_t *bucket_B,
-               saidx_t n) {
+               saidx_t n, saint_t nthreads) {
   saidx_t *PAb, *ISAb, *buf;
 #ifdef _OPENMP
   saidx_t *curbuf;
@@ -103,10 +104,10 @@ note:
 
     /* Sort the type B* substrings using sssort. */
 #ifdef _OPENMP
-    tmp = omp_get_max_threads();
+    tmp = (0 < nthreads) ? nthreads : omp_get_max_threads();
     buf = SA + m, bufsize = (n - (2 * m)) / tmp;
     c0 = ALPHABET_SIZE - 2, c1 = ALPHABET_SIZE - 1, j = m;
-#pragma omp parallel default(shared) private(curbuf, k, l, d0, d1, tmp)
+#pragma omp parallel num_threads(tmp) default(shared) private(curbuf, k, l, d0, d1, tmp)
     {
       tmp = omp_get_thread_num();
       curbuf = buf + tmp * bufsize;
@@ -132,6 +133,7 @@ note:
       }
     }
 #else
+    (void)nthreads;
     buf = SA + m, bufsize = n - (2 * m);
     for(c0 = ALPHABET_SIZE - 2, j = m; 0 < j; --c0) {
       for(c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1) {
@@ -329,7 +331,7 @@ static
 saidx_t
 construct_BWT(const sauchar_t *T, saidx_t *SA,
               saidx_t *bucket_A, saidx_t *bucket_B,
-              saidx_t n, saidx_t m, unsigned *LFpowers, unsigned nLFpowers) {
+              saidx_t n, saidx_t m, uint64_t *LFpowers, unsigned nLFpowers) {
   saidx_t *i, *j, *k, *orig;
   saidx_t s;
   saint_t c0, c1, c2;
@@ -425,7 +427,7 @@ divsufsort(const sauchar_t *T, saidx_t *SA, saidx_t n) {
 
   /* Suffixsort. */
   if((bucket_A != NULL) && (bucket_B != NULL)) {
-    m = sort_typeBstar(T, SA, bucket_A, bucket_B, n);
+    m = sort_typeBstar(T, SA, bucket_A, bucket_B, n, 0);
     construct_SA(T, SA, bucket_A, bucket_B, n, m);
   } else {
     err = -2;
@@ -439,7 +441,7 @@ divsufsort(const sauchar_t *T, saidx_t *SA, saidx_t n) {
 
 saidx_t
 divbwt(const sauchar_t *T, sauchar_t *U, saidx_t *A, saidx_t n,
-       unsigned *LFpowers, unsigned nLFpowers) {
+       uint64_t *LFpowers, unsigned nLFpowers, saint_t nthreads) {
   saidx_t *B;
   saidx_t *bucket_A, *bucket_B;
   saidx_t m, pidx, i;
@@ -454,7 +456,7 @@ divbwt(const sauchar_t *T, sauchar_t *U, saidx_t *A, saidx_t n,
 
   /* Burrows-Wheeler Transform. */
   if((B != NULL) && (bucket_A != NULL) && (bucket_B != NULL)) {
-    m = sort_typeBstar(T, B, bucket_A, bucket_B, n);
+    m = sort_typeBstar(T, B, bucket_A, bucket_B, n, nthreads);
     if(nLFpowers > 1) {
       pidx = construct_BWT(T, B, bucket_A, bucket_B, n, m, LFpowers, nLFpowers);
       LFpowers[0] = pidx;
@@ -479,7 +481,8 @@ divbwt(const sauchar_t *T, sauchar_t *U, saidx_t *A, saidx_t n,
 
 saidx_t
 divbwtf(const sauchar_t *T, sauchar_t *U, saidx_t *A, saidx_t n,
-        unsigned *LFpowers, unsigned nLFpowers, unsigned freqs[256]) {
+        uint64_t *LFpowers, unsigned nLFpowers, uint64_t freqs[256],
+        saint_t nthreads) {
   saidx_t *B;
   saidx_t *bucket_A, *bucket_B;
   saidx_t m, pidx, i;
@@ -494,7 +497,7 @@ divbwtf(const sauchar_t *T, sauchar_t *U, saidx_t *A, saidx_t n,
 
   /* Burrows-Wheeler Transform. */
   if((B != NULL) && (bucket_A != NULL) && (bucket_B != NULL)) {
-    m = sort_typeBstar(T, B, bucket_A, bucket_B, n);
+    m = sort_typeBstar(T, B, bucket_A, bucket_B, n, nthreads);
     if(nLFpowers > 1) {
       pidx = construct_BWT(T, B, bucket_A, bucket_B, n, m, LFpowers, nLFpowers);
       LFpowers[0] = pidx;
@@ -81,17 +81,20 @@ divsufsort(const sauchar_t *T, saidx_t *SA, saidx_t n);
  * @param U[0..n-1] The output string. (can be T)
  * @param A[0..n-1] The temporary array. (can be NULL)
  * @param n The length of the given string.
+ * @param nthreads The number of threads used when compiled with OpenMP.
+ *                 (0 means the default of OpenMP, ignored without OpenMP)
  * @return The primary index if no error occurred, -1 or -2 otherwise.
  */
 DIVSUFSORT_API
 saidx_t
 divbwt(const sauchar_t *T, sauchar_t *U, saidx_t *A, saidx_t n,
-       unsigned *LFpowers, unsigned nLFpowers);
+       uint64_t *LFpowers, unsigned nLFpowers, saint_t nthreads);
 
 DIVSUFSORT_API
 saidx_t
 divbwtf(const sauchar_t *T, sauchar_t *U, saidx_t *A, saidx_t n,
-        unsigned *LFpowers, unsigned nLFpowers, unsigned *freqs);
+        uint64_t *LFpowers, unsigned nLFpowers, uint64_t *freqs,
+        saint_t nthreads);
 
 /**
  * Returns the version of the divsufsort library.
@@ -0,0 +1,8 @@
+/*
+ * divsufsort64.c for libdivsufsort64
+ *
+ * Compiles divsufsort.c with 64-bit indices. See divsufsort64.h.
+ */
+
+#define BUILD_DIVSUFSORT64
+#include "divsufsort.c"
@@ -73,6 +73,7 @@ extern "C" {
 # endif /* PRIdSAIDX_T */
 # define divsufsort divsufsort64
 # define divbwt divbwt64
+# define divbwtf divbwtf64
 # define divsufsort_version divsufsort64_version
 # define bw_transform bw_transform64
 # define inverse_bw_transform inverse_bw_transform64
@@ -289,10 +289,10 @@ typedef typename std::iterator_traits<string_type>::value_type char_type;
 }
 template<typename string_type, typename sarray_type,
          typename bucketC_type, typename bucketB_type, typename index_type>
-int
+index_type
 computeBWT(string_type T, sarray_type SA, bucketC_type C, bucketB_type B,
            index_type n, index_type k, bool recount,
-           std::vector<uint32>& LFpowers) {
+           std::vector<uint64>& LFpowers) {
 typedef typename std::iterator_traits<string_type>::value_type char_type;
   index_type i, j, pidx = -1;
   char_type c0, c1;
@@ -342,7 +342,7 @@ typedef typename std::iterator_traits<string_type>::value_type char_type;
 
 template<typename string_type, typename sarray_type,
          typename bucketC_type, typename bucketB_type, typename index_type>
-int
+index_type
 computeBWT(string_type T, sarray_type SA, bucketC_type C, bucketB_type B,
            index_type n, index_type k, bool recount) {
 typedef typename std::iterator_traits<string_type>::value_type char_type;
@@ -446,7 +446,7 @@ template<typename string_type, typename sarray_type,
 index_type
 stage3sort(string_type T, sarray_type SA, bucketC_type C, bucketB_type B,
            index_type n, index_type m, index_type k,
-           unsigned flags, bool isbwt, std::vector<uint32>& LFpowers) {
+           unsigned flags, bool isbwt, std::vector<uint64>& LFpowers) {
 typedef typename std::iterator_traits<string_type>::value_type char_type;
   index_type i, j, p, q, pidx = 0;
   char_type c0, c1;
@@ -504,7 +504,7 @@ typedef typename std::iterator_traits<string_type>::value_type char_type;
 /* find the suffix array SA of T[0..n-1] in {0..k}^n
    use a working space (excluding s and SA) of at most 2n+O(1) for a constant alphabet */
 template<typename string_type, typename sarray_type, typename index_type>
-int
+index_type
 suffixsort(string_type T, sarray_type SA,
            index_type fs, index_type n, index_type k,
            bool isbwt) {
@@ -624,10 +624,10 @@ typedef typename std::iterator_traits<string_type>::value_type char_type;
 /* find the suffix array SA of T[0..n-1] in {0..k}^n
    use a working space (excluding s and SA) of at most 2n+O(1) for a constant alphabet */
 template<typename string_type, typename sarray_type, typename index_type>
-int
+index_type
 suffixsort(string_type T, sarray_type SA,
            index_type fs, index_type n, index_type k,
-           bool isbwt, std::vector<uint32>& LFpowers) {
+           bool isbwt, std::vector<uint64>& LFpowers) {
 typedef typename std::iterator_traits<string_type>::value_type char_type;
   sarray_type RA, C, B;
   index_type *Cp, *Bp;
@@ -777,7 +777,7 @@ typedef typename std::iterator_traits<sarray_type>::value_type savalue_type;
 template<typename string_type, typename sarray_type, typename index_type>
 void
 saisxx_bwt(string_type T, string_type U, sarray_type A, index_type n,
-           std::vector<uint32>& LFpowers, index_type k = 256) {
+           std::vector<uint64>& LFpowers, index_type k = 256) {
 typedef typename std::iterator_traits<sarray_type>::value_type savalue_type;
 typedef typename std::iterator_traits<string_type>::value_type char_type;
 index_type i, pidx;
@@ -788,9 +788,11 @@ index_type i, pidx;
   if((n < 0) || (k <= 0)) { LFpowers[0] = -1; }
   if(n <= 1) { if(n == 1) { U[0] = T[0]; } LFpowers[0] = 0; }
   if(LFpowers.size() == 1) {
-    LFpowers[0] = pidx = saisxx_private::suffixsort(T, A, 0, n, k, true);
+    LFpowers[0] = pidx = saisxx_private::suffixsort(
+        T, A, static_cast<index_type>(0), n, k, true);
   } else {
-    pidx = saisxx_private::suffixsort(T, A, 0, n, k, true, LFpowers);
+    pidx = saisxx_private::suffixsort(
+        T, A, static_cast<index_type>(0), n, k, true, LFpowers);
   }
 
   if(0 <= pidx) {
@@ -803,7 +805,7 @@ index_type i, pidx;
 template<typename string_type, typename sarray_type, typename index_type>
 void
 saisxx_bwt(string_type T, string_type U, sarray_type A, index_type n,
-           std::vector<uint32>& LFpowers, index_type k, uint32 *freqs) {
+           std::vector<uint64>& LFpowers, index_type k, uint64 *freqs) {
 typedef typename std::iterator_traits<sarray_type>::value_type savalue_type;
 typedef typename std::iterator_traits<string_type>::value_type char_type;
 index_type i, pidx;
@@ -814,9 +816,11 @@ index_type i, pidx;
   if((n < 0) || (k <= 0)) { LFpowers[0] = -1; }
   if(n <= 1) { if(n == 1) { U[0] = T[0]; } LFpowers[0] = 0; }
   if(LFpowers.size() == 1) {
-    LFpowers[0] = pidx = saisxx_private::suffixsort(T, A, 0, n, k, true);
+    LFpowers[0] = pidx = saisxx_private::suffixsort(
+        T, A, static_cast<index_type>(0), n, k, true);
   } else {
-    pidx = saisxx_private::suffixsort(T, A, 0, n, k, true, LFpowers);
+    pidx = saisxx_private::suffixsort(
+        T, A, static_cast<index_type>(0), n, k, true, LFpowers);
   }
 
   if(0 <= pidx) {
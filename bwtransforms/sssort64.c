@@ -0,0 +1,8 @@
+/*
+ * sssort64.c for libdivsufsort64
+ *
+ * Compiles sssort.c with 64-bit indices. See divsufsort64.h.
+ */
+
+#define BUILD_DIVSUFSORT64
+#include "sssort.c"
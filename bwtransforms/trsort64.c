@@ -0,0 +1,8 @@
+/*
+ * trsort64.c for libdivsufsort64
+ *
+ * Compiles trsort.c with 64-bit indices. See divsufsort64.h.
+ */
+
+#define BUILD_DIVSUFSORT64
+#include "trsort.c"
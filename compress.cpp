@@ -31,8 +31,10 @@
 #include <iostream>
 #include <string>
 #include <iterator>
+#include <algorithm>
 
 #include <boost/program_options.hpp>
+#include <boost/thread.hpp>
 namespace po = boost::program_options;
 
 #include "Compressor.hpp"
@@ -71,7 +73,7 @@ void validateStartingPoints(uint32 sp) {
 /* Notifier function for encoding option choice */
 void validateEncodingOption(char c) {
   if (c == 'H' || c == 'm' || c == 'M' || c == 'u' || c == 'b' || c == 'B'
-      /* || c == <other option> */) return;
+      || c == 'I' || c == 'R' || c == 'P' /* || c == <other option> */) return;
 
   class EncodingExc : public std::exception {
     virtual const char* what() const throw() {
@@ -100,8 +102,8 @@ int main(int argc, char** argv) {
   uint64 mem;
   char encoding, bwtAlgo;
   std::string input_name, output_name, preprocessing;
-  bool stdout, stdin;
-  uint32 startingPoints;
+  bool stdout, stdin, readAhead;
+  uint32 startingPoints, threads;
 
   try {
     po::options_description description(
@@ -115,6 +117,10 @@ int main(int argc, char** argv) {
         ("starts,s", po::value<uint32>(&startingPoints)->default_value(8)->
          notifier(&validateStartingPoints),
          "Starting points for decompression (more means faster decompression).")
+        ("threads,t", po::value<uint32>(&threads)->default_value(1),
+         "Number of threads to use (0 means one per processor core)")
+        ("read-ahead,r", "read and precompress next block while encoding "
+         "the current one (uses smaller blocks)")
         ("verb,v", po::value<int>(&verbosity)->default_value(0),
          "verbosity level")
         ("input-file", po::value<std::string>(&input_name),
@@ -135,11 +141,16 @@ int main(int argc, char** argv) {
          notifier(&validateEncodingOption),
          "entropy encoding scheme, options:\n"
          "  H -- Huffman coding with run-length encoding\n"
+         "  P -- Same as H, but each context block is divided into "
+         "substreams which can be decoded in parallel\n"
+         "  R -- rANS coding with run-length encoding\n"
          "  M -- Remembering 16 previous bits (Wavelet tree)\n"
          "  m -- Remembering 8 previous bits (Wavelet tree)\n"
          "  b -- Finite State Machine with unbiased and equal predictors "
          "in each state (Wavelet tree)\n"
          "  B -- Slightly optimised version of above (Wavelet tree)\n"
+         "  I -- Same as B, but bits are coded with interleaved range "
+         "coders for faster decoding (Wavelet tree)\n"
          "  u -- Simple predictor with 4 states. These are used in "
          "FSM's states (Wavelet tree)")
         ;
@@ -163,6 +174,7 @@ int main(int argc, char** argv) {
 
     stdout = varmap.count("stdout") != 0;
     stdin  = varmap.count("stdin") != 0;
+    readAhead = varmap.count("read-ahead") != 0;
   } /* try-block */
   catch(std::exception& e) {
     std::cerr << "error: " << e.what() << std::endl;
@@ -177,6 +189,10 @@ int main(int argc, char** argv) {
     std::clog << "Maximum memory to use = " << mem <<  "MB" << std::endl;
   }
   if (mem <= 0) mem = 1;
+  if (threads == 0) threads = std::max(boost::thread::hardware_concurrency(), 1U);
+  if (verbosity > 1) {
+    std::clog << "Using " << threads << " thread(s)" << std::endl;
+  }
 
   if (stdout) output_name = "";
   if (stdin)  input_name = "";
@@ -192,7 +208,8 @@ int main(int argc, char** argv) {
   bwtc::Compressor compressor(input_name, output_name, preprocessing,
                               mem*1000000, encoding);
   compressor.initializeBwtAlgorithm(bwtAlgo, startingPoints);
-  size_t compressedBytes = compressor.compress(1);
+  compressor.setReadAhead(readAhead);
+  size_t compressedBytes = compressor.compress(threads);
 
   if(verbosity > 0) {
     std::clog << "Compressed size is " << compressedBytes << std::endl;
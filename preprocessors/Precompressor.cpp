@@ -45,6 +45,17 @@ Precompressor::readBlock(size_t blockSize, InStream* in) const {
   return result;
 }
 
+/* Besides the block, precompression uses the temporary array which is taken
+ * into use when the block has shrunk below 2/3 of its original size (see
+ * precompress) and the tables of PairReplacer. */
+uint64 Precompressor::maxSizeInBytes(uint64 block_size) const {
+  uint64 bytes = block_size + 1;
+  if(m_preprocessingOptions.size() > 0) {
+    bytes += block_size*2/3 + 1 + sizeof(PairReplacer);
+  }
+  return bytes;
+}
+
 #define PREPROCESS(Type, verb, src) \
   Type r(grammar, (verb));\
   r.analyseData((src), length);\
@@ -49,6 +49,10 @@ class Precompressor {
   // precompress in-place)
   void precompress(PrecompressorBlock& block) const;
 
+  /**Upper bound for the memory used by reading and precompressing a block
+   * of block_size bytes, including the block itself. */
+  uint64 maxSizeInBytes(uint64 block_size) const;
+
   const std::string options() const { return m_preprocessingOptions; }
   
  private:
@@ -82,17 +82,18 @@ class FSM : public ProbabilityModel {
   FSM() : m_currentState(N/2), m_states(N) {}
   ~FSM() {}
 
+  /* Calls are qualified so that they are not dispatched virtually. */
   void update(bool bit) {
-    m_states[m_currentState].update(bit);
-    updateState(bit);
+    m_states[m_currentState].BitPredictor::update(bit);
+    FSM::updateState(bit);
   }
 
   Probability probabilityOfOne() const {
-    return m_states[m_currentState].probabilityOfOne();
+    return m_states[m_currentState].BitPredictor::probabilityOfOne();
   }
 
   void resetModel() {
-    for(uint32 i = 0; i < N; ++i) m_states[i].resetModel();
+    for(uint32 i = 0; i < N; ++i) m_states[i].BitPredictor::resetModel();
     m_currentState = N/2;
   }
 
@@ -125,7 +126,7 @@ class FSM6 : public ProbabilityModel {
       case 4: o2.update(bit); break;
       case 5: o3.update(bit); break;
     }
-    updateState(bit);
+    FSM6::updateState(bit);
   }
 
   void updateState(bool bit) {
@@ -182,7 +183,7 @@ class FSM8 : public ProbabilityModel {
       case 6: o3.update(bit); break;
       case 7: o4.update(bit); break;
     }
-    updateState(bit);
+    FSM8::updateState(bit);
   }
 
   void updateState(bool bit) {
@@ -244,7 +245,7 @@ class FSM9 : public ProbabilityModel {
       case 7: o3.update(bit); break;
       case 8: o4.update(bit); break;
     }
-    updateState(bit);
+    FSM9::updateState(bit);
   }
 
   void updateState(bool bit) {
@@ -300,12 +301,12 @@ class LimitedHistoryModel : public ProbabilityModel {
   ~LimitedHistoryModel() {}
 
   void update(bool bit) {
-    m_predictors[m_history].update(bit);
-    updateState(bit);
+    m_predictors[m_history].BitPredictor::update(bit);
+    LimitedHistoryModel::updateState(bit);
   }
   
   Probability probabilityOfOne() const {
-    return m_predictors[m_history].probabilityOfOne();
+    return m_predictors[m_history].BitPredictor::probabilityOfOne();
   }
   
   void updateState(bool bit) {
@@ -0,0 +1,90 @@
+/**
+ * @file Models.hpp
+ *
+ * @section LICENSE
+ *
+ * This file is part of bwtc.
+ *
+ * bwtc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bwtc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bwtc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Concrete types of the probability models given by giveProbabilityModel,
+ * giveModelForIntegerCodes and giveModelForGaps. With these the models can be
+ * used without virtual calls in the inner loops of entropy coders.
+ */
+
+#ifndef BWTC_MODELS_HPP_
+#define BWTC_MODELS_HPP_
+
+#include "../globaldefs.hpp"
+#include "ProbabilityModel.hpp"
+#include "BitPredictors.hpp"
+#include "FSM.hpp"
+
+namespace bwtc {
+
+/* Models for internal nodes of wavelet tree, see giveProbabilityModel. */
+typedef SimpleMarkov<byte> Markov8Model;                      // 'm'
+typedef SimpleMarkov<unsigned short int> Markov16Model;       // 'M'
+typedef EvenIntervalPredictor<4> EvenIntervalModel;           // 'u'
+typedef FSM<6, EvenIntervalPredictor<4> > FSMModel;           // 'b'
+typedef FSM8<UnbiasedPredictor<2, 4, 2400>,
+             UnbiasedPredictor<2, 5, 2300>,
+             UnbiasedPredictor<2, 5, 2200>,
+             UnbiasedPredictor<2, 5, 2100> > FSM8Model;       // 'B'
+
+typedef FSM<3, UnbiasedPredictor<100, 5, kHalfProbability> >
+ModelForIntegerCodes;
+typedef FSM<4, UnbiasedPredictor<2, 5, kHalfProbability> > ModelForGaps;
+
+/**Calls visitor.template visit<Model>(), where Model is the type of the
+ * model giveProbabilityModel(choice) creates.
+ */
+template <typename Visitor>
+void visitProbabilityModel(char choice, Visitor& visitor) {
+  switch(choice) {
+    case 'm': visitor.template visit<Markov8Model>(); break;
+    case 'M': visitor.template visit<Markov16Model>(); break;
+    case 'u': visitor.template visit<EvenIntervalModel>(); break;
+    case 'b': visitor.template visit<FSMModel>(); break;
+    case 'B':
+    default: visitor.template visit<FSM8Model>(); break;
+  }
+}
+
+/**Gives the model of known type to coders through non-virtual calls. The
+ * qualified calls bypass the virtual dispatch, so the compiler is able to
+ * inline the model into the coding loop.
+ */
+template <typename Model>
+class StaticModel {
+ public:
+  explicit StaticModel(ProbabilityModel& model)
+      : m_model(static_cast<Model&>(model)) {}
+
+  Probability probabilityOfOne() const {
+    return m_model.Model::probabilityOfOne();
+  }
+  void update(bool bit) { m_model.Model::update(bit); }
+  void resetModel() { m_model.Model::resetModel(); }
+  void updateState(bool bit) { m_model.Model::updateState(bit); }
+
+ private:
+  Model& m_model;
+};
+
+} // namespace bwtc
+
+#endif
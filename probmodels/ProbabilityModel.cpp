@@ -24,7 +24,6 @@
  * Base class for probability models.
  */
 
-#include <algorithm> // for std::fill
 #include <iostream>
 #include <deque>
 
@@ -33,16 +32,17 @@
 #include "BitPredictors.hpp"
 #include "FSM.hpp"
 #include "DMC.hpp"
+#include "Models.hpp"
 
 namespace bwtc {
 
 ProbabilityModel* giveModelForIntegerCodes() {
   //return new UnbiasedPredictor<100, 5, kHalfProbability>();
-  return new FSM<3, UnbiasedPredictor<100, 5, kHalfProbability> >();
+  return new ModelForIntegerCodes();
 }
 
 ProbabilityModel* giveModelForGaps() {
-  return new FSM<4, UnbiasedPredictor<2, 5, kHalfProbability> >();
+  return new ModelForGaps();
 }
 
 ProbabilityModel* giveProbabilityModel(char choice) {
@@ -50,81 +50,25 @@ ProbabilityModel* giveProbabilityModel(char choice) {
     case 'm':
       if( verbosity > 1)
         std::clog << "Remembering 8 previous bits\n";
-      return new SimpleMarkov<byte>();
+      return new Markov8Model();
     case 'M':
       if( verbosity > 1)
         std::clog << "Remembering 16 previous bits\n";
-      return new SimpleMarkov<unsigned short int>();      
+      return new Markov16Model();
     case 'u':
       if( verbosity > 1)
         std::clog << "Remembering 4 previous bits.\n";
-      return new EvenIntervalPredictor<4>();
+      return new EvenIntervalModel();
     case 'b':
       if( verbosity > 1)
         std::clog << "Using FSM.\n";
-      return new FSM<6, EvenIntervalPredictor<4> >();
+      return new FSMModel();
     case 'B':
     default:
       if( verbosity > 1) 
         std::clog << "Using FSM8.\n";
-      return new FSM8<UnbiasedPredictor<2, 4, 2400>,
-        UnbiasedPredictor<2, 5, 2300>,
-        UnbiasedPredictor<2, 5, 2200 >,
-        UnbiasedPredictor<2, 5, 2100> >();
+      return new FSM8Model();
   }
 }
 
-
-/*************************************************************************
- * SimpleMarkov: An example of how to integrate new probability model    *
- * to program.                                                           *
- *                                                                       * 
- * Simple template-based probability-model which remembers               *
- * 8*sizeof(Integer) previous bits. Consumes huge amount of memory       *
- * 2^(8*sizeof(Integer) bytes) so practically this is  usable  only with *
- * bytes and short integers.                                             *
- *************************************************************************/
-template <typename UnsignedInt>
-SimpleMarkov<UnsignedInt>::SimpleMarkov() :
-    m_prev(static_cast<UnsignedInt>(0)), m_history(0)
-{
-  uint64 size = (static_cast<uint64>(1) << 8*sizeof(UnsignedInt)) - 1;
-  m_history = new char[size];
-  std::fill(m_history, m_history + size, 0);
-}
-
-template <typename UnsignedInt>
-SimpleMarkov<UnsignedInt>::~SimpleMarkov() {
-  delete [] m_history;
-}
-
-template <typename UnsignedInt>
-void SimpleMarkov<UnsignedInt>::update(bool bit) {
-  if (bit) {
-    if (m_history[m_prev] < 2 )
-      ++m_history[m_prev];
-  }
-  else {
-    if(m_history[m_prev] > -2)
-      --m_history[m_prev];
-  }
-  m_prev <<= 1;
-  m_prev |= (bit)? 1 : 0;
-}
-
-template <typename UnsignedInt>
-Probability SimpleMarkov<UnsignedInt>::probabilityOfOne() const {
-  Probability val = kProbabilityScale >> (kLogProbabilityScale/2);
-  if (m_history[m_prev] > 0) return val << 2*m_history[m_prev];
-  else return val >> 2*m_history[m_prev];
-}
-
-template <typename UnsignedInt>
-void SimpleMarkov<UnsignedInt>::resetModel() {
-  /* Seems to work better when not resetting the model for different
-   * contexts. */
-  uint64 size = (static_cast<uint64>(1) << 8*sizeof(UnsignedInt)) - 1;
-  std::fill(m_history, m_history + size, 0);
-}
-
 } //namespace bwtc
@@ -28,6 +28,8 @@
 #ifndef BWTC_PROBABILITY_MODEL_HPP_
 #define BWTC_PROBABILITY_MODEL_HPP_
 
+#include <algorithm> // for std::fill
+
 #include "../globaldefs.hpp" /* Important definitions */
 
 namespace bwtc {
@@ -50,15 +52,56 @@ class ProbabilityModel {
   virtual void updateState(bool) {}
 };
 
-/* Example how to integrate new probability model to program */
+/*************************************************************************
+ * SimpleMarkov: An example of how to integrate new probability model    *
+ * to program.                                                           *
+ *                                                                       *
+ * Simple template-based probability-model which remembers               *
+ * 8*sizeof(Integer) previous bits. Consumes huge amount of memory       *
+ * 2^(8*sizeof(Integer) bytes) so practically this is  usable  only with *
+ * bytes and short integers.                                             *
+ *************************************************************************/
 template <typename UnsignedInt>
 class SimpleMarkov : public ProbabilityModel {
  public:
-  SimpleMarkov();
-  virtual ~SimpleMarkov();
-  virtual void update(bool bit);
-  virtual Probability probabilityOfOne() const;
-  virtual void resetModel();
+  SimpleMarkov() : m_prev(static_cast<UnsignedInt>(0)), m_history(0) {
+    uint64 size = static_cast<uint64>(1) << 8*sizeof(UnsignedInt);
+    m_history = new char[size];
+    std::fill(m_history, m_history + size, 0);
+  }
+
+  virtual ~SimpleMarkov() {
+    delete [] m_history;
+  }
+
+  void update(bool bit) {
+    if (bit) {
+      if (m_history[m_prev] < 2 )
+        ++m_history[m_prev];
+    }
+    else {
+      if(m_history[m_prev] > -2)
+        --m_history[m_prev];
+    }
+    m_prev <<= 1;
+    m_prev |= (bit)? 1 : 0;
+  }
+
+  Probability probabilityOfOne() const {
+    Probability val = kProbabilityScale >> (kLogProbabilityScale/2);
+    if (m_history[m_prev] > 0) return val << 2*m_history[m_prev];
+    /* This used to shift right by a negative amount. The optimized builds,
+     * which wrote the existing files, left the value as it is. */
+    else return val;
+  }
+
+  void resetModel() {
+    /* Seems to work better when not resetting the model for different
+     * contexts. The history of all one bits has always been left out here,
+     * and it is kept that way so that the old files decode. */
+    uint64 size = (static_cast<uint64>(1) << 8*sizeof(UnsignedInt)) - 1;
+    std::fill(m_history, m_history + size, 0);
+  }
 
  private:
   UnsignedInt m_prev;
@@ -30,7 +30,9 @@
 
 #include <boost/test/unit_test.hpp>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <string>
 #include <vector>
 
 #include "../Compressor.hpp"
@@ -58,29 +60,57 @@ void makeRepetitiveData(std::vector<byte>& data, size_t length, int times) {
   }
 }
 
-void test(size_t length, size_t reps, const char* prep, size_t mem,
-          char entropyCoder, char bwtAlgo, size_t startingPoints)
+/**Symbols of geometric distribution over the given number of symbols.
+ * The Huffman codes of such data get long, so that near the end of a code
+ * section the lookup table sees less bits than the longest codes have. */
+void makeSkewedData(std::vector<byte>& data, size_t length, int symbols) {
+  for(size_t i = 0; i < length; ++i) {
+    int s = 0;
+    while(s < symbols - 1 && rand() % 3 != 0) ++s;
+    data.push_back('a' + s);
+  }
+}
+
+/**Text-like data which is the same on every platform. The archives in
+ * test/data were made from 40000 bytes of it by the compressor preceding
+ * kIndependentBlocks, with a memory limit of 30000 bytes, so they have eight
+ * BWT-blocks each. That compressor read one entry past the history of
+ * SimpleMarkov, so the Markov archives were made with the entry being zero
+ * as in the freshly allocated memory. */
+void makeWordData(std::vector<byte>& data, size_t length) {
+  static const char* const words[] = {
+    "the", "wavelet", "tree", "of", "a", "block", "is", "coded", "with",
+    "models", "and", "bits", "\n"};
+  uint32 x = 12345;
+  while(data.size() < length) {
+    x = x*1103515245 + 12345;
+    const char* w = words[(x >> 16) % (sizeof(words)/sizeof(words[0]))];
+    data.insert(data.end(), w, w + std::strlen(w));
+    data.push_back(' ');
+  }
+  data.resize(length);
+}
+
+void roundTrip(std::vector<byte> orig, const char* prep, size_t mem,
+               char entropyCoder, char bwtAlgo, size_t startingPoints,
+               uint32 threads = 1, bool readAhead = false,
+               size_t decompressionMem = 0)
 {
-  srand(time(0));
-  std::vector<byte> orig, comp, decomp;
+  std::vector<byte> comp, decomp;
   TestStream *original = new TestStream(orig),
       *compressed = new TestStream(comp),
       *compr2 = new TestStream(comp),
       *decompressed = new TestStream(decomp);
-  if(reps == 0) {
-    makeRandomData(orig, length);
-  } else {
-    makeRepetitiveData(orig, length/reps, reps);
-  }
 
   {
     Compressor compressor(original, compressed, prep, mem,
                           entropyCoder);
     compressor.initializeBwtAlgorithm(bwtAlgo, startingPoints);
-    compressor.compress(1);
+    compressor.setReadAhead(readAhead);
+    compressor.compress(threads);
     
-    Decompressor decompressor(compr2, decompressed);
-    decompressor.decompress(1);
+    Decompressor decompressor(compr2, decompressed, decompressionMem);
+    decompressor.decompress(threads);
 
     BOOST_CHECK_EQUAL(orig.size(), decomp.size());
     for(size_t i = 0; i < orig.size(); ++i) {
@@ -92,6 +122,64 @@ void test(size_t length, size_t reps, const char* prep, size_t mem,
   }
 }
 
+void test(size_t length, size_t reps, const char* prep, size_t mem,
+          char entropyCoder, char bwtAlgo, size_t startingPoints,
+          uint32 threads = 1, bool readAhead = false,
+          size_t decompressionMem = 0)
+{
+  srand(time(0));
+  std::vector<byte> orig;
+  if(reps == 0) {
+    makeRandomData(orig, length);
+  } else {
+    makeRepetitiveData(orig, length/reps, reps);
+  }
+  roundTrip(orig, prep, mem, entropyCoder, bwtAlgo, startingPoints, threads,
+            readAhead, decompressionMem);
+}
+
+/**Compresses data of skewed distribution with several seeds. */
+void testSkewed(char entropyCoder) {
+  for(unsigned seed = 1; seed <= 40; ++seed) {
+    srand(seed);
+    std::vector<byte> orig;
+    makeSkewedData(orig, 2000 + rand() % 100000, 2 + rand() % 59);
+    roundTrip(orig, "", 10000000, entropyCoder, 'd', 1);
+  }
+}
+
+/**Compresses into a stream which can't be seeked. */
+void testSequentialOutput(size_t length, size_t mem, char entropyCoder,
+                          uint32 threads)
+{
+  std::vector<byte> orig, comp, decomp;
+  makeRepetitiveData(orig, length/4, 4);
+  TestStream *original = new TestStream(orig),
+      *compressed = new TestStream(comp),
+      *decompressed = new TestStream(decomp);
+  SequentialTestStream *sequential = new SequentialTestStream(comp);
+
+  Compressor compressor(original, sequential, "", mem, entropyCoder);
+  compressor.initializeBwtAlgorithm('d', 2);
+  compressor.compress(threads);
+  BOOST_CHECK(!sequential->seeked());
+
+  Decompressor decompressor(compressed, decompressed);
+  decompressor.decompress(1);
+  BOOST_CHECK(orig == decomp);
+}
+
+/**Decompresses an archive written by the earlier versions of the
+ * compressor. */
+void testOlderFile(const std::string& name, uint32 threads) {
+  std::vector<byte> orig, decomp;
+  makeWordData(orig, 40000);
+  Decompressor decompressor(
+      new RawInStream(std::string(TEST_DATA_DIR) + "/" + name),
+      new TestStream(decomp));
+  decompressor.decompress(threads);
+  BOOST_CHECK(orig == decomp);
+}
 
 BOOST_AUTO_TEST_SUITE(WithWaveletCoders)
 
@@ -159,10 +247,46 @@ BOOST_AUTO_TEST_CASE(MultipleStartingPoints) {
     test(10000, 0, "", 100000, 'B', 'd', i);
 }
 
+BOOST_AUTO_TEST_CASE(AutomaticBwtChoice) {
+  test(200000, 0, "", 10000000, 'B', 'a', 1);
+  test(200000, 100, "", 10000000, 'B', 'a', 8);
+  test(200000, 100, "", 1000000, 'B', 'a', 1, 2);
+}
+
+BOOST_AUTO_TEST_CASE(MultipleThreads) {
+  test(100000, 0, "", 100000, 'B', 'd', 1, 2);
+  test(100000, 50, "", 100000, 'B', 's', 8, 4);
+  test(100000, 2, "pp", 1000000, 'B', 'd', 1, 3);
+  test(100000, 50, "ppp", 100000, 'm', 'd', 1, 4);
+}
+
+BOOST_AUTO_TEST_CASE(ReadAhead) {
+  test(100000, 0, "", 100000, 'B', 'd', 1, 1, true);
+  test(100000, 50, "", 10000, 'B', 's', 4, 2, true);
+  test(100000, 2, "pp", 100000, 'B', 'd', 1, 1, true);
+  test(100000, 50, "ppp", 300000, 'B', 'd', 2, 3, true);
+}
+
+BOOST_AUTO_TEST_CASE(DecompressionMemoryLimit) {
+  test(1000000, 0, "", 10000000, 'B', 'd', 8, 1, false, 1);
+  test(1000000, 0, "", 10000000, 'B', 'd', 8, 1, false, 6000000);
+  test(1000000, 50, "pp", 10000000, 'B', 'd', 8, 2, false, 1);
+  test(100000, 2, "", 1000000, 'B', 'd', 1, 3, false, 3000000);
+}
+
+BOOST_AUTO_TEST_CASE(SequentialOutput) {
+  testSequentialOutput(100000, 100000, 'B', 1);
+  testSequentialOutput(100000, 100000, 'B', 3);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE(WithHuffmanCoders)
 
+BOOST_AUTO_TEST_CASE(SkewedDistribution) {
+  testSkewed('H');
+}
+
 BOOST_AUTO_TEST_CASE(SingleStartingPointSingleBlockNoPreprocessing) {
   test(100, 0, "", 1000, 'H', 'd', 1);
   test(1000, 0, "", 10000, 'H', 'd', 1);
@@ -202,9 +326,125 @@ BOOST_AUTO_TEST_CASE(MultipleStartingPoints) {
     test(10000, 0, "", 100000, 'H', 'd', i);
 }
 
+BOOST_AUTO_TEST_CASE(MultipleThreads) {
+  test(100000, 0, "", 100000, 'H', 'd', 1, 2);
+  test(100000, 50, "", 100000, 'H', 's', 8, 4);
+  test(100000, 2, "pp", 1000000, 'H', 'd', 1, 3);
+}
+
+BOOST_AUTO_TEST_CASE(SequentialOutput) {
+  testSequentialOutput(100000, 100000, 'H', 1);
+  testSequentialOutput(100000, 100000, 'H', 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(WithHuffmanSubstreams)
+
+BOOST_AUTO_TEST_CASE(SkewedDistribution) {
+  testSkewed('P');
+}
+
+BOOST_AUTO_TEST_CASE(SingleStartingPointSingleBlock) {
+  test(100, 0, "", 1000, 'P', 'd', 1);
+  test(1000, 0, "", 10000, 'P', 'd', 1);
+  test(100000, 0, "", 1000000, 'P', 'd', 1);
+  test(100000, 2, "", 1000000, 'P', 's', 1);
+  test(100000, 50, "", 1000000, 'P', 'd', 1);
+  test(100000, 2, "pp", 1000000, 'P', 'd', 1);
+}
+
+BOOST_AUTO_TEST_CASE(SingleStartingPointMultBlock) {
+  test(100, 2, "", 100, 'P', 's', 1);
+  test(10000, 0, "", 1000, 'P', 'd', 1);
+  test(100000, 50, "ppp", 10000, 'P', 'd', 1);
+}
+
+BOOST_AUTO_TEST_CASE(MultipleThreads) {
+  test(100000, 0, "", 100000, 'P', 'd', 1, 2);
+  test(100000, 50, "", 100000, 'P', 's', 8, 4);
+}
+
+BOOST_AUTO_TEST_CASE(SequentialOutput) {
+  testSequentialOutput(100000, 100000, 'P', 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(WithRansCoders)
+
+BOOST_AUTO_TEST_CASE(SingleStartingPointSingleBlock) {
+  test(100, 0, "", 1000, 'R', 'd', 1);
+  test(1000, 0, "", 10000, 'R', 'd', 1);
+  test(100000, 0, "", 1000000, 'R', 'd', 1);
+  test(100000, 2, "", 1000000, 'R', 's', 1);
+  test(100000, 50, "", 1000000, 'R', 'd', 1);
+  test(100000, 2, "pp", 1000000, 'R', 'd', 1);
+}
+
+BOOST_AUTO_TEST_CASE(SingleStartingPointMultBlock) {
+  test(100, 2, "", 100, 'R', 's', 1);
+  test(10000, 0, "", 1000, 'R', 'd', 1);
+  test(100000, 50, "ppp", 10000, 'R', 'd', 1);
+}
+
+BOOST_AUTO_TEST_CASE(MultipleThreads) {
+  test(100000, 0, "", 100000, 'R', 'd', 1, 2);
+  test(100000, 50, "", 100000, 'R', 's', 8, 4);
+}
+
+BOOST_AUTO_TEST_CASE(SequentialOutput) {
+  testSequentialOutput(100000, 100000, 'R', 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(WithInterleavedWaveletCoders)
+
+BOOST_AUTO_TEST_CASE(SingleStartingPointSingleBlock) {
+  test(100, 0, "", 10000, 'I', 'd', 1);
+  test(1000, 0, "", 100000, 'I', 'd', 1);
+  test(100000, 0, "", 10000000, 'I', 'd', 1);
+  test(100000, 50, "", 10000000, 'I', 's', 1);
+  test(100000, 2, "pp", 1000000, 'I', 'd', 1);
+}
+
+BOOST_AUTO_TEST_CASE(SingleStartingPointMultBlock) {
+  test(100, 2, "", 100, 'I', 's', 1);
+  test(10000, 0, "", 1000, 'I', 'd', 1);
+  test(100000, 50, "", 100000, 'I', 'd', 1);
+}
+
+BOOST_AUTO_TEST_CASE(MultipleThreads) {
+  test(100000, 0, "", 100000, 'I', 'd', 1, 2);
+  test(100000, 50, "ppp", 100000, 'I', 's', 8, 4);
+}
+
+BOOST_AUTO_TEST_CASE(SequentialOutput) {
+  testSequentialOutput(100000, 100000, 'I', 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 
+BOOST_AUTO_TEST_SUITE(WithOlderFiles)
+
+BOOST_AUTO_TEST_CASE(WaveletCoders) {
+  const char* files[] = {"markov8.bwtc", "markov16.bwtc", "fsm.bwtc",
+                         "fsm8.bwtc", "evenintervals.bwtc"};
+  for(size_t i = 0; i < sizeof(files)/sizeof(files[0]); ++i) {
+    testOlderFile(files[i], 1);
+    testOlderFile(files[i], 3);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(HuffmanCoders) {
+  testOlderFile("huffman.bwtc", 1);
+  testOlderFile("huffman.bwtc", 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
 } //namespace tests
 } //namespace bwtc
 
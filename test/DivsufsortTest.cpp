@@ -48,9 +48,9 @@ void BwtDivSufTest(char *arg) {
   byte *res = new byte[len+1];
   strcpy((char*)str, arg);
 
-  std::vector<uint32> LFpowers;
+  std::vector<bwtc::uint64> LFpowers;
   LFpowers.resize(1);
-  divbwt(str, res, 0, len+1, &LFpowers[0], LFpowers.size());
+  divbwt(str, res, 0, len+1, &LFpowers[0], LFpowers.size(), 0);
 
   for(int i = 0; i < len + 1; ++i) {
     //std::cout << res[i];
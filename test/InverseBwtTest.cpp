@@ -52,13 +52,18 @@ void test(byte *t, uint32 n) {
   std::vector<byte> v(n + 1);
   std::copy(t, t + n, v.begin());
   BWTransform* transform = giveTransformer('d');
-  InverseBWTransform* inverse_transform = giveInverseTransformer();
+  InverseBWTransform* inverse_transform;
+  if (my_random(0, 1)) {
+    inverse_transform = giveInverseTransformer(my_random(1, 8));
+  } else {
+    inverse_transform = new FastInverseBWTransform();
+  }
 
   std::vector<byte> data(t, t+n);
   std::reverse(data.begin(), data.end());
   data.push_back(0);
 
-  std::vector<uint32> LFpowers;
+  std::vector<bwtc::uint64> LFpowers;
   int starting_points = my_random(1, std::min(256, (int)n));
   LFpowers.resize(starting_points);
 
@@ -113,15 +118,52 @@ void test_random(int testcases, int max_n, int max_sigma) {
   }
 }
 
-int main() {
+/* Checks that giveInverseTransformer gives the transform which fits into
+ * the memory budget. */
+template <typename Expected>
+void test_choice(uint32 threads, bwtc::uint64 n, bwtc::uint64 budget,
+                 const char* name) {
+  InverseBWTransform* inverse_transform =
+      giveInverseTransformer(threads, n, budget);
+  if (!dynamic_cast<Expected*>(inverse_transform)) {
+    fprintf(stderr,"FAIL: expected %s for n = %lu, budget = %lu\n", name,
+        (unsigned long)n, (unsigned long)budget);
+    exit(1);
+  }
+  delete inverse_transform;
+}
+
+void test_choices() {
+  bwtc::uint64 n = 100000000;
+  bwtc::uint64 mtl = MtlSaInverseBWTransform(4).maxSizeInBytes(n);
+  bwtc::uint64 mtl1 = MtlSaInverseBWTransform(1).maxSizeInBytes(n);
+  bwtc::uint64 fast = FastInverseBWTransform().maxSizeInBytes(n);
+  if (!(fast < mtl1 && mtl1 < mtl)) {
+    fprintf(stderr,"FAIL: footprints mergeTL = %lu, MTL-SA = %lu (1 thread), "
+        "%lu (4 threads)\n", (unsigned long)fast, (unsigned long)mtl1,
+        (unsigned long)mtl);
+    exit(1);
+  }
+  test_choice<MtlSaInverseBWTransform>(4, n, mtl, "MTL-SA");
+  test_choice<MtlSaInverseBWTransform>(4, n, mtl - 1, "MTL-SA");
+  test_choice<MtlSaInverseBWTransform>(1, n, mtl1, "MTL-SA");
+  test_choice<FastInverseBWTransform>(1, n, mtl1 - 1, "mergeTL");
+  test_choice<FastInverseBWTransform>(1, n, 0, "mergeTL");
+}
+
+/* By default a tenth of the test cases are run, as is done by ctest.
+ * Argument --full runs all of them. */
+int main(int argc, char **argv) {
   srand(time(0) + getpid());
-  test_random(100000,    3, 256);
-  test_random(100000,   10, 256);
-  test_random(10000,   100, 256);
-  test_random(10000,  1000, 256);
-  test_random(1000,  10000, 256);
-  test_random(1000, 100000, 256);
-  test_random(100, 1000000, 256);
+  int scale = (argc > 1 && strcmp(argv[1], "--full") == 0) ? 1 : 10;
+  test_choices();
+  test_random(100000/scale,    3, 256);
+  test_random(100000/scale,   10, 256);
+  test_random(10000/scale,   100, 256);
+  test_random(10000/scale,  1000, 256);
+  test_random(1000/scale,  10000, 256);
+  test_random(1000/scale, 100000, 256);
+  test_random(100/scale, 1000000, 256);
   fprintf(stderr,"All tests passed.\n");
   return 0;
 }
@@ -111,7 +111,7 @@ void test(int testcases, int max_n, int max_sigma) {
     std::vector<byte> data(t, t+n);
     data.push_back(0);
 
-    std::vector<uint32> LFpowers;
+    std::vector<bwtc::uint64> LFpowers;
     LFpowers.resize(starting_positions);
     transform->doTransform(&data[0], n+1, LFpowers);
 
@@ -121,7 +121,7 @@ void test(int testcases, int max_n, int max_sigma) {
     for (int i = 1; i <= n; ++i) {
       LFpow[i] = LF[LFpow[i - 1]];
     }
-    std::vector<uint32> LFpowers_simple;
+    std::vector<bwtc::uint64> LFpowers_simple;
     LFpowers_simple.resize(starting_positions);
     std::fill(LFpowers_simple.begin(), LFpowers_simple.end(), 0);
     int block_size = (n + 1) / starting_positions;
@@ -155,12 +155,12 @@ void test(int testcases, int max_n, int max_sigma) {
       fprintf(stderr,"starting_positions = %d\n", starting_positions);
       fprintf(stderr,"sais  returned: ");
       for (uint32 j = 0; j < LFpowers.size(); ++j) {
-        fprintf(stderr,"%d ", LFpowers[j]);
+        fprintf(stderr,"%lu ", (unsigned long)LFpowers[j]);
       }
       fprintf(stderr,"\n");
       fprintf(stderr,"naive returned: ");
       for (uint32 j = 0; j < LFpowers_simple.size(); ++j) {
-        fprintf(stderr,"%d ", LFpowers_simple[j]);
+        fprintf(stderr,"%lu ", (unsigned long)LFpowers_simple[j]);
       }
       fprintf(stderr,"\n");
       fprintf(stderr,"LFpows:\n");
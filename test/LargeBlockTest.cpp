@@ -0,0 +1,181 @@
+/**
+ * @file LargeBlockTest.cpp
+ *
+ * @section LICENSE
+ *
+ * This file is part of bwtc.
+ *
+ * bwtc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bwtc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bwtc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Tests for the code paths used with the blocks larger than
+ * kMaxSmallBlockSize. The blocks themselves would be too large for a unit
+ * test, so the 64-bit paths are run on small inputs and compared against
+ * the 32-bit ones. Also the milestone index of FastInverseBWTransform,
+ * which is needed only for the blocks larger than 2^24, and the allocation
+ * of the large arrays are tested.
+ */
+
+#define BOOST_TEST_MODULE
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "../globaldefs.hpp"
+#include "../BWTBlock.hpp"
+#include "../Streams.hpp"
+#include "../bwtransforms/BWTransform.hpp"
+#include "../bwtransforms/InverseBWT.hpp"
+#include "../bwtransforms/LargeArray.hpp"
+#include "../bwtransforms/SA-IS-bwt.hpp"
+#include "../bwtransforms/divsufsort.h"
+#include "../bwtransforms/divsufsort64.h"
+#include "../bwtransforms/sais.hxx"
+
+namespace bwtc {
+int verbosity = 0;
+
+namespace tests {
+
+void makeData(std::vector<byte>& data, size_t length, int sigma) {
+  for(size_t i = 0; i < length; ++i) data.push_back('a' + rand() % sigma);
+}
+
+std::vector<uint64> headerRoundTrip(uint64 length,
+                                    const std::vector<uint64>& positions,
+                                    size_t* headerBytes) {
+  BWTBlock block(0, length, true);
+  block.LFpowers() = positions;
+  MemoryOutStream out;
+  *headerBytes = block.writeHeader(&out);
+  BOOST_CHECK_EQUAL(*headerBytes, out.size());
+  std::vector<byte> bytes(out.begin(), out.end());
+  MemoryInStream in(bytes);
+  BWTBlock decoded;
+  decoded.readHeader(&in);
+  return decoded.LFpowers();
+}
+
+BOOST_AUTO_TEST_SUITE(LargeBlockTests)
+
+BOOST_AUTO_TEST_CASE(SmallBlockHeaderIsUnchanged) {
+  std::vector<uint64> positions;
+  positions.push_back(kMaxSmallBlockSize);
+  positions.push_back(12345);
+  positions.push_back(0);
+  size_t bytes;
+  std::vector<uint64> decoded =
+      headerRoundTrip(kMaxSmallBlockSize, positions, &bytes);
+  BOOST_CHECK(decoded == positions);
+  BOOST_CHECK_EQUAL(bytes, 1 + (3*31 + 7)/8);
+}
+
+BOOST_AUTO_TEST_CASE(WideBlockHeader) {
+  std::vector<uint64> positions;
+  positions.push_back(0x7fffffff);
+  positions.push_back((static_cast<uint64>(1) << 40) + 3);
+  positions.push_back(kMaxBlockSize - 1);
+  positions.push_back(0);
+  size_t bytes;
+  std::vector<uint64> decoded =
+      headerRoundTrip(kMaxSmallBlockSize + 1, positions, &bytes);
+  BOOST_CHECK(decoded == positions);
+  BOOST_CHECK_EQUAL(bytes, 1 + (31 + 4*48 + 7)/8);
+}
+
+BOOST_AUTO_TEST_CASE(Divbwt64MatchesDivbwt) {
+  std::vector<byte> data;
+  makeData(data, 100000, 4);
+  std::vector<byte> narrow(data), wide(data);
+  std::vector<uint64> narrowLF(8), wideLF(8);
+  std::vector<uint64> narrowFreqs(256), wideFreqs(256);
+  divbwtf(&narrow[0], &narrow[0], 0, narrow.size(), &narrowLF[0],
+          narrowLF.size(), &narrowFreqs[0], 0);
+  divbwtf64(&wide[0], &wide[0], 0, wide.size(), &wideLF[0],
+            wideLF.size(), &wideFreqs[0], 0);
+  BOOST_CHECK(narrow == wide);
+  BOOST_CHECK(narrowLF == wideLF);
+  BOOST_CHECK(narrowFreqs == wideFreqs);
+}
+
+BOOST_AUTO_TEST_CASE(SaisWithInt64MatchesInt) {
+  std::vector<byte> data;
+  makeData(data, 100000, 4);
+  std::vector<byte> narrow(data.size()), wide(data.size());
+  std::vector<int> sa(data.size());
+  std::vector<int64> sa64(data.size());
+  std::vector<uint64> narrowLF(8), wideLF(8);
+  saisxx_bwt(&data[0], &narrow[0], &sa[0], static_cast<int>(data.size()),
+             narrowLF, 256);
+  saisxx_bwt(&data[0], &wide[0], &sa64[0],
+             static_cast<int64>(data.size()), wideLF,
+             static_cast<int64>(256));
+  BOOST_CHECK(narrow == wide);
+  BOOST_CHECK(narrowLF == wideLF);
+}
+
+BOOST_AUTO_TEST_CASE(WideInverseTransform) {
+  for(int sigma = 1; sigma <= 26; sigma += 5) {
+    std::vector<byte> orig;
+    makeData(orig, 50000, sigma);
+    std::vector<byte> data(orig.rbegin(), orig.rend());
+    data.push_back(0);
+    std::vector<uint64> LFpowers(5);
+    BWTransform* transform = giveTransformer('d');
+    transform->doTransform(&data[0], data.size(), LFpowers);
+    delete transform;
+    WideInverseBWTransform inverse;
+    inverse.doTransform(&data[0], data.size(), LFpowers);
+    BOOST_CHECK(std::equal(orig.begin(), orig.end(), data.begin()));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(FastInverseOverSuperblocks) {
+  /* Character 'a' occurs more than 2^24 times, so its rank wraps around in
+   * the second superblock. */
+  size_t length = (1 << 24) + (1 << 20);
+  std::vector<byte> orig(length, 'a');
+  for(size_t i = 0; i < length; i += 1 + rand() % 200) {
+    orig[i] = 'b' + rand() % 4;
+  }
+  std::vector<byte> data(orig.rbegin(), orig.rend());
+  data.push_back(0);
+  std::vector<uint64> LFpowers(8);
+  BWTransform* transform = giveTransformer('d');
+  transform->doTransform(&data[0], data.size(), LFpowers);
+  delete transform;
+  FastInverseBWTransform inverse;
+  inverse.doTransform(&data[0], data.size(), LFpowers);
+  BOOST_CHECK(std::equal(orig.begin(), orig.end(), data.begin()));
+}
+
+BOOST_AUTO_TEST_CASE(LargeArrays) {
+  size_t sizes[] = {1, 1000, (5 << 20) + 3};
+  for(size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i) {
+    LargeArray<uint32> array(sizes[i]);
+    BOOST_CHECK_EQUAL(array.size(), sizes[i]);
+    BOOST_CHECK(array.pageSize() >= 4096);
+    for(size_t j = 0; j < sizes[i]; ++j) array[j] = j;
+    BOOST_CHECK_EQUAL(array[sizes[i] - 1], sizes[i] - 1);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} //namespace tests
+} //namespace bwtc
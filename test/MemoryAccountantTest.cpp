@@ -0,0 +1,82 @@
+/**
+ * @file MemoryAccountantTest.cpp
+ *
+ * @section LICENSE
+ *
+ * This file is part of bwtc.
+ *
+ * bwtc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bwtc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bwtc.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * @section DESCRIPTION
+ *
+ * Tests for choosing the block sizes with MemoryAccountant.
+ */
+
+#define BOOST_TEST_MODULE
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include "../globaldefs.hpp"
+#include "../MemoryAccountant.hpp"
+
+namespace bwtc {
+int verbosity = 0;
+
+namespace tests {
+
+/* Footprint of 5 bytes per byte, and 9 bytes per byte for the blocks
+ * larger than 1000, like with a 64-bit suffix array. */
+struct Footprint {
+  explicit Footprint(uint64 fixed) : m_fixed(fixed) {}
+  uint64 operator()(uint64 n) const {
+    return m_fixed + (n > 1000 ? 9 : 5)*n;
+  }
+  uint64 m_fixed;
+};
+
+BOOST_AUTO_TEST_SUITE(MemoryAccountantTests)
+
+BOOST_AUTO_TEST_CASE(LargestFittingBlock) {
+  MemoryAccountant memory(4100);
+  BOOST_CHECK_EQUAL(memory.largestBlock(Footprint(100), 1, 10000), 800);
+  BOOST_CHECK_EQUAL(memory.largestBlock(Footprint(100), 2, 10000), 390);
+  BOOST_CHECK_EQUAL(memory.largestBlock(Footprint(100), 1, 500), 500);
+}
+
+BOOST_AUTO_TEST_CASE(FootprintWithJump) {
+  MemoryAccountant memory(9100);
+  BOOST_CHECK_EQUAL(memory.largestBlock(Footprint(0), 1, 10000), 1011);
+}
+
+BOOST_AUTO_TEST_CASE(Reservations) {
+  MemoryAccountant memory(4100);
+  memory.reserve(2000);
+  BOOST_CHECK_EQUAL(memory.available(), 2100);
+  BOOST_CHECK_EQUAL(memory.largestBlock(Footprint(100), 1, 10000), 400);
+  memory.reserve(3000);
+  BOOST_CHECK_EQUAL(memory.available(), 0);
+  memory.release(5000);
+  BOOST_CHECK_EQUAL(memory.reserved(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(NothingFits) {
+  MemoryAccountant memory(50);
+  BOOST_CHECK_EQUAL(memory.largestBlock(Footprint(100), 1, 10000), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} //namespace tests
+} //namespace bwtc
@@ -22,12 +22,16 @@
  *
  * @section DESCRIPTION
  *
- * Testing of RawInStream and RawOutStream.
+ * Testing of RawInStream, RawOutStream, AsyncOutStream and the byte windows
+ * of the streams.
  *
  */
 
+/* The tests are made with asserts, some of which also read the streams. */
+#undef NDEBUG
 #include <cassert>
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -38,8 +42,6 @@ namespace fs = boost::filesystem;
 #include "../globaldefs.hpp"
 #include "../Streams.hpp"
 
-#undef NDEBUG
-
 using bwtc::uint64;
 using bwtc::byte;
 
@@ -132,6 +134,96 @@ void ReadFromFileTest() {
 /*********** end: ReadFromFileTest ***********/
 
 
+/* Writes over several buffers of AsyncOutStream and patches a length field
+ * in the middle of the data. */
+void AsyncWriteTest() {
+  std::vector<byte> data;
+  for(long i = 0; i < 3500000L; ++i) data.push_back((i*31 + i/7) & 0xff);
+  long position = 1500000L;
+  {
+    bwtc::AsyncOutStream out(test_fname, 2);
+    for(long i = 0; i < 1000; ++i) out.writeByte(data[i]);
+    out.writeBlock(&data[1000], &data[position]);
+    assert(out.getPos() == position);
+    for(long i = position; i < position + 6; ++i) out.writeByte(0);
+    out.writeBlock(&data[position + 6], &data[0] + data.size());
+    out.write48bits(0x0102030405ULL, position);
+    out.writeByte('x');
+  }
+  for(int i = 0; i < 6; ++i) data[position + i] = (i == 0) ? 0 : i;
+  data.push_back('x');
+
+  TestFileSize(test_fname, data.size());
+  bwtc::RawInStream in(test_fname);
+  std::vector<byte> read(data.size() + 1);
+  read.resize(in.readBlock(&read[0], read.size()));
+  assert(read == data);
+}
+
+/* Writes through the windows of the output streams in pieces which cross
+ * the buffer boundaries and reads the data back through the windows of the
+ * input streams. */
+void WriteThroughWindow(bwtc::OutStream& out, const std::vector<byte>& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    byte *end;
+    byte *pos = out.writeWindow(&end);
+    assert(pos != end);
+    size_t piece = std::min<size_t>(end - pos, 7777);
+    piece = std::min(piece, data.size() - written);
+    std::copy(&data[written], &data[written] + piece, pos);
+    out.releaseWriteWindow(pos + piece);
+    written += piece;
+    if (written < data.size()) out.writeByte(data[written++]);
+  }
+}
+
+void ReadThroughWindow(bwtc::InStream& in, const std::vector<byte>& data) {
+  size_t read = 0;
+  while (read < data.size()) {
+    const byte *end;
+    const byte *pos = in.readWindow(&end);
+    assert(pos != end);
+    size_t piece = std::min<size_t>(end - pos, 5555);
+    piece = std::min(piece, data.size() - read);
+    assert(std::equal(pos, pos + piece, &data[read]));
+    in.releaseReadWindow(pos + piece);
+    read += piece;
+    if (read < data.size()) assert(in.readByte() == data[read++]);
+  }
+  const byte *end;
+  assert(in.readWindow(&end) == end);
+}
+
+void WindowTest() {
+  std::vector<byte> data;
+  for(long i = 0; i < 2500001L; ++i) data.push_back((i*17 + i/5) & 0xff);
+  {
+    bwtc::RawOutStream out(test_fname);
+    WriteThroughWindow(out, data);
+  }
+  {
+    bwtc::RawInStream in(test_fname);
+    ReadThroughWindow(in, data);
+  }
+  {
+    bwtc::AsyncOutStream out(test_fname, 2);
+    WriteThroughWindow(out, data);
+  }
+  {
+    bwtc::MmapInStream in(test_fname);
+    assert(in.isMapped());
+    ReadThroughWindow(in, data);
+  }
+  bwtc::MemoryOutStream memOut;
+  WriteThroughWindow(memOut, data);
+  assert(memOut.size() == data.size());
+  std::vector<byte> copy(memOut.begin(), memOut.end());
+  assert(copy == data);
+  bwtc::MemoryInStream memIn(copy);
+  ReadThroughWindow(memIn, data);
+}
+
 } //namespace tests
 
 
@@ -146,6 +238,8 @@ int main(int argc, char **argv) {
   tests::EmptyWriteTest();
   tests::SimpleWriteReadTest();
   tests::ReadFromFileTest();
+  tests::AsyncWriteTest();
+  tests::WindowTest();
   std::cout << "Streams passed all tests.\n";
   return 0;
 }
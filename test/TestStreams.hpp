@@ -124,6 +124,39 @@ class TestStream : public InStream, public OutStream {
   uint32 m_currBit;
 };
 
+/**Output stream which can only be appended to, like a pipe. Attempts to
+ * seek are recorded. */
+class SequentialTestStream : public OutStream {
+ public:
+  SequentialTestStream(std::vector<byte>& data)
+      : m_data(data), m_seeked(false) {}
+
+  ~SequentialTestStream() {}
+
+  void writeByte(byte b) { m_data.push_back(b); }
+
+  void writeBlock(const byte* begin, const byte* end) {
+    m_data.insert(m_data.end(), begin, end);
+  }
+
+  long int getPos() {
+    m_seeked = true;
+    return m_data.size();
+  }
+
+  void write48bits(uint64 /*toWritten*/, long int /*position*/) {
+    m_seeked = true;
+  }
+
+  void flush() {}
+
+  bool seeked() const { return m_seeked; }
+
+ private:
+  std::vector<byte>& m_data;
+  bool m_seeked;
+};
+
 }} //namespace bwtc::tests
 
 
@@ -30,6 +30,7 @@
 #include <boost/test/unit_test.hpp>
 #include <cstring>
 #include <iterator>
+#include <map>
 #include <utility>
 #include <vector>
 #include <cstdlib>
@@ -284,6 +285,30 @@ BOOST_AUTO_TEST_CASE(WholeConstruction8) {
   }
 }
 
+/* A run longer than the limit given to the tree is coded as several runs
+ * of the same symbol. */
+BOOST_AUTO_TEST_CASE(LongRunsAreSplit) {
+  const uint32 maxRunLength = 1000;
+  size_t length = 2*maxRunLength + 5;
+  std::vector<byte> data(length, 'a');
+  data[length - 1] = 'b';
+
+  uint64 runFreqs[256] = {0};
+  std::vector<std::map<uint32, uint64> > runs(256);
+  BOOST_CHECK_EQUAL(utils::calculateRunsAndCharacters(
+      runFreqs, &data[0], length, &runs[0], maxRunLength), 4);
+  BOOST_CHECK_EQUAL(runFreqs['a'], 3);
+  BOOST_CHECK_EQUAL(runs['a'][maxRunLength], 2);
+  BOOST_CHECK_EQUAL(runs['a'][4], 1);
+  BOOST_CHECK_EQUAL(runs['b'][1], 1);
+
+  WaveletTree<PackedBitVector> tree(&data[0], length, maxRunLength);
+  BOOST_CHECK_EQUAL(tree.bitsInRoot(), 4);
+  std::vector<byte> msg;
+  BOOST_CHECK_EQUAL(tree.message(std::back_inserter(msg)), length);
+  checkEqual(msg, data);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 
@@ -386,11 +411,12 @@ class MockProbModel {
 
 BOOST_AUTO_TEST_SUITE(CodingAndDecoding)
 
+template <typename BitVector>
 void makeCodingAndDecodingTest(size_t len) {
   for(size_t i = 0; i < 5; ++i) {
     std::vector<byte> data;
     genData(data, i, len);
-    WaveletTree<std::vector<bool> > tree(&data[0], data.size());
+    WaveletTree<BitVector> tree(&data[0], data.size());
     MockCoder coded;
     tree.treeShape(coded);
     MockProbModel prob;
@@ -399,7 +425,7 @@ void makeCodingAndDecodingTest(size_t len) {
     size_t bitsInRoot = tree.bitsInRoot();
     coded.reset();
     
-    WaveletTree<std::vector<bool> > other;
+    WaveletTree<BitVector> other;
     other.readShape(coded);
     other.decodeTreeBF(bitsInRoot, coded, prob, prob, prob);
 
@@ -412,15 +438,54 @@ void makeCodingAndDecodingTest(size_t len) {
 
 BOOST_AUTO_TEST_CASE(CodingAndDecoding1) {
   srand(time(0));
-  makeCodingAndDecodingTest(100);
-  makeCodingAndDecodingTest(1000);
-  makeCodingAndDecodingTest(10000);
-  makeCodingAndDecodingTest(100000);
+  makeCodingAndDecodingTest<std::vector<bool> >(100);
+  makeCodingAndDecodingTest<std::vector<bool> >(1000);
+  makeCodingAndDecodingTest<std::vector<bool> >(10000);
+  makeCodingAndDecodingTest<std::vector<bool> >(100000);
+}
+
+BOOST_AUTO_TEST_CASE(CodingAndDecodingPacked) {
+  srand(time(0));
+  makeCodingAndDecodingTest<PackedBitVector>(100);
+  makeCodingAndDecodingTest<PackedBitVector>(1000);
+  makeCodingAndDecodingTest<PackedBitVector>(10000);
+  makeCodingAndDecodingTest<PackedBitVector>(100000);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
 
 
+BOOST_AUTO_TEST_SUITE(PackedBitVectorTests)
+
+BOOST_AUTO_TEST_CASE(PushPopAndRank) {
+  srand(time(0));
+  std::vector<bool> naive;
+  PackedBitVector packed;
+  for(size_t i = 0; i < 200000; ++i) {
+    bool bit = (rand() % 5) == 0;
+    if(i > 100000 && (rand() % 3) == 0) {
+      naive.pop_back();
+      packed.pop_back();
+    } else {
+      naive.push_back(bit);
+      packed.push_back(bit);
+    }
+  }
+  BOOST_REQUIRE_EQUAL(naive.size(), packed.size());
+  packed.buildRankDirectory();
+  size_t ones = 0;
+  for(size_t i = 0; i < naive.size(); ++i) {
+    BOOST_REQUIRE_EQUAL(naive[i], packed[i]);
+    BOOST_REQUIRE_EQUAL(ones, packed.rank(true, i));
+    BOOST_REQUIRE_EQUAL(i - ones, packed.rank(false, i));
+    if(naive[i]) ++ones;
+  }
+  BOOST_CHECK_EQUAL(ones, packed.rank(true, naive.size()));
+  BOOST_CHECK_EQUAL(ones, packed.ones());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
 BOOST_AUTO_TEST_SUITE(GammaCodes)
 
 BOOST_AUTO_TEST_CASE(Construction1) {
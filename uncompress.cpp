@@ -33,6 +33,7 @@
 #include <algorithm>
 
 #include <boost/program_options.hpp>
+#include <boost/thread.hpp>
 namespace po = boost::program_options;
 
 #include "preprocessors/Postprocessor.hpp"
@@ -48,6 +49,8 @@ using bwtc::verbosity;
 int main(int argc, char** argv) {
   std::string input_name, output_name;
   bool stdout, stdin;
+  unsigned threads;
+  uint64 mem;
 
   try {
     po::options_description description(
@@ -56,6 +59,10 @@ int main(int argc, char** argv) {
         ("help,h", "print help message")
         ("stdin,i", "input from standard in")
         ("stdout,c", "output to standard out")
+        ("threads,t", po::value<unsigned>(&threads)->default_value(1),
+         "Number of threads to use (0 means one per processor core)")
+        ("mem,m", po::value<uint64>(&mem)->default_value(0),
+         "Maximum memory to use (in MB, 0 means no limit)")
         ("verb,v", po::value<int>(&verbosity)->default_value(0),
          "verbosity level")
         ("input-file", po::value<std::string>(&input_name),
@@ -94,9 +101,16 @@ int main(int argc, char** argv) {
 
   if (stdout) output_name = "";
   if (stdin)  input_name = "";
+  if (threads == 0) threads = std::max(boost::thread::hardware_concurrency(), 1U);
+  if (verbosity > 1) {
+    std::clog << "Using " << threads << " thread(s)" << std::endl;
+  }
+  if (verbosity > 2 && mem > 0) {
+    std::clog << "Maximum memory to use = " << mem <<  "MB" << std::endl;
+  }
 
-  bwtc::Decompressor decompressor(input_name, output_name);
-  decompressor.decompress(1);
+  bwtc::Decompressor decompressor(input_name, output_name, mem*1000000);
+  decompressor.decompress(threads);
 
   PRINT_PROFILE_DATA
   return 0;